@@ -37,12 +37,16 @@ typedef u8 intr_id;
 enum {
 	// alignment
 	BASIC_TYPE_ALIGN = 8,
+	CACHE_LINE_SIZE = 64,
 
 	IRQ_CPU_OFFSET = 0x00,
 	IRQ_PIC_OFFSET = 0x20,
 
 	// Interrupt vector
 	INTR_APIC_TIMER = 0x30,
+	INTR_IPI_RESCHED = 0x50,
+	INTR_IPI_CALL = 0x51,
+	INTR_IPI_MESSAGE = 0x52,
 };
 enum {
 	PHYS_MAP_ADR    = U64(0xffff800000000000),
@@ -67,10 +71,20 @@ inline uptr map_virt_adr(const void* vadr) {
 _cpu_id get_cpu_node_id();
 _cpu_id get_cpu_lapic_id();
 int get_cpu_id();
+void post_ipi(_cpu_id id, intr_id vec);
 
 void intr_enable();
 void intr_disable();
 void intr_wait();
+_cpu_word intr_save();
+void intr_restore(_cpu_word flags);
+
+/// @brief  Time Stamp Counter を読む。
+inline u64 read_tsc() {
+	u32 lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return static_cast<u64>(hi) << 32 | lo;
+}
 
 }  // namespace arch
 
@@ -32,6 +32,7 @@ class pte;
 
 using page_table = arch::pte;
 struct PAGE_TRAITS_ARRAY;
+class tlb_gather;
 
 namespace arch {
 namespace page {
@@ -144,7 +145,12 @@ cause::t map(
 cause::t unmap(
     page_table* tbl, uptr vadr, LEVEL page_type);
 
+cause::t unmap_range(
+    page_table* tbl, uptr low_vadr, uptr high_vadr, tlb_gather* tg);
+
 void clear_tlb(void* vadr);
+void clear_tlb_range(uptr low_vadr, uptr high_vadr, uptr stride, bool global);
+void clear_tlb_all();
 
 }  // namespace page
 }  // namespace arch
@@ -20,41 +20,95 @@
 #define ARCH_X86_64_INCLUDE_ARCH_SPINLOCK_OPS_HH_
 
 #include <core/basic.hh>
+#include <arch/atomic_ops.hh>
 
 
 namespace arch {
 
-class spin_rwlock_ops
+/// @brief  キュー付きスピンロックのロックワード。
+//
+/// bit 0-7   : ロックされていれば 0 以外。
+/// bit 16-31 : キューの最後で待っている CPU を表す tail。
+///             キューが空なら 0。
+class spin_lock_ops
 {
 protected:
+	enum : u32 {
+		LOCKED      = 0x01,
+		LOCKED_MASK = 0xff,
+		TAIL_SHIFT  = 16,
+	};
+
+	volatile u32 word;
+
+	spin_lock_ops() : word(0) {}
+
+	bool is_locked() const { return (word & LOCKED_MASK) != 0; }
+
+	/// キューが空でロックされていなければロックする。
+	bool try_lock() {
+		return word == 0 &&
+		       atomic32_compare_exchange(0, LOCKED, &word) == 0;
+	}
+	/// キューの先頭の CPU だけが呼び出せる。
+	void set_locked() {
+		*locked_byte() = LOCKED;
+	}
+	void unlock() {
+		asm volatile ("" : : : "memory");
+		*locked_byte() = 0;
+	}
+
+	/// @return  直前の tail を返す。
+	u16 exchange_tail(u16 tail) {
+		return atomic16_exchange(tail, tail_half());
+	}
+	/// @brief  tail が自分だけならキューを空にしてロックする。
+	bool try_lock_and_clear_tail(u16 tail) {
+		const u32 old = u32(tail) << TAIL_SHIFT;
+		return atomic32_compare_exchange(old, LOCKED, &word) == old;
+	}
+
+private:
+	volatile u8* locked_byte() {
+		return reinterpret_cast<volatile u8*>(&word);
+	}
+	volatile u16* tail_half() {
+		return reinterpret_cast<volatile u16*>(&word) + 1;
+	}
+};
 
-#if CONFIG_MAX_CPU < 0x100
-	enum { WLOCK = -0x100 };
-	typedef s16 atom_type;
-
-#elif CONFIG_MAX_CPU < 0x10000
-	enum { WLOCK = -0x10000 };
-	typedef s32 atom_type;
-
-#elif CONFIG_MAX_CPU < 0x100000000
-	enum { WLOCK = U64(-0x100000000) };
-	typedef s64 atom_type;
-
-#else  // CONFIG_MAX_CPU
-# error "Too big CONFIG_MAX_CPU."
-
-#endif  // CONFIG_MAX_CPU
+/// @brief  writer 優先の rwlock のカウンタ。
+//
+/// bit 0-7  : writer がロックしていれば 0 以外。
+/// bit 8    : writer がロックを待っている。
+/// bit 9-31 : reader の数。
+/// writer が待っている間は新しい reader は try_rlock() に失敗する。
+class spin_rwlock_ops
+{
+protected:
+	enum : u32 {
+		WLOCKED  = 0x0ff,
+		WWAITING = 0x100,
+		WMASK    = 0x1ff,
+		RBIAS    = 0x200,
+	};
 
-	volatile atom_type atom;
+	volatile u32 cnts;
 
-	spin_rwlock_ops() : atom(0) {}
+	spin_rwlock_ops() : cnts(0) {}
 
-	bool can_rlock() { return atom >= 0; }
-	bool can_wlock() { return atom == 0; }
+	bool can_rlock() { return (cnts & WMASK) == 0; }
+	bool can_wlock() { return cnts == 0; }
+	bool is_wlocked() const { return (cnts & WLOCKED) != 0; }
 	bool try_rlock();
 	bool try_wlock();
 	void un_rlock();
 	void un_wlock();
+
+	void add_reader();
+	void set_wwaiting();
+	bool try_wlock_waiting();
 };
 
 inline void cpu_relax() {
@@ -7,12 +7,15 @@
 #define ARCH_X86_64_INCLUDE_ARCH_THREAD_CTL_HH_
 
 
+class cpu_node;
 class thread;
 
 namespace arch {
 
 thread* get_current_thread();
 void sleep_current_thread();
+cause::pair<thread*> create_kernel_thread(
+    cpu_node* owner_cpu, void (*entry)(void* param), void* param);
 
 }  // namespace arch
 
@@ -28,6 +28,7 @@ public:
 	cause::t start_thread_sched();
 	cause::t attach_boot_thread(thread* t);
 	cause::t start_message_loop();
+	void start_ap_message_loop();
 
 	void set_original_lapic_id(u8 id) { original_lapic_id = id; }
 	u8 get_original_lapic_id() const { return original_lapic_id; }
@@ -43,6 +44,7 @@ public:
 
 	void post_intr_message(message* ev);
 	void post_soft_message(message* ev);
+	void post_remote_message(message* ev);
 
 	void sleep_current_thread();
 	bool force_switch_thread();
@@ -50,12 +52,24 @@ public:
 
 	void exit_boot_thread();
 
+	void on_fpu_unavailable();
+	void begin_kernel_fpu();
+	void end_kernel_fpu();
+
+	void push_cpu_call(cpu_call* call);
+	void on_call_ipi();
+	void on_resched_ipi();
+	void on_message_ipi();
+
 private:
 	cause::t setup_tss();
 	cause::t setup_gdt();
 	cause::t setup_syscall();
 	void* ist_layout(void* mem);
 
+	bool fpu_owns(native_thread* t) const;
+	void switch_fpu(native_thread* next);
+
 	u8   inc_preempt_disable() { return ++preempt_disable_cnt; }
 	u8   dec_preempt_disable() { return --preempt_disable_cnt; }
 
@@ -272,6 +286,10 @@ private:
 
 	native_thread* message_thread;
 
+	/// 最後に FPU の状態をレジスタへ読み込んだ thread。
+	/// fpu_owns() が true の間はレジスタの状態がこの thread のもの。
+	native_thread* fpu_owner;
+
 	/// 外部割込みによって発生したイベントを溜める。
 	/// intr_evq を操作するときは CPU が割り込み禁止状態になっていなければ
 	/// ならない。
@@ -279,15 +297,25 @@ private:
 
 	message_queue soft_msgq;
 
+	/// 他の CPU から post_remote_message() で届いた message。
+	/// message_loop() でまとめて soft_msgq へ移してから処理する。
+	message_inbox remote_msgq;
+
+	/// arch::call_on_cpu() で依頼された関数。
+	spin_lock cpu_call_lock;
+	forward_chain<cpu_call, &cpu_call::chain_node> cpu_call_queue;
+
 #if CONFIG_PREEMPT
 	u8 preempt_disable_cnt;
 #endif  // CONFIG_PREEMPT
 
 public:
 
+	/// on_syscall.S が swapgs で参照する CPU ごとの領域。
+	/// レイアウトを変えるときは on_syscall.S も修正する必要がある。
 	struct {
-		uptr thread_private_info;
-		uptr tmp;
+		uptr thread_private_info;  ///< +0 running thread のカーネルスタック
+		uptr tmp;                  ///< +8 ユーザーの %rsp を一時的に置く
 	} syscall_buf;
 
 	struct {
@@ -0,0 +1,78 @@
+/// @file  native_fpu.hh
+/// @brief x87 FPU / SSE / AVX state management.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ARCH_X86_64_INCLUDE_NATIVE_FPU_HH_
+#define ARCH_X86_64_INCLUDE_NATIVE_FPU_HH_
+
+#include <core/basic.hh>
+#include <x86/native_ops.hh>
+
+
+namespace x86 {
+
+class native_thread;
+
+enum {
+	CR0_TS = 0x8,
+};
+
+cause::t fpu_cpu_setup();
+u32      fpu_get_state_bytes();
+
+cause::t fpu_alloc_state(native_thread* t);
+void     fpu_free_state(native_thread* t);
+void     fpu_save_state(native_thread* t);
+void     fpu_load_state(native_thread* t);
+
+/// CR0.TS がセットされていれば FPU を使うと #NM が発生する。
+inline bool fpu_is_trapped() {
+	return (native::get_cr0_64() & CR0_TS) != 0;
+}
+inline void fpu_trap() {
+	native::set_cr0_64(native::get_cr0_64() | CR0_TS);
+}
+inline void fpu_untrap() {
+	native::clts();
+}
+
+}  // namespace x86
+
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+/// @brief  カーネルの中で SSE / AVX を使う区間。
+//
+/// 区間の中では preempt_disable 状態になる。区間を入れ子にしてはならない。
+/// 割込みハンドラの中では使えない。
+class kernel_fpu_section
+{
+	DISALLOW_COPY_AND_ASSIGN(kernel_fpu_section);
+
+public:
+	kernel_fpu_section() {
+		kernel_fpu_begin();
+	}
+	~kernel_fpu_section() {
+		kernel_fpu_end();
+	}
+};
+
+
+#endif  // include guard
+
@@ -55,6 +55,10 @@ inline u64 get_cr3() {
 	asm volatile ("movq %%cr3, %0" : "=r" (cr3));
 	return cr3;
 }
+/// CR3 から PCID とフラグを除いた PML4 の物理アドレスを返す。
+inline u64 get_cr3_padr() {
+	return get_cr3() & U64(0x000ffffffffff000);
+}
 inline void set_cr3(u64 cr3) {
 	asm volatile ("movq %0, %%cr3" : : "r" (cr3));
 }
@@ -66,6 +70,20 @@ inline u64 get_cr4_64() {
 inline void set_cr4(u64 cr4) {
 	asm volatile ("movq %0, %%cr4" : : "r" (cr4));
 }
+inline void clts() {
+	asm volatile ("clts");
+}
+inline u64 xgetbv(u32 index) {
+	u32 l, h;
+	asm volatile ("xgetbv" : "=a" (l), "=d" (h) : "c" (index));
+	return u64(h) << 32 | l;
+}
+inline void xsetbv(u32 index, u64 val) {
+	asm volatile ("xsetbv" : :
+	    "c" (index),
+	    "a" (static_cast<u32>(val)),
+	    "d" (static_cast<u32>(val >> 32)));
+}
 inline u64 get_ef_64() {
 	u64 ef;
 	asm volatile ("pushfq\n"
@@ -0,0 +1,62 @@
+/// @file  native_pcid.hh
+/// @brief Process-context identifiers.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ARCH_X86_64_INCLUDE_NATIVE_PCID_HH_
+#define ARCH_X86_64_INCLUDE_NATIVE_PCID_HH_
+
+#include <core/basic.hh>
+
+
+class output_buffer;
+
+namespace x86 {
+
+enum {
+	/// カーネルだけのアドレス空間が使う PCID。再割り当てしない。
+	PCID_KERNEL = 0,
+	/// まだ PCID を割り当てていない。
+	PCID_NONE   = 0xffff,
+	/// PCID は 12 bit。
+	PCID_COUNT  = 4096,
+};
+
+/// @brief  アドレス空間に割り当てた PCID。
+//
+/// PCID は世代ごとに 1 から順に割り当て、使い切ったら世代を進めて
+/// 全ての PCID を割り当て直す。
+/// 同じ世代の中では PCID は 1 つのアドレス空間にしか割り当てないので、
+/// CPU は世代が変わったときだけ TLB を全てフラッシュすればよい。
+struct pcid_tag
+{
+	pcid_tag() : pcid(PCID_NONE), gen(0) {}
+
+	u16 pcid;
+	u64 gen;
+};
+
+cause::t pcid_cpu_setup();
+bool     pcid_is_enabled();
+u64      pcid_make_cr3(uptr pml4_padr, pcid_tag* tag);
+void     pcid_dump(output_buffer& ob);
+
+}  // namespace x86
+
+
+#endif  // include guard
+
@@ -25,6 +25,8 @@ public:
 
 	arch::regset* ref_regset() { return &rs; }
 
+	enum : cpu_id { FPU_CPU_NONE = 0xffffffff };
+
 	uptr get_thread_private_info() const { return thread_private_info; }
 	void set_thread_private_info(uptr info) { thread_private_info = info; }
 
@@ -33,8 +35,16 @@ public:
 	uptr stack_bytes;
 	/// swapgs でアクセスできる値
 	uptr thread_private_info;
+
+	/// FPU / SSE / AVX の状態を保存する領域。FPU を使うまでは nullptr。
+	void* fpu_state;
+	void* fpu_mem;
+	/// 最後に fpu_state をレジスタへ読み込んだ CPU。
+	cpu_id fpu_cpu;
 };
 
+cause::pair<native_thread*> create_ap_boot_thread();
+
 cause::pair<native_thread*> create_thread(
     cpu_node* owner_cpu, uptr text, uptr param);
 
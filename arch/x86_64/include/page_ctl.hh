@@ -27,6 +27,12 @@ namespace arch {
 /// @brief Page control
 class page_ctl
 {
+public:
+	void detect_paging_features();
+
+	bool has_pge() const { return pge; }
+	bool has_pcid() const { return pcid; }
+
 private:
 	bool pse;     ///< page-size extensions for 32bit paging.
 	bool pae;     ///< physical-address extension.
@@ -40,8 +46,6 @@ private:
 
 	int padr_width;
 	int vadr_width;
-
-	void detect_paging_features();
 };
 
 }  // namespace arch
@@ -118,8 +118,9 @@ class page_table_base
 {
 public:
 	enum PAGE_FLAGS {
-		EXIST = pte::P,
-		WRITE = pte::RW,
+		EXIST  = pte::P,
+		WRITE  = pte::RW,
+		GLOBAL = pte::G,
 	};
 
 protected:
@@ -171,6 +172,8 @@ public:
 	struct page_enum {
 		uptr cur_vadr;
 		uptr end_vadr;
+		/// unset_page_next() で最後に外したエントリのフラグ。
+		u64  flags;
 	};
 	cause::t unset_page_start(
 	    uptr vadr1, uptr vadr2, page_enum* pe);
@@ -272,6 +275,7 @@ cause::t page_table_tmpl<page_table_traits>::unset_page_start(
 {
 	upe->cur_vadr = down_align<uptr>(start_vadr, page::PHYS_L1_SIZE);
 	upe->end_vadr = down_align<uptr>(end_vadr,   page::PHYS_L1_SIZE);
+	upe->flags    = 0;
 
 	return cause::OK;
 }
@@ -300,6 +304,7 @@ cause::t page_table_tmpl<page_table_traits>::unset_page_next(
 					*pt = LEVELINDEX_TO_PAGETYPE[level];
 					upe->cur_vadr = cur_vadr +
 					   (UPTR(1) << PTE_INDEX_SHIFTS[level]);
+					upe->flags = ent->get() & ~ent->get_adr();
 					ent->set(0, 0);
 					return cause::OK;
 				}
@@ -325,7 +330,18 @@ cause::t page_table_tmpl<page_table_traits>::unset_page_next(
 					break;
 			}
 
+			++level;
+			if (level >= page::PHYS_LEVEL_CNT)
+				return cause::END;
+
+			// 空になったテーブルは親のエントリを外してから解放する。
+			// top は呼び出し元が解放する。
+			pte* parent = table_stack[level];
 			if (i == 512) {
+				const int parent_index =
+				    ((cur_vadr - 1) >> PTE_INDEX_SHIFTS[level]) & 0x1ff;
+				parent[parent_index].set(0, 0);
+
 				u64 padr =
 				    page_table_traits::virt_to_phys(table);
 				auto r =
@@ -334,11 +350,7 @@ cause::t page_table_tmpl<page_table_traits>::unset_page_next(
 					return r;
 			}
 
-			++level;
-			if (level >= page::PHYS_LEVEL_CNT)
-				return cause::END;
-
-			table = table_stack[level];
+			table = parent;
 		}
 	}
 }
@@ -19,9 +19,14 @@
 
 #include <arch.hh>
 #include <arch/mem_ops.hh>
+#include <arch/spinlock_ops.hh>
+#include <config.h>
+#include <core/cpu_node.hh>
 #include <core/global_vars.hh>
 #include <core/intr_ctl.hh>
 #include <core/log.hh>
+#include <core/message.hh>
+#include <native_ops.hh>
 
 
 namespace {
@@ -79,22 +84,61 @@ inline void write_reg(u32 val, LAPIC_REG offset) {
 	    reinterpret_cast<u32*>(LOCAL_APIC_REG_BASE + offset));
 }
 
+enum {
+	/// LVT Timer Register の Timer Mode が TSC-deadline。
+	LVT_TIMER_TSC_DEADLINE = 0x00040000,
+
+	MSR_IA32_TSC_DEADLINE = 0x6e0,
+};
+
+/// true ならば LVT Timer を TSC-deadline モードにする。
+bool tsc_deadline_mode;
+
+/// TSC-deadline タイマが満了したときに送る message。CPU ごとに持つ。
+message* tsc_deadline_msgs[CONFIG_MAX_CPUS];
+
+/// Local APIC ID から cpu_node の ID を引く表。
+cpu_id lapic_cpu_node_ids[256];
+
+/// cpu_node の ID から Local APIC ID を引く表。
+u8 cpu_node_lapic_ids[CONFIG_MAX_CPUS];
+
 intr_handler timer_ih;
 void timer_handler(intr_handler*)
 {
+	const cpu_id id = arch::get_cpu_node_id();
+
+	message* msg = tsc_deadline_msgs[id];
+	if (msg) {
+		tsc_deadline_msgs[id] = nullptr;
+		arch::post_intr_message(msg);
+	}
+
 	write_reg(0, LOCAL_APIC_EOI);
 }
 
-cause::t local_apic_init()
+u32 lvt_timer_value()
 {
-	log()("LAPIC version:").x(read_reg(LOCAL_APIC_VERSION))();
+	u32 val = arch::INTR_APIC_TIMER;
+	if (tsc_deadline_mode)
+		val |= LVT_TIMER_TSC_DEADLINE;
+
+	return val;
+}
 
+/// @brief  Local APIC を初期化する。
+/// @param[in] id  cpu_node の ID。
+//
+/// Local APIC ID はハードウェアの値のまま使う。x2APIC では書き換え
+/// られないし、書き換えると INIT/SIPI の宛先が他の CPU と重なる。
+/// cpu_node の ID との対応は lapic_set_cpu_node_id() で登録しておく。
+void local_apic_init(cpu_id id)
+{
 	// Local APIC enable
 	u32 tmp = read_reg(LOCAL_APIC_SVR);
 	write_reg(tmp | 0x100, LOCAL_APIC_SVR);
 
-	write_reg(0, LOCAL_APIC_ID);
-	write_reg(0x1000000, LOCAL_APIC_LDR);
+	write_reg(id < 8 ? 0x1000000 << id : 0, LOCAL_APIC_LDR);
 	write_reg(0xffffffff, LOCAL_APIC_DFR);
 
 	// Task priority lowest
@@ -103,8 +147,16 @@ cause::t local_apic_init()
 	//*local_apic_reg(LOCAL_APIC_DCR) = 0xb; // clock/1
 	write_reg(0xa, LOCAL_APIC_DCR); // clock/128
 
-	// one shot, unmask, とりあえずベクタ0x30
-	write_reg(arch::INTR_APIC_TIMER, LOCAL_APIC_LVT_TIMER);
+	// one shot または TSC-deadline, unmask, とりあえずベクタ0x30
+	write_reg(lvt_timer_value(), LOCAL_APIC_LVT_TIMER);
+}
+
+cause::t local_apic_bsp_init()
+{
+	log()("LAPIC version:").x(read_reg(LOCAL_APIC_VERSION))();
+
+	// BSP の cpu_node の ID は 0 になる。
+	local_apic_init(0);
 
 	timer_ih.handler = timer_handler;
 	global_vars::core.intr_ctl_obj->install_handler(
@@ -120,9 +172,12 @@ void set_ipi_dest(u32 id)
 }
 
 enum {
+	ICR_FIXED_MODE = 0x00000000,
 	ICR_INIT_MODE = 0x000000500,
 	ICR_STARTUP_MODE = 0x00000600,
 
+	ICR_DELIVERY_PENDING = 0x00001000,
+
 	ICR_PHYSICAL_DEST = 0x000000000,
 	ICR_LOGICAL_DEST = 0x000000800,
 
@@ -134,10 +189,25 @@ enum {
 
 	ICR_BROADCAST = 0x000c0000,
 };
-void post_ipi(u8 vec, u64 flags)
+/// @brief  IPI を送る。
+//
+/// ICR は CPU ごとにあるが ICR_HIGH と ICR_LOW の書き込みの間に
+/// 割込みハンドラが IPI を送ると宛先が書き換わるので、その間は
+/// 割込みを禁止する。
+void post_ipi(u32 dest, u8 vec, u64 flags)
 {
+	const cpu_word ef = arch::intr_save();
+
+	// 前の IPI の送信が終わるのを待つ。
+	while (read_reg(LOCAL_APIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+		arch::cpu_relax();
+
+	set_ipi_dest(dest);
+
 	u64 val = vec | flags;
 	write_reg(val, LOCAL_APIC_ICR_LOW);
+
+	arch::intr_restore(ef);
 }
 
 }  // namespace
@@ -146,9 +216,25 @@ namespace arch {
 
 cause::t apic_init()
 {
-	return local_apic_init();
+	return local_apic_bsp_init();
+}
+
+/// @brief  AP の Local APIC を初期化する。
+/// @param[in] id  AP の cpu_node の ID。
+void apic_ap_init(_cpu_id id)
+{
+	local_apic_init(id);
+}
+
+/// @brief  cpu_node の ID が id の CPU へ IPI を送る。
+void post_ipi(_cpu_id id, intr_id vec)
+{
+	::post_ipi(cpu_node_lapic_ids[id], vec,
+	    ICR_FIXED_MODE |
+	    ICR_PHYSICAL_DEST |
+	    ICR_ASSERT_LEVEL |
+	    ICR_EDGE_TRIGGER);
 }
-#include <native_ops.hh>
 void wait(u32 n)
 {
 	write_reg(n, LOCAL_APIC_INI_COUNT);
@@ -162,22 +248,74 @@ void lapic_eoi()
 	write_reg(0, LOCAL_APIC_EOI);
 }
 
-void lapic_post_init_ipi()
+/// @brief  Local APIC ID と cpu_node の ID の対応を登録する。
+/// @param[in] lapic_id  CPU の Local APIC ID。
+/// @param[in] id        その CPU の cpu_node の ID。
+//
+/// AP を起動する前に全ての CPU の分を登録しておく。
+void lapic_set_cpu_node_id(u8 lapic_id, cpu_id id)
 {
-	post_ipi(0,
+	lapic_cpu_node_ids[lapic_id] = id;
+	cpu_node_lapic_ids[id] = lapic_id;
+}
+
+/// @brief  LVT Timer を TSC-deadline モードにする。
+//
+/// 呼び出した CPU の LVT Timer を設定し直す。
+/// この後で初期化する AP も TSC-deadline モードになる。
+void lapic_enable_tsc_deadline()
+{
+	preempt_disable_section _pds;
+
+	tsc_deadline_mode = true;
+
+	write_reg(lvt_timer_value(), LOCAL_APIC_LVT_TIMER);
+}
+
+/// @brief  この CPU の TSC-deadline タイマを設定する。
+/// @param[in] tsc  満了する TSC の値。0 ならばタイマを止める。
+/// @param[in] msg  満了したときにこの CPU へ送る message。
+//
+/// msg と MSR を書き換える間に timer_handler() が古い msg を送らない
+/// ように割込みを禁止する。
+/// 既に過ぎた tsc を設定すると、割込みを許可したときに発生する。
+void lapic_set_tsc_deadline(u64 tsc, message* msg)
+{
+	const cpu_word ef = arch::intr_save();
+
+	tsc_deadline_msgs[arch::get_cpu_node_id()] = msg;
+
+	native::write_msr(tsc, MSR_IA32_TSC_DEADLINE);
+
+	arch::intr_restore(ef);
+}
+
+/// @param[in] lapic_id  起動前の AP の Local APIC ID。
+void lapic_post_init_ipi(u8 lapic_id)
+{
+	post_ipi(lapic_id, 0,
 	    ICR_INIT_MODE |
+	    ICR_PHYSICAL_DEST |
 	    ICR_ASSERT_LEVEL |
-	    ICR_EDGE_TRIGGER |
-	    ICR_BROADCAST);
+	    ICR_LEVEL_TRIGGER);
+
+	// INIT level de-assert
+	post_ipi(lapic_id, 0,
+	    ICR_INIT_MODE |
+	    ICR_PHYSICAL_DEST |
+	    ICR_DEASSERT_LEVEL |
+	    ICR_LEVEL_TRIGGER);
 }
 
-void lapic_post_startup_ipi(u8 vec)
+/// @param[in] lapic_id  起動前の AP の Local APIC ID。
+/// @param[in] vec       AP が実行を始める物理アドレスの 4KiB 単位の値。
+void lapic_post_startup_ipi(u8 lapic_id, u8 vec)
 {
-	post_ipi(vec,
+	post_ipi(lapic_id, vec,
 	    ICR_STARTUP_MODE |
+	    ICR_PHYSICAL_DEST |
 	    ICR_ASSERT_LEVEL |
-	    ICR_EDGE_TRIGGER |
-	    ICR_BROADCAST);
+	    ICR_EDGE_TRIGGER);
 }
 
 namespace arch {
@@ -186,7 +324,7 @@ _cpu_id get_cpu_node_id()
 {
 	const u32 id = read_reg(LOCAL_APIC_ID);
 
-	return id >> 24;
+	return lapic_cpu_node_ids[id >> 24];
 }
 
 _cpu_id get_cpu_lapic_id()
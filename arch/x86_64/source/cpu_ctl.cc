@@ -22,6 +22,7 @@
 #include <arch/global_vars.hh>
 #include <core/cpu_node.hh>
 #include <core/mempool.hh>
+#include <flags.hh>
 #include "kerninit.hh"
 #include <regset.hh>
 #include <x86/native_ops.hh>
@@ -114,5 +115,22 @@ void intr_wait()
 	asm volatile ("sti;hlt;cli" : : : "memory");
 }
 
+/// @brief  割込みを禁止する。
+/// @return  禁止する前の割込み許可状態を返す。intr_restore() に渡す。
+_cpu_word intr_save()
+{
+	const _cpu_word flags = native::get_ef_64();
+	native::cli();
+
+	return flags;
+}
+
+/// @brief  intr_save() で禁止する前の割込み許可状態に戻す。
+void intr_restore(_cpu_word flags)
+{
+	if (flags & x86::REGFLAGS::IF)
+		native::sti();
+}
+
 }  // namespace arch
 
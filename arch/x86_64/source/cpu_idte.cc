@@ -189,7 +189,7 @@ cause::t intr_init(idte* idt)
 		{ except_0x04, 1, 1, 0, idte::TRAP },
 		{ except_0x05, 1, 1, 0, idte::TRAP },
 		{ except_0x06, 1, 1, 0, idte::TRAP },
-		{ except_0x07, 1, 1, 0, idte::TRAP },
+		{ except_0x07, 1, 1, 0, idte::INTR },
 		{ except_0x08, 1, 1, 0, idte::TRAP },
 		{ except_0x09, 1, 1, 0, idte::TRAP },
 		{ except_0x0a, 1, 1, 0, idte::TRAP },
@@ -330,7 +330,8 @@ extern "C" void on_except_0x06() {
 	except_dump(0x06, "Invalid Opcode Exception (#UD)");
 }
 extern "C" void on_except_0x07() {
-	except_dump(0x07, "Device Not Available Exception (#NM)");
+	// Device Not Available Exception (#NM)
+	x86::get_native_cpu_node()->on_fpu_unavailable();
 }
 extern "C" void on_except_0x08() {
 	except_dump(0x08, "Double Fault Exception (#TS)");
@@ -18,6 +18,9 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
+#include <core/syscall_nr.hh>
+
+
 typedef unsigned long uptr;
 
 struct syscall_r
@@ -33,37 +36,59 @@ extern "C" syscall_r syscall3(uptr, uptr, uptr, uptr);
 extern "C" syscall_r syscall4(uptr, uptr, uptr, uptr, uptr);
 extern "C" syscall_r syscall5(uptr, uptr, uptr, uptr, uptr, uptr);
 
+/// core/sys_syscall.hh の syscall_batch_entry と同じレイアウト。
+struct batch_entry
+{
+	uptr nr;
+	uptr args[6];
+	uptr ret_cause;
+	uptr ret_value;
+};
+
 syscall_r mount(const char* source, const char* target, const char* type,
 unsigned long mountflags, const void* data)
 {
 	return syscall5((uptr)source, (uptr)target, (uptr)type,
-	    mountflags, (uptr)data, 101);
+	    mountflags, (uptr)data, SYSCALL_MOUNT);
 }
 
 syscall_r read(int iod, void* buf, uptr bytes)
 {
-	return syscall3((uptr)iod, (uptr)buf, bytes, 102);
+	return syscall3((uptr)iod, (uptr)buf, bytes, SYSCALL_READ);
 }
 
 syscall_r write(int iod, const void* buf, uptr bytes)
 {
-	//return syscall3((uptr)iod, (uptr)buf, bytes, 103);
-	return syscall5((uptr)iod, (uptr)buf, bytes, 0, 0, 103);
+	return syscall3((uptr)iod, (uptr)buf, bytes, SYSCALL_WRITE);
 }
 
 syscall_r open(const char* path, unsigned int flags)
 {
-	return syscall2((uptr)path, flags, 104);
+	return syscall2((uptr)path, flags, SYSCALL_OPEN);
 }
 
 syscall_r close(int iod)
 {
-	return syscall1(iod, 105);
+	return syscall1(iod, SYSCALL_CLOSE);
 }
 
 syscall_r mkdir(const char* path)
 {
-	return syscall1((uptr)path, 106);
+	return syscall1((uptr)path, SYSCALL_MKDIR);
+}
+
+/// @brief  entries のシステムコールを 1 回の syscall で実行する。
+syscall_r batch(batch_entry* entries, uptr count)
+{
+	return syscall2((uptr)entries, count, SYSCALL_BATCH);
+}
+
+void set_write(batch_entry* e, int iod, const void* buf, uptr bytes)
+{
+	e->nr = SYSCALL_WRITE;
+	e->args[0] = (uptr)iod;
+	e->args[1] = (uptr)buf;
+	e->args[2] = bytes;
 }
 
 extern "C" int main()
@@ -74,9 +99,14 @@ extern "C" int main()
 		syscall_r iod = open("/test", 0x01/*create*/|0x02/*write*/);
 
 		syscall1(0/*dummy*/, 100);
-		for (int i = 0; i < 256; ++i) {
-			//write(1, "X\n", 2);
-			write(iod.data, "x", 1);
+
+		// スタックは 1 ページしか無いので、256 回の write を
+		// 32 個ずつの batch にまとめる。
+		batch_entry writes[32];
+		for (int i = 0; i < 256; i += 32) {
+			for (int j = 0; j < 32; ++j)
+				set_write(&writes[j], iod.data, "x", 1);
+			batch(writes, 32);
 		}
 
 		close(iod.data);
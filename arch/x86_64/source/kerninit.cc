@@ -31,6 +31,8 @@
 #include <core/mempool.hh>
 #include <core/mem_io.hh>
 #include <core/new_ops.hh>
+#include <core/sched_balance.hh>
+#include <core/sys_syscall.hh>
 #include <core/timer_ctl.hh>
 #include <global_vars.hh>
 #include <util/string.hh>
@@ -41,14 +43,10 @@
 using namespace x86;
 
 void dump_build_info(output_buffer& ob);
-extern char _binary_arch_x86_64_kernel_ap_boot_bin_start[];
-extern char _binary_arch_x86_64_kernel_ap_boot_bin_size[];
 
 void test(void*);
 bool test_init();
 io_node* create_serial();
-u64 get_clock();
-u64 usecs_to_count(u64 usecs);
 cause::t ramfs_init();
 cause::t devfs_init();
 void kern_init2(void* context);
@@ -354,6 +352,10 @@ log(1)("memlog:")(memlog_buffer)(" size:0x").x(MEMLOG_SIZE)();
 	if (is_fail(r))
 		return r;
 
+	r = sched_balance_setup();
+	if (is_fail(r))
+		return r;
+
 	const int n = 3;
 	timer_message* tmsg = new (mem_alloc(sizeof (timer_message[n]))) timer_message[n];
 
@@ -370,50 +372,9 @@ log(1)("memlog:")(memlog_buffer)(" size:0x").x(MEMLOG_SIZE)();
 	get_jiffy_tick(&tt);
 	log()("tick=").u(tt)();
 
-	/*
-	lapic_post_init_ipi();
-	u64 initipi_clock = get_clock();
-
-	struct ap_param {
-		u64 pml4;
-		u64 entry_point;
-		void* stack;
-	};
-
-	log(1)("apboot_start=").p(_binary_arch_x86_64_kernel_ap_boot_bin_start)();
-	log(1)("apboot_size=").p(_binary_arch_x86_64_kernel_ap_boot_bin_size)();
-	u8* apboot_start = (u8*)_binary_arch_x86_64_kernel_ap_boot_bin_start;
-	uptr apboot_size = (uptr)_binary_arch_x86_64_kernel_ap_boot_bin_size;
-	u8* dest = (u8*)arch::map_phys_adr(0x1000, apboot_size);
-	for (uptr i = 0; i < apboot_size; ++i) {
-		dest[i] = apboot_start[i];
-	}
-	ap_param* app = (ap_param*)up_align<uptr>((uptr)&dest[apboot_size], 8);
-	app->pml4 = native::get_cr3();
-	app->entry_point = (u64)apentry;
-	mempool* stackmp;
-	r = mempool_acquire_shared(0x2000, &stackmp);
+	r = smp_setup();
 	if (is_fail(r))
 		return r;
-	u8* apstack = (u8*)stackmp->alloc();
-	app->stack = apstack + 0x2000;
-
-	u64 _10ms = usecs_to_count(10000);
-	u64 i;
-	for (i = 0; ; ++i) {
-		if (get_clock() >= (initipi_clock + _10ms))
-			break;
-	}
-	log(1)("loop count:").u(i)();
-	lapic_post_startup_ipi(0x01);
-	u64 startupipi_clock = get_clock();
-	u64 _200ms = usecs_to_count(200000);
-	for (i = 0; ; ++i) {
-		if (get_clock() >= (startupipi_clock + _200ms))
-			break;
-	}
-	log(1)("loop count:").u(i)();
-	*/
 
 	r = mempool_post_setup();
 	if (is_fail(r))
@@ -495,6 +456,10 @@ log(1)("memlog:")(memlog_buffer)(" size:0x").x(MEMLOG_SIZE)();
 	if (is_fail(r))
 		return r;
 
+	r = uniqos::syscall_setup();
+	if (is_fail(r))
+		return r;
+
 	r = create_first_process(serial);
 	if (is_fail(r)) {
 		log()("create_first_process() failed")();
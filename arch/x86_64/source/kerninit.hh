@@ -6,11 +6,16 @@
 #ifndef ARCH_X86_64_SOURCE_KERNINIT_HH_
 #define ARCH_X86_64_SOURCE_KERNINIT_HH_
 
+#include <arch.hh>
 #include <core/setup.hh>
 
 
+class message;
+
 cause::t cpu_page_init();
 cause::t irq_setup();
+cause::t smp_setup();
+extern "C" void ap_entry(u64 cpu_node_id);
 
 namespace x86 {
 
@@ -25,12 +30,16 @@ cause::t create_boot_thread();
 namespace arch {
 
 cause::t apic_init();
+void apic_ap_init(_cpu_id id);
 void wait(u32 n);
 
 }  // namespace arch
 
-void lapic_post_init_ipi();
-void lapic_post_startup_ipi(u8 vec);
+void lapic_set_cpu_node_id(u8 lapic_id, cpu_id id);
+void lapic_post_init_ipi(u8 lapic_id);
+void lapic_post_startup_ipi(u8 lapic_id, u8 vec);
+void lapic_enable_tsc_deadline();
+void lapic_set_tsc_deadline(u64 tsc, message* msg);
 
 
 #endif  // include guard
@@ -20,6 +20,9 @@
 
 #include "cpu_ctl.hh"
 #include "flags.hh"
+#include "native_fpu.hh"
+#include "native_pcid.hh"
+#include "native_process.hh"
 #include "native_thread.hh"
 #include "native_pagetbl.hh"
 #include "pagetable.hh"
@@ -28,12 +31,16 @@
 #include <core/mempool.hh>
 #include <core/new_ops.hh>
 #include <core/page.hh>
+#include <core/rcu.hh>
+#include <core/sched_balance.hh>
+#include <core/tlb_gather.hh>
 #include <global_vars.hh>
 #include <x86/native_ops.hh>
 
 
 extern char on_syscall[];
-extern "C" void native_switch_regset(arch::regset* r1, arch::regset* r2);
+extern "C" void native_switch_regset(
+    arch::regset* r1, arch::regset* r2, volatile bool* saved);
 
 namespace {
 
@@ -55,6 +62,8 @@ namespace x86 {
 
 native_cpu_node::native_cpu_node(cpu_id cpunode_id) :
 	cpu_node(cpunode_id),
+	message_thread(nullptr),
+	fpu_owner(nullptr),
 	preempt_disable_cnt(0)
 {
 }
@@ -81,6 +90,14 @@ cause::t native_cpu_node::setup()
 	if (is_fail(r))
 		return r;
 
+	r = fpu_cpu_setup();
+	if (is_fail(r))
+		return r;
+
+	r = pcid_cpu_setup();
+	if (is_fail(r))
+		return r;
+
 	return cause::OK;
 }
 
@@ -101,7 +118,8 @@ cause::t native_cpu_node::start_thread_sched()
 
 	native_switch_regset(
 	    static_cast<x86::native_thread*>(th2)->ref_regset(),
-	    static_cast<x86::native_thread*>(th1)->ref_regset());
+	    static_cast<x86::native_thread*>(th1)->ref_regset(),
+	    th1->ref_sched_on_cpu());
 
 	return cause::FAIL;
 }
@@ -120,11 +138,36 @@ cause::t native_cpu_node::start_message_loop()
 
 	message_thread = r.data();
 
+	// 割込みからのメッセージを CPU を使い続ける thread の後ろで
+	// 待たせないようにする。
+	message_thread->set_sched_urgent(true);
+
+	// message_thread はこの CPU のメッセージを処理するので移動しない。
+	message_thread->set_sched_pinned(true);
+
 	ready_thread(message_thread);
 
+	set_online();
+
 	return cause::OK;
 }
 
+/// @brief  AP の boot thread を message_thread にしてメッセージループを
+///         始める。
+//
+/// AP の boot thread から呼び出す。この関数は戻らない。
+void native_cpu_node::start_ap_message_loop()
+{
+	message_thread = get_current_native_thread();
+
+	message_thread->set_sched_urgent(true);
+	message_thread->set_sched_pinned(true);
+
+	set_online();
+
+	message_loop();
+}
+
 /// running thread が変わったらこの関数を呼び出す必要がある
 /// @param[in] t  Ptr to new running thread.
 void native_cpu_node::load_running_thread(thread* t)
@@ -133,6 +176,107 @@ void native_cpu_node::load_running_thread(thread* t)
 
 	syscall_buf.thread_private_info = nt->thread_private_info;
 	intr_buf.running_thread_regset = nt->ref_regset();
+
+	// PCID の世代が変わっているかもしれないので、CR3 は切り替えるたびに
+	// 作り直す。
+	native_process* np = static_cast<native_process*>(nt->get_owner_process());
+	if (np)
+		nt->rs.cr3 = np->make_cr3();
+
+	switch_fpu(nt);
+}
+
+/// @brief  レジスタの FPU の状態が t のものなら true を返す。
+//
+/// t が他の CPU で FPU を使った後は、fpu_owner が t のままでも
+/// レジスタの状態は古い。
+bool native_cpu_node::fpu_owns(native_thread* t) const
+{
+	return fpu_owner == t && t->fpu_cpu == get_cpu_node_id();
+}
+
+/// @brief  next に切り替えるときの FPU の状態を用意する。
+//
+/// CR0.TS がクリアされていれば fpu_owner が FPU を使ったので、
+/// fpu_owner の状態を保存する。FPU を使わない thread は保存も復元もしない。
+/// CONFIG_FPU_EAGER == 0 なら、next が FPU を使ったときに
+/// on_fpu_unavailable() で復元する。
+void native_cpu_node::switch_fpu(native_thread* next)
+{
+	const bool live = !fpu_is_trapped();
+
+	if (live && fpu_owner && fpu_owner != next)
+		fpu_save_state(fpu_owner);
+
+	if (fpu_owns(next)) {
+		if (!live)
+			fpu_untrap();
+		return;
+	}
+
+#if CONFIG_FPU_EAGER
+	if (next->fpu_state) {
+		if (!live)
+			fpu_untrap();
+		fpu_load_state(next);
+		fpu_owner = next;
+		next->fpu_cpu = get_cpu_node_id();
+		return;
+	}
+#endif  // CONFIG_FPU_EAGER
+
+	if (live)
+		fpu_trap();
+}
+
+/// @brief  #NM 例外で、実行中の thread の FPU の状態を復元する。
+//
+/// 割込みゲートから呼ばれるので割込み禁止状態になっている。
+/// 途中で割込みが許可されないように preempt_disable のカウントだけを増やす。
+void native_cpu_node::on_fpu_unavailable()
+{
+	inc_preempt_disable();
+
+	native_thread* t = static_cast<native_thread*>(threads.get_running_thread());
+
+	fpu_untrap();
+
+	if (!fpu_owns(t)) {
+		if (!t->fpu_state) {
+			cause::t r = fpu_alloc_state(t);
+			if (is_fail(r)) {
+				log()("!!! FPU state allocation failed. thread:")
+				     (t)(" r=").u(r)();
+				for (;;)
+					native::hlt();
+			}
+		}
+
+		fpu_load_state(t);
+		fpu_owner = t;
+		t->fpu_cpu = get_cpu_node_id();
+	}
+
+	dec_preempt_disable();
+}
+
+/// @brief  kernel_fpu_begin() から呼ばれる。
+void native_cpu_node::begin_kernel_fpu()
+{
+	if (fpu_is_trapped())
+		fpu_untrap();
+	else if (fpu_owner)
+		fpu_save_state(fpu_owner);
+
+	// レジスタはカーネルが上書きするので、次に FPU を使う thread は
+	// 保存した状態から復元する必要がある。
+	fpu_owner = nullptr;
+}
+
+/// @brief  kernel_fpu_end() から呼ばれる。
+void native_cpu_node::end_kernel_fpu()
+{
+	fpu_trap();
 }
 
 cause::t native_cpu_node::setup_tss()
@@ -167,7 +311,9 @@ cause::t native_cpu_node::setup_tss()
 
 cause::t native_cpu_node::setup_syscall()
 {
-	// syscall から swapgs で syscall_buf へアクセスできるようにする
+	// syscall から swapgs で syscall_buf へアクセスできるようにする。
+	// KERNEL_GS_BASE は CPU ごとの MSR なので、各 CPU で自分の
+	// syscall_buf を設定する。
 	const uptr gs_base = reinterpret_cast<uptr>(&syscall_buf);
 	native::write_msr(gs_base, 0xc0000102);
 
@@ -276,6 +422,69 @@ void native_cpu_node::post_soft_message(message* ev)
 	preempt_enable();
 }
 
+/// @brief  他の CPU からこの CPU へ message を送る。
+//
+/// 箱が空だったときだけ INTR_IPI_MESSAGE で知らせる。空でなければ、
+/// 先に送った CPU の IPI でこの CPU の message_thread が既に起こされて
+/// いて、まだ箱を空にしていないので IPI は不要。
+/// online になる前に届いた message は message_loop() の開始後に処理する。
+void native_cpu_node::post_remote_message(message* ev)
+{
+	if (remote_msgq.push(ev) && is_online())
+		arch::post_ipi(get_cpu_node_id(), arch::INTR_IPI_MESSAGE);
+}
+
+/// @brief  他の CPU から arch::call_on_cpu() で依頼された関数を登録する。
+void native_cpu_node::push_cpu_call(cpu_call* call)
+{
+	spin_lock_section _cl_sec(cpu_call_lock);
+
+	cpu_call_queue.push_back(call);
+}
+
+/// @brief  INTR_IPI_CALL の割込みで、依頼された関数を全て実行する。
+void native_cpu_node::on_call_ipi()
+{
+	for (;;) {
+		cpu_call* call;
+		{
+			spin_lock_section_np _cl_sec(cpu_call_lock);
+			call = cpu_call_queue.pop_front();
+		}
+		if (!call)
+			break;
+
+		call->func(call->arg);
+
+		// done を書いた後は call を参照してはならない。
+		// x86 ではストアの順序は入れ替わらないので、コンパイラの
+		// 最適化だけを抑止する。
+		asm volatile ("" : : : "memory");
+		call->done = true;
+	}
+}
+
+/// @brief  INTR_IPI_RESCHED の割込みで、実行するスレッドを選び直す。
+//
+/// message_thread に切り替えると、message_thread がメッセージを処理した
+/// 後で次のスレッドを選ぶ。
+void native_cpu_node::on_resched_ipi()
+{
+	if (message_thread)
+		switch_messenger_after_intr();
+}
+
+/// @brief  INTR_IPI_MESSAGE の割込みで message_thread を起こす。
+//
+/// remote_msgq は message_loop() で取り出す。
+void native_cpu_node::on_message_ipi()
+{
+	if (message_thread) {
+		ready_thread_np(message_thread);
+		switch_messenger_after_intr();
+	}
+}
+
 /// @brief  Make running thread sleep.
 void native_cpu_node::sleep_current_thread()
 {
@@ -303,7 +512,8 @@ bool native_cpu_node::force_switch_thread()
 
 	native_switch_regset(
 	    static_cast<x86::native_thread*>(next_thr)->ref_regset(),
-	    static_cast<x86::native_thread*>(prev_thr)->ref_regset());
+	    static_cast<x86::native_thread*>(prev_thr)->ref_regset(),
+	    prev_thr->ref_sched_on_cpu());
 
 	return true;
 }
@@ -312,11 +522,19 @@ bool native_cpu_node::force_switch_thread()
 //
 /// 割込み処理中にこの関数を使うと、割込み終了後の iret の後に実行するスレッド
 /// を指定できる。割込み処理以外の状態でこの関数を呼んではならない。
+//
+/// 割込みハンドラは IST で動き、それまでのスレッドのコンテキストは割込み
+/// の入口で保存し終えているので、すぐに sched_on_cpu を false にする。
 void native_cpu_node::switch_thread_after_intr(native_thread* t)
 {
+	thread* prev = threads.get_running_thread();
+
 	force_set_running_thread(t);
 
 	load_running_thread(t);
+
+	if (prev != t)
+		*prev->ref_sched_on_cpu() = false;
 }
 
 /// exit boot thread
@@ -324,46 +542,17 @@ void native_cpu_node::switch_thread_after_intr(native_thread* t)
 cause::t release_pages(uptr adr, uptr bytes)
 {
 	uptr align_adr = up_align<uptr>(adr, arch::page::PHYS_L1_SIZE);
+	if (bytes <= align_adr - adr)
+		return cause::OK;
+
 	bytes -= align_adr - adr;
 	adr = align_adr;
 
-	for (;;) {
-		if ((adr & (arch::page::PHYS_L3_SIZE - 1)) == 0
-		  && bytes >= arch::page::PHYS_L3_SIZE)
-		{
-			auto r = page_dealloc(arch::page::PHYS_L3, adr);
-			if (is_fail(r))
-				return r;
-
-			adr += arch::page::PHYS_L3_SIZE;
-			bytes -= arch::page::PHYS_L3_SIZE;
-		}
-		else if ((adr & (arch::page::PHYS_L2_SIZE - 1)) == 0
-		  && bytes >= arch::page::PHYS_L2_SIZE)
-		{
-			auto r = page_dealloc(arch::page::PHYS_L2, adr);
-			if (is_fail(r))
-				return r;
-
-			adr += arch::page::PHYS_L2_SIZE;
-			bytes -= arch::page::PHYS_L2_SIZE;
-		}
-		else if ((adr & (arch::page::PHYS_L1_SIZE - 1)) == 0
-		  && bytes >= arch::page::PHYS_L1_SIZE)
-		{
-			auto r = page_dealloc(arch::page::PHYS_L1, adr);
-			if (is_fail(r))
-				return r;
+	const uptr count = bytes >> arch::page::PHYS_L1_SIZE_BITS;
+	if (count == 0)
+		return cause::OK;
 
-			adr += arch::page::PHYS_L1_SIZE;
-			bytes -= arch::page::PHYS_L1_SIZE;
-		}
-		else {
-			break;
-		}
-	}
-
-	return cause::OK;
+	return page_dealloc_contig(adr, count);
 }
 
 typedef message_with<thread*> exit_thread_message;
@@ -397,28 +586,19 @@ void exit_boot_thread_handler(message* m)
 		read_bytes += sizeof memwork->entries[i];
 	}
 
-	arch::pte* pt = static_cast<arch::pte*>(
-	    arch::map_phys_adr(boot_thr->rs.cr3, 0x1000));
-	native_page_table tbl(pt);
-	native_page_table::page_enum pe;
-	r = tbl.unset_page_start(0, UPTR(0x00007fffffffffff), &pe);
-	if (is_fail(r)) {
-		log()("unset_page_start = ").u(r)();
-		return;
-	}
-	uptr vadr;
-	u64 padr;
-	arch::page::TYPE page_type;
-	for (int i = 0; ; ++i) {
-		r = tbl.unset_page_next(&pe, &vadr, &padr, &page_type);
-		if (is_fail(r)) {
-			log()("unset_page_next = ").
-			    u(r)(":").x(pe.cur_vadr)(':').x(pe.end_vadr)();
-			break;
-		}
-	}
+	// boot thread のページテーブルは全ての CPU が使っているので、
+	// 全ての CPU の TLB をフラッシュする。
+	// rs.cr3 には PCID のビットが含まれているかもしれない。
+	arch::pte* pt = static_cast<arch::pte*>(arch::map_phys_adr(
+	    boot_thr->rs.cr3 & U64(0x000ffffffffff000), 0x1000));
+	tlb_gather tg(pt, tlb_gather::ACTIVE);
+	r = tg.unmap_range(0, UPTR(0x00007fffffffffff));
+	if (is_fail(r))
+		log()("!!!")(SRCPOS)(" tlb_gather::unmap_range() failed.")();
 
-	r = tbl.unset_page_end(&pe);
+	r = tg.finish();
+	if (is_fail(r))
+		log()("!!!")(SRCPOS)(" tlb_gather::finish() failed.")();
 }
 
 /// @brief Exit boot thread.
@@ -457,7 +637,8 @@ void native_cpu_node::exit_boot_thread()
 
 	native_switch_regset(
 	    static_cast<x86::native_thread*>(next_thr)->ref_regset(),
-	    static_cast<x86::native_thread*>(boot_thr)->ref_regset());
+	    static_cast<x86::native_thread*>(boot_thr)->ref_regset(),
+	    boot_thr->ref_sched_on_cpu());
 }
 
 void native_cpu_node::message_loop()
@@ -468,9 +649,18 @@ void native_cpu_node::message_loop()
 		arch::intr_enable();
 		arch::intr_disable();
 
+		if (rcu_quiescent())
+			continue;
+
+#if CONFIG_NO_HZ
+		sched_balance_restart();
+#endif  // CONFIG_NO_HZ
+
 		if (intr_msgq.deliv_all_np())
 			continue;
 
+		remote_msgq.take_all(&soft_msgq);
+
 		if (soft_msgq.deliv_np())
 			continue;
 
@@ -486,7 +676,12 @@ void native_cpu_node::message_loop()
 		if (r)
 			continue;
 
-		arch::intr_wait();
+		if (sched_balance_idle(this))
+			continue;
+
+		drain_page_cache();
+
+		preempt_wait();
 	}
 }
 
@@ -508,7 +703,8 @@ void native_cpu_node::_sleep_current_thread()
 
 		native_switch_regset(
 		    static_cast<x86::native_thread*>(next_run)->ref_regset(),
-		    static_cast<x86::native_thread*>(prev_run)->ref_regset());
+		    static_cast<x86::native_thread*>(prev_run)->ref_regset(),
+		    prev_run->ref_sched_on_cpu());
 	}
 }
 
@@ -564,7 +760,14 @@ void post_cpu_message(message* msg)
 
 void post_cpu_message(message* msg, cpu_node* cpu)
 {
-	static_cast<x86::native_cpu_node*>(cpu)->post_soft_message(msg);
+	x86::native_cpu_node* ncn = static_cast<x86::native_cpu_node*>(cpu);
+
+	preempt_disable_section _pds;
+
+	if (cpu == get_cpu_node())
+		ncn->post_soft_message(msg);
+	else
+		ncn->post_remote_message(msg);
 }
 
 }  // namespace arch
@@ -0,0 +1,284 @@
+/// @file   native_fpu.cc
+/// @brief  x87 FPU / SSE / AVX state management.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <native_fpu.hh>
+
+#include <core/cpu_node.hh>
+#include <core/log.hh>
+#include <core/mempool.hh>
+#include <native_cpu_node.hh>
+#include <native_thread.hh>
+#include <util/string.hh>
+
+
+namespace {
+
+enum {
+	CR0_MP = 0x2,
+	CR0_EM = 0x4,
+	CR0_NE = 0x20,
+
+	CR4_OSFXSR     = 0x200,
+	CR4_OSXMMEXCPT = 0x400,
+	CR4_OSXSAVE    = 0x40000,
+
+	XCR0_X87 = 0x1,
+	XCR0_SSE = 0x2,
+	XCR0_AVX = 0x4,
+
+	CPUID1_ECX_XSAVE = 0x04000000,
+	CPUID1_ECX_AVX   = 0x10000000,
+	CPUID1_EDX_FXSR  = 0x01000000,
+	CPUID0D1_EAX_XSAVEOPT = 0x1,
+
+	/// FXSAVE 領域のサイズ
+	FXSAVE_BYTES = 512,
+	/// XSAVE 領域は 64 バイト境界に置く必要がある。
+	STATE_ALIGN = 64,
+
+	/// FXSAVE 領域の中のオフセット
+	FCW_OFFSET   = 0,
+	MXCSR_OFFSET = 24,
+
+	FCW_INIT   = 0x037f,
+	MXCSR_INIT = 0x1f80,
+};
+
+enum SAVE_MODE {
+	SAVE_FXSAVE,
+	SAVE_XSAVE,
+	SAVE_XSAVEOPT,
+};
+
+struct fpu_info
+{
+	SAVE_MODE mode;
+	/// XCR0 にセットする値。XSAVE / XRSTOR の対象になる。
+	u64 xcr0;
+	/// 1 thread の状態を保存するために必要なバイト数。
+	u32 state_bytes;
+	/// 状態を保存する領域。STATE_ALIGN で揃えるために余分に確保する。
+	mempool* state_mp;
+} fpu;
+
+void cpuid(u32 leaf, u32 subleaf, u32* a, u32* b, u32* c, u32* d)
+{
+	asm volatile ("cpuid" :
+	    "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) :
+	    "a"(leaf), "c"(subleaf));
+}
+
+/// @brief  使える命令と XCR0 を決める。
+cause::t detect_features()
+{
+	u32 a, b, c, d;
+	cpuid(0x01, 0, &a, &b, &c, &d);
+
+	if (!(d & CPUID1_EDX_FXSR)) {
+		log()("!!! FXSAVE is not supported.")();
+		return cause::NODEV;
+	}
+
+	if (!(c & CPUID1_ECX_XSAVE)) {
+		fpu.mode = SAVE_FXSAVE;
+		fpu.xcr0 = 0;
+		return cause::OK;
+	}
+
+	u64 xcr0 = XCR0_X87 | XCR0_SSE;
+	if (c & CPUID1_ECX_AVX)
+		xcr0 |= XCR0_AVX;
+
+	cpuid(0x0d, 0, &a, &b, &c, &d);
+	fpu.xcr0 = xcr0 & (u64(d) << 32 | a);
+
+	cpuid(0x0d, 1, &a, &b, &c, &d);
+	fpu.mode = (a & CPUID0D1_EAX_XSAVEOPT) ? SAVE_XSAVEOPT : SAVE_XSAVE;
+
+	return cause::OK;
+}
+
+/// @brief  XCR0 を設定した後で、状態の保存に必要なサイズを調べる。
+cause::t setup_state_pool()
+{
+	if (fpu.mode == SAVE_FXSAVE) {
+		fpu.state_bytes = FXSAVE_BYTES;
+	} else {
+		u32 a, b, c, d;
+		cpuid(0x0d, 0, &a, &b, &c, &d);
+		// EBX は現在の XCR0 で必要なサイズ
+		fpu.state_bytes = b;
+	}
+
+	auto r = mempool::acquire_shared(fpu.state_bytes + STATE_ALIGN - 1);
+	if (is_fail(r))
+		return r.cause();
+
+	fpu.state_mp = r.value();
+
+	log()("FPU: mode=").u(fpu.mode)
+	     (" xcr0=0x").x(fpu.xcr0)
+	     (" state_bytes=").u(fpu.state_bytes)();
+
+	return cause::OK;
+}
+
+}  // namespace
+
+namespace x86 {
+
+/// @brief  この CPU で FPU / SSE / AVX を使えるようにする。
+//
+/// 最初に呼び出したとき（BSP）に CPU の機能を調べる。
+/// 設定後は CR0.TS をセットするので、FPU を最初に使った thread で #NM が
+/// 発生する。
+cause::t fpu_cpu_setup()
+{
+	const bool first = fpu.state_mp == nullptr;
+
+	if (first) {
+		cause::t r = detect_features();
+		if (is_fail(r))
+			return r;
+	}
+
+	u64 cr0 = native::get_cr0_64();
+	cr0 &= ~CR0_EM;
+	cr0 |= CR0_MP | CR0_NE | CR0_TS;
+	native::set_cr0_64(cr0);
+
+	u64 cr4 = native::get_cr4_64();
+	cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if (fpu.mode != SAVE_FXSAVE)
+		cr4 |= CR4_OSXSAVE;
+	native::set_cr4(cr4);
+
+	if (fpu.mode != SAVE_FXSAVE)
+		native::xsetbv(0, fpu.xcr0);
+
+	if (first)
+		return setup_state_pool();
+
+	return cause::OK;
+}
+
+u32 fpu_get_state_bytes()
+{
+	return fpu.state_bytes;
+}
+
+/// @brief  t の状態を保存する領域を確保する。
+//
+/// 領域は初期状態にしておく。XSAVE の header は 0 なので、
+/// XRSTOR すると全ての状態が init state になる。
+cause::t fpu_alloc_state(native_thread* t)
+{
+	auto r = fpu.state_mp->acquire();
+	if (is_fail(r))
+		return r.cause();
+
+	void* mem = r.value();
+	u8* st = reinterpret_cast<u8*>(
+	    up_align<uptr>(reinterpret_cast<uptr>(mem), STATE_ALIGN));
+
+	mem_fill(0, st, fpu.state_bytes);
+	*reinterpret_cast<u16*>(st + FCW_OFFSET) = FCW_INIT;
+	*reinterpret_cast<u32*>(st + MXCSR_OFFSET) = MXCSR_INIT;
+
+	t->fpu_mem = mem;
+	t->fpu_state = st;
+
+	return cause::OK;
+}
+
+void fpu_free_state(native_thread* t)
+{
+	if (!t->fpu_mem)
+		return;
+
+	fpu.state_mp->release(t->fpu_mem);
+
+	t->fpu_mem = nullptr;
+	t->fpu_state = nullptr;
+	t->fpu_cpu = native_thread::FPU_CPU_NONE;
+}
+
+/// @brief  レジスタの状態を t の領域へ保存する。
+//
+/// XSAVEOPT は最後に XRSTOR した領域へ保存するときに、変更されていない
+/// 部分や init state の部分の書き込みを省く。
+/// CR0.TS がクリアされた状態で呼び出す必要がある。
+void fpu_save_state(native_thread* t)
+{
+	const u32 l = static_cast<u32>(fpu.xcr0);
+	const u32 h = static_cast<u32>(fpu.xcr0 >> 32);
+
+	switch (fpu.mode) {
+	case SAVE_XSAVEOPT:
+		asm volatile ("xsaveopt64 (%0)" : :
+		    "r"(t->fpu_state), "a"(l), "d"(h) : "memory");
+		break;
+	case SAVE_XSAVE:
+		asm volatile ("xsave64 (%0)" : :
+		    "r"(t->fpu_state), "a"(l), "d"(h) : "memory");
+		break;
+	case SAVE_FXSAVE:
+		asm volatile ("fxsave64 (%0)" : :
+		    "r"(t->fpu_state) : "memory");
+		break;
+	}
+}
+
+/// @brief  t の領域からレジスタへ状態を読み込む。
+//
+/// CR0.TS がクリアされた状態で呼び出す必要がある。
+void fpu_load_state(native_thread* t)
+{
+	const u32 l = static_cast<u32>(fpu.xcr0);
+	const u32 h = static_cast<u32>(fpu.xcr0 >> 32);
+
+	if (fpu.mode == SAVE_FXSAVE) {
+		asm volatile ("fxrstor64 (%0)" : :
+		    "r"(t->fpu_state) : "memory");
+	} else {
+		asm volatile ("xrstor64 (%0)" : :
+		    "r"(t->fpu_state), "a"(l), "d"(h) : "memory");
+	}
+}
+
+}  // namespace x86
+
+/// @brief  カーネルの中で SSE / AVX を使い始める。
+//
+/// レジスタに残っている thread の状態は保存してから使う。
+/// kernel_fpu_end() まで preempt_disable 状態になる。
+void kernel_fpu_begin()
+{
+	preempt_disable();
+
+	x86::get_native_cpu_node()->begin_kernel_fpu();
+}
+
+void kernel_fpu_end()
+{
+	x86::get_native_cpu_node()->end_kernel_fpu();
+
+	preempt_enable();
+}
+
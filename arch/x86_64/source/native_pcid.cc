@@ -0,0 +1,169 @@
+/// @file   native_pcid.cc
+/// @brief  Process-context identifiers.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <native_pcid.hh>
+
+#include <arch.hh>
+#include <arch/pagetbl.hh>
+#include <core/output_buffer.hh>
+#include <core/spinlock.hh>
+#include <page_ctl.hh>
+#include <util/atomic.hh>
+#include <x86/native_ops.hh>
+
+
+namespace {
+
+enum {
+	CR4_PGE   = 0x80,
+	CR4_PCIDE = 0x20000,
+};
+
+/// CR3 の bit 63 をセットして書き込むと、TLB をフラッシュしない。
+const u64 CR3_NOFLUSH = U64(1) << 63;
+
+struct pcid_info
+{
+	pcid_info() :
+		detected(false),
+		enabled(false),
+		gen(1),
+		next_pcid(x86::PCID_KERNEL + 1),
+		rollover_cnt(0),
+		flush_cnt(0)
+	{}
+
+	bool detected;
+	bool enabled;
+
+	spin_lock lock;
+	/// 現在の世代。
+	u64 volatile gen;
+	/// 次に割り当てる PCID。
+	u32 next_pcid;
+
+	/// CPU ごとに、TLB を全てフラッシュした世代。
+	u64 cpu_gen[CONFIG_MAX_CPUS];
+
+	atomic<u64> rollover_cnt;
+	atomic<u64> flush_cnt;
+} pcid;
+
+/// @brief  tag に今の世代の PCID を割り当てる。
+void assign_pcid(x86::pcid_tag* tag)
+{
+	spin_lock_section _sls(pcid.lock);
+
+	if (tag->gen == pcid.gen)
+		return;
+
+	if (pcid.next_pcid >= x86::PCID_COUNT) {
+		pcid.gen = pcid.gen + 1;
+		pcid.next_pcid = x86::PCID_KERNEL + 1;
+		pcid.rollover_cnt.inc();
+	}
+
+	tag->pcid = pcid.next_pcid++;
+	tag->gen = pcid.gen;
+}
+
+}  // namespace
+
+namespace x86 {
+
+/// @brief  この CPU で PCID とグローバルページを有効にする。
+//
+/// CR4.PCIDE をセットするときは CR3 の PCID が 0 でなければならない。
+cause::t pcid_cpu_setup()
+{
+	arch::page_ctl pc;
+	pc.detect_paging_features();
+
+	u64 cr4 = native::get_cr4_64();
+
+	if (pc.has_pge())
+		cr4 |= CR4_PGE;
+
+	const bool enable = pc.has_pcid() && (native::get_cr3() & 0xfff) == 0;
+	if (enable)
+		cr4 |= CR4_PCIDE;
+
+	native::set_cr4(cr4);
+
+	const cpu_id id = arch::get_cpu_node_id();
+	pcid.cpu_gen[id] = pcid.gen;
+
+	// 全ての CPU が PCID を使えるときだけ有効にする。
+	if (!pcid.detected) {
+		pcid.detected = true;
+		pcid.enabled = enable;
+	} else if (!enable) {
+		pcid.enabled = false;
+	}
+
+	return cause::OK;
+}
+
+bool pcid_is_enabled()
+{
+	return pcid.enabled;
+}
+
+/// @brief  pml4_padr のアドレス空間に切り替えるときに CR3 へ書き込む値を
+///         返す。
+/// @param[in] pml4_padr  PML4 の物理アドレス。
+/// @param[in,out] tag    アドレス空間の PCID。
+//
+/// preempt_disable 状態で呼び出す必要がある。
+/// この CPU が今の世代になってから TLB をフラッシュしていなければ、
+/// ここでフラッシュする。
+u64 pcid_make_cr3(uptr pml4_padr, pcid_tag* tag)
+{
+	if (!pcid.enabled)
+		return pml4_padr;
+
+	if (tag->pcid == PCID_KERNEL)
+		return pml4_padr | CR3_NOFLUSH;
+
+	if (tag->gen != pcid.gen)
+		assign_pcid(tag);
+
+	const cpu_id id = arch::get_cpu_node_id();
+	const u64 gen = tag->gen;
+	if (pcid.cpu_gen[id] != gen) {
+		// 前の世代で同じ PCID を使ったアドレス空間の TLB が残っている。
+		arch::page::clear_tlb_all();
+		pcid.cpu_gen[id] = gen;
+		pcid.flush_cnt.inc();
+	}
+
+	return pml4_padr | tag->pcid | CR3_NOFLUSH;
+}
+
+void pcid_dump(output_buffer& ob)
+{
+	ob("pcid: enabled=").u(u8(pcid.enabled))
+	  (" gen=").u(pcid.gen)
+	  (" next=").u(pcid.next_pcid)
+	  (" rollover=").u(pcid.rollover_cnt.load())
+	  (" flush=").u(pcid.flush_cnt.load())();
+}
+
+}  // namespace x86
+
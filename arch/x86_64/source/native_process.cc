@@ -20,6 +20,7 @@
 
 #include "native_thread.hh"
 #include <core/cpu_node.hh>
+#include <core/tlb_gather.hh>
 #include <util/string.hh>
 #include <x86/native_ops.hh>
 
@@ -44,6 +45,8 @@ cause::t native_process::setup_self()
 
 	ptbl.set_toptable(arch::page::get_table());
 
+	pcid.pcid = PCID_KERNEL;
+
 	return cause::OK;
 }
 
@@ -79,6 +82,49 @@ cause::t native_process::setup(thread* entry_thread, int iod_nr)
 	return cause::OK;
 }
 
+/// @brief  アドレス空間を解放する。
+//
+/// 全ての thread が終了し、どの CPU もこのアドレス空間を使っていない
+/// 状態で呼び出す必要がある。
+/// PCID は世代が変わるまで他のアドレス空間に割り当てないので、
+/// TLB をフラッシュせずにページテーブルを解放できる。
+cause::t native_process::unsetup()
+{
+	arch::pte* my_pml4 = ptbl.get_toptable();
+	if (!my_pml4)
+		return cause::OK;
+
+	tlb_gather tg(my_pml4, tlb_gather::INACTIVE);
+
+	// カーネル用の後半は共有しているので外さない。
+	cause::t r = tg.unmap_range(0, UPTR(0x00007fffffffffff));
+	cause::t r2 = tg.finish();
+	if (is_ok(r))
+		r = r2;
+	if (is_fail(r))
+		return r;
+
+	r = get_cpu_node()->page_dealloc(arch::page::PHYS_L1,
+	    arch::unmap_phys_adr(my_pml4, arch::page::TABLE_SIZE));
+	if (is_fail(r))
+		return r;
+
+	ptbl.set_toptable(nullptr);
+
+	return cause::OK;
+}
+
+/// @brief  このプロセスのアドレス空間に切り替えるときの CR3 の値を返す。
+//
+/// preempt_disable 状態で呼び出す必要がある。
+u64 native_process::make_cr3()
+{
+	const uptr pml4_padr = arch::unmap_phys_adr(
+	    ptbl.get_toptable(), arch::page::TABLE_SIZE);
+
+	return pcid_make_cr3(pml4_padr, &pcid);
+}
+
 native_process* get_current_native_process()
 {
 	native_thread* thr = get_current_native_thread();
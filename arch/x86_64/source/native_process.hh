@@ -7,6 +7,7 @@
 #define ARCH_X86_64_SOURCE_NATIVE_PROCESS_HH_
 
 #include "native_pagetbl.hh"
+#include <native_pcid.hh>
 #include <core/process.hh>
 
 
@@ -22,11 +23,15 @@ public:
 	cause::t setup_self();
 
 	cause::t setup(thread* entry_thread, int iod_nr);
+	cause::t unsetup();
 
 	native_page_table& ref_ptbl() { return ptbl; }
 
+	u64 make_cr3();
+
 private:
 	native_page_table ptbl;
+	pcid_tag pcid;
 };
 
 native_process* get_current_native_process();
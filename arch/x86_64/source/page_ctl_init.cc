@@ -42,6 +42,7 @@
 #include <core/page.hh>
 #include <core/page_pool.hh>
 #include <global_vars.hh>
+#include "kerninit.hh"
 #include <mpspec.hh>
 #include <native_cpu_node.hh>
 #include "native_pagetbl.hh"
@@ -285,6 +286,8 @@ cause::t setup_pam1(u64 padr_end, tmp_alloc* heap)
 
 	pam1_page_table pg_tbl(cr3, heap);
 
+	// 全てのアドレス空間で共有するのでグローバルページにする。
+	// CR3 を切り替えても TLB に残る。
 	padr_end = min<u64>(padr_end, SETUP_PAM1_MAPEND);
 
 	for (uptr padr = 0; padr < padr_end; padr += arch::page::PHYS_L2_SIZE)
@@ -293,7 +296,8 @@ cause::t setup_pam1(u64 padr_end, tmp_alloc* heap)
 		    arch::PHYS_MAP_ADR + padr,
 		    padr,
 		    arch::page::PHYS_L2,
-		    pam1_page_table::EXIST | pam1_page_table::WRITE);
+		    pam1_page_table::EXIST | pam1_page_table::WRITE |
+		    pam1_page_table::GLOBAL);
 
 		if (is_fail(r))
 			return r;
@@ -322,7 +326,8 @@ cause::t setup_pam2(u64 padr_end, tmp_alloc* heap)
 		    arch::PHYS_MAP_ADR + padr,
 		    padr,
 		    arch::page::PHYS_L2,
-		    pam2_page_table::EXIST | pam2_page_table::WRITE);
+		    pam2_page_table::EXIST | pam2_page_table::WRITE |
+		    pam2_page_table::GLOBAL);
 
 		if (is_fail(r))
 			return r;
@@ -418,6 +423,13 @@ bool move_free_range(
 	return true;
 }
 
+#if CONFIG_ACPI
+
+/// acpi::table_init() が完了していれば true。
+bool acpi_table_ready = false;
+
+#endif  // CONFIG_ACPI
+
 u32 acpi_count_memory_affinity(ACPI_TABLE_SRAT* srat)
 {
 	acpi::subtable_enumerator subtbl_enum(srat);
@@ -516,6 +528,8 @@ cause::t setup_page_pool_by_srat(tmp_alloc* heap)
 	if (is_fail(r))
 		return r;
 
+	acpi_table_ready = true;
+
 	// get SRAT table.
 	ACPI_TABLE_SRAT* srat;
 	char sig_srat[] = ACPI_SIG_SRAT;
@@ -570,6 +584,8 @@ cause::t setup_page_pool_by_srat(tmp_alloc* heap)
 
 	//TODO: free aff_heap_mem
 
+	return cause::OK;
+
 #endif  // CONFIG_ACPI
 	return cause::FAIL;
 }
@@ -644,67 +660,275 @@ cause::pair<x86::native_cpu_node*> create_native_cpu_node(
 	return ret_type(cause::OK, ncn);
 }
 
-void set_page_pool_to_cpu_node(cpu_id cpu_node_id)
+/// @brief  SRAT と SLIT から NUMA ノード間の距離を求める。
+//
+/// ACPI テーブルが無いときは全ての CPU とメモリが proximity domain 0 に
+/// 属しているものとして扱う。
+class numa_info
+{
+public:
+	enum {
+		LOCAL_DISTANCE = 10,
+		REMOTE_DISTANCE = 20,
+	};
+
+	numa_info();
+
+	void load();
+
+	u32 get_cpu_proximity_domain(u32 apic_id) const;
+	u32 get_distance(u32 from_pd, u32 to_pd) const;
+
+private:
+#if CONFIG_ACPI
+	ACPI_TABLE_SRAT* srat;
+	ACPI_TABLE_SLIT* slit;
+#endif  // CONFIG_ACPI
+};
+
+numa_info::numa_info()
+#if CONFIG_ACPI
+	: srat(nullptr),
+	  slit(nullptr)
+#endif  // CONFIG_ACPI
+{
+}
+
+void numa_info::load()
+{
+#if CONFIG_ACPI
+	if (!acpi_table_ready)
+		return;
+
+	char sig_srat[] = ACPI_SIG_SRAT;
+	ACPI_STATUS as = AcpiGetTable(
+	    sig_srat, 0, reinterpret_cast<ACPI_TABLE_HEADER**>(&srat));
+	if (ACPI_FAILURE(as))
+		srat = nullptr;
+
+	char sig_slit[] = ACPI_SIG_SLIT;
+	as = AcpiGetTable(
+	    sig_slit, 0, reinterpret_cast<ACPI_TABLE_HEADER**>(&slit));
+	if (ACPI_FAILURE(as))
+		slit = nullptr;
+
+#endif  // CONFIG_ACPI
+}
+
+/// @brief  SRAT の Processor Affinity から CPU の proximity domain を探す。
+/// @param[in] apic_id  CPU の Local APIC ID。
+/// @return 見つからなければ 0 を返す。
+u32 numa_info::get_cpu_proximity_domain(u32 apic_id) const
+{
+#if CONFIG_ACPI
+	if (!srat)
+		return 0;
+
+	acpi::subtable_enumerator subtbl_enum(srat);
+	for (;;) {
+		auto* e = subtbl_enum.next();
+		if (!e)
+			break;
+
+		if (e->Type == ACPI_SRAT_TYPE_CPU_AFFINITY) {
+			auto* aff = reinterpret_cast<ACPI_SRAT_CPU_AFFINITY*>(e);
+			if (!(aff->Flags & ACPI_SRAT_CPU_USE_AFFINITY) ||
+			    aff->ApicId != apic_id)
+				continue;
+
+			return u32(aff->ProximityDomainLo) |
+			       u32(aff->ProximityDomainHi[0]) << 8 |
+			       u32(aff->ProximityDomainHi[1]) << 16 |
+			       u32(aff->ProximityDomainHi[2]) << 24;
+		} else if (e->Type == ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY) {
+			auto* aff =
+			    reinterpret_cast<ACPI_SRAT_X2APIC_CPU_AFFINITY*>(e);
+			if (!(aff->Flags & ACPI_SRAT_CPU_ENABLED) ||
+			    aff->ApicId != apic_id)
+				continue;
+
+			return aff->ProximityDomain;
+		}
+	}
+
+#else  // CONFIG_ACPI
+	(void)apic_id;
+
+#endif  // CONFIG_ACPI
+	return 0;
+}
+
+/// @brief  SLIT から proximity domain 間の距離を返す。
+//
+/// SLIT が無いか範囲外なら、同じ domain は LOCAL_DISTANCE、
+/// 違う domain は REMOTE_DISTANCE とする。
+u32 numa_info::get_distance(u32 from_pd, u32 to_pd) const
+{
+#if CONFIG_ACPI
+	if (slit &&
+	    from_pd < slit->LocalityCount && to_pd < slit->LocalityCount)
+	{
+		return slit->Entry[from_pd * slit->LocalityCount + to_pd];
+	}
+
+#endif  // CONFIG_ACPI
+	return from_pd == to_pd ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+}
+
+/// @brief  CPU から近い順に page_pool を cpu_node に設定する。
+void set_page_pool_to_cpu_node(cpu_id cpu_node_id, const numa_info& numa)
 {
 	page_pool** const pps = global_vars::core.page_pool_objs;
 
-	cpu_node* cn = global_vars::core.cpu_node_objs[cpu_node_id];
+	x86::native_cpu_node* cn = x86::get_native_cpu_node(cpu_node_id);
+
+	// SRAT には書き換える前の Local APIC ID が書かれている。
+	const u32 cpu_pd =
+	    numa.get_cpu_proximity_domain(cn->get_original_lapic_id());
+	cn->set_proximity_domain(cpu_pd);
 
-	const int n = global_vars::core.page_pool_nr;
+	const int n = min<int>(global_vars::core.page_pool_nr, CONFIG_MAX_CPUS);
 	cn->set_page_pool_cnt(n);
 
+	// 距離が同じなら page_pool_objs の順を保つように挿入ソートする。
+	page_pool* order[CONFIG_MAX_CPUS];
+	u32 dist[CONFIG_MAX_CPUS];
 	for (int i = 0; i < n; ++i) {
-		cn->set_page_pool(i, pps[i]);
+		const u32 d =
+		    numa.get_distance(cpu_pd, pps[i]->get_proximity_domain());
+
+		int j;
+		for (j = i; j > 0 && dist[j - 1] > d; --j) {
+			order[j] = order[j - 1];
+			dist[j] = dist[j - 1];
+		}
+		order[j] = pps[i];
+		dist[j] = d;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		cn->set_page_pool(i, order[i]);
+	}
+}
+
+/// @brief  cpu_node を１つ生成して cpu_node_objs の末尾に追加する。
+/// @param[in] lapic_id  CPU の Local APIC ID。
+//
+/// cpu_node の ID は cpu_node_objs のインデックスになる。
+/// Local APIC ID との対応は lapic_set_cpu_node_id() で登録する。
+cause::t add_cpu_node(u8 lapic_id)
+{
+	const cpu_id id = global_vars::core.cpu_node_nr;
+	if (id >= CONFIG_MAX_CPUS) {
+		log()("!!! Too many CPUs. lapic_id=").u(lapic_id)();
+		return cause::OUTOFRANGE;
 	}
+
+	page_pool* pp = global_vars::core.page_pool_objs[0];
+	auto rcn = create_native_cpu_node(pp, id);
+	if (is_fail(rcn))
+		return rcn.cause();
+
+	rcn.value()->set_original_lapic_id(lapic_id);
+	lapic_set_cpu_node_id(lapic_id, id);
+
+	global_vars::core.cpu_node_objs[id] = rcn.value();
+	global_vars::core.cpu_node_nr = id + 1;
+
+	return cause::OK;
 }
 
+#if CONFIG_ACPI
+
+cause::t setup_cpu_node_by_madt()
+{
+	if (!acpi_table_ready)
+		return cause::NODEV;
+
+	ACPI_TABLE_MADT* madt;
+	char sig_madt[] = ACPI_SIG_MADT;
+	ACPI_STATUS as = AcpiGetTable(
+	    sig_madt, 0, reinterpret_cast<ACPI_TABLE_HEADER**>(&madt));
+	if (ACPI_FAILURE(as))
+		return cause::NODEV;
+
+	// BSP の cpu_node を先頭にする。
+	const u8 bsp_id = arch::get_cpu_lapic_id();
+	cause::t r = add_cpu_node(bsp_id);
+	if (is_fail(r))
+		return r;
+
+	acpi::subtable_enumerator subtbl_enum(madt);
+	for (;;) {
+		auto* e = subtbl_enum.next(ACPI_MADT_TYPE_LOCAL_APIC);
+		if (!e)
+			break;
+
+		auto* lapic = reinterpret_cast<ACPI_MADT_LOCAL_APIC*>(e);
+		if (!(lapic->LapicFlags & ACPI_MADT_ENABLED) ||
+		    lapic->Id == bsp_id)
+			continue;
+
+		if (is_fail(add_cpu_node(lapic->Id)))
+			break;
+	}
+
+	return cause::OK;
+}
+
+#endif  // CONFIG_ACPI
+
 cause::t setup_cpu_node_by_mpspec()
 {
+	enum {
+		CPU_EN = 0x01,
+	};
+
 	mpspec mps;
 	cause::t r = mps.load();
 	if (is_fail(r))
 		return r;
 
-	page_pool* pp = global_vars::core.page_pool_objs[0];
+	// BSP の cpu_node を先頭にする。
+	const u8 bsp_id = arch::get_cpu_lapic_id();
+	r = add_cpu_node(bsp_id);
+	if (is_fail(r))
+		return r;
 
 	mpspec::processor_iterator proc_itr(&mps);
-	cpu_id proc_nr = 0;
 	for (;;) {
 		const mpspec::processor_entry* pe = proc_itr.get_next();
 		if (!pe)
 			break;
 
-		auto rcn = create_native_cpu_node(pp, pe->localapic_id);
-		if (is_fail(rcn))
-			return rcn.cause();
-
-		global_vars::core.cpu_node_objs[proc_nr] = rcn.data();
+		if (!(pe->cpu_flags & CPU_EN) || pe->localapic_id == bsp_id)
+			continue;
 
-		++proc_nr;
+		if (is_fail(add_cpu_node(pe->localapic_id)))
+			break;
 	}
 
-	global_vars::core.cpu_node_nr = proc_nr;
-
 	return cause::OK;
 }
 
 cause::t setup_cpu_node_one()
 {
-	global_vars::core.cpu_node_nr = 1;
-
-	page_pool* pp = global_vars::core.page_pool_objs[0];
-	auto rcn = create_native_cpu_node(pp, arch::get_cpu_lapic_id());
-	if (is_fail(rcn))
-		return rcn.cause();
-
-	global_vars::core.cpu_node_objs[0] = rcn.data();
-
-	return cause::OK;
+	return add_cpu_node(arch::get_cpu_lapic_id());
 }
 
 cause::t setup_cpu_node()
 {
+	global_vars::core.cpu_node_nr = 0;
+
+#if CONFIG_ACPI
+	cause::t r = setup_cpu_node_by_madt();
+	if (is_ok(r))
+		return r;
+
+	r = setup_cpu_node_by_mpspec();
+#else
 	cause::t r = setup_cpu_node_by_mpspec();
+#endif  // CONFIG_ACPI
 	if (is_ok(r))
 		return r;
 
@@ -717,9 +941,12 @@ cause::t setup_cpu_node()
 
 cause::t setup_cpu_page()
 {
+	numa_info numa;
+	numa.load();
+
 	cpu_id n = global_vars::core.cpu_node_nr;
 	for (cpu_id i = 0; i < n; ++i) {
-		set_page_pool_to_cpu_node(i);
+		set_page_pool_to_cpu_node(i, numa);
 	}
 
 	return cause::OK;
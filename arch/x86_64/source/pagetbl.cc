@@ -20,10 +20,50 @@
 #include <core/pagetbl.hh>
 
 #include <core/cpu_node.hh>
+#include <core/tlb_gather.hh>
 #include "native_pagetbl.hh"
+#include "native_pcid.hh"
 #include <x86/native_ops.hh>
 
 
+namespace {
+
+enum {
+	CR4_PGE = 0x80,
+};
+
+// tlb_gather へ解放するページテーブルを渡すページテーブル。
+
+class gather_page_table_traits;
+using _gather_page_table = arch::page_table_tmpl<gather_page_table_traits>;
+class gather_page_table : public _gather_page_table
+{
+public:
+	gather_page_table(arch::pte* top, tlb_gather* _tg) :
+		_gather_page_table(top), tg(_tg)
+	{}
+
+	tlb_gather* tg;
+};
+class gather_page_table_traits
+{
+public:
+	/// TLB をフラッシュするまでは解放しない。
+	static cause::t release_page(_gather_page_table* x, u64 padr)
+	{
+		return static_cast<gather_page_table*>(x)->tg->add_table_page(padr);
+	}
+
+	static void* phys_to_virt(uptr adr) {
+		return arch::map_phys_adr(adr, arch::page::PHYS_L1_SIZE);
+	}
+	static uptr virt_to_phys(void* adr) {
+		return arch::unmap_phys_adr(adr, arch::page::PHYS_L1_SIZE);
+	}
+};
+
+}  // namespace
+
 namespace arch {
 namespace page {
 
@@ -50,7 +90,7 @@ const PAGE_TRAITS_ARRAY get_page_traits()
 page_table* get_table()
 {
 	void* ptbl = arch::map_phys_adr(
-	    native::get_cr3(), arch::page::TABLE_SIZE);
+	    native::get_cr3_padr(), arch::page::TABLE_SIZE);
 
 	return static_cast<page_table*>(ptbl);
 }
@@ -114,12 +154,79 @@ cause::t unmap(
 	return r;
 }
 
+/// @brief  low_vadr から high_vadr までのページを外して tg に集める。
+//
+/// 外したページのアドレスと空になったページテーブルを tg に渡す。
+/// TLB はフラッシュしないので、tg->finish() を呼び出す必要がある。
+cause::t unmap_range(
+    page_table* tbl,
+    uptr low_vadr,
+    uptr high_vadr,
+    tlb_gather* tg)
+{
+	gather_page_table pgtbl(reinterpret_cast<pte*>(tbl), tg);
+
+	gather_page_table::page_enum pe;
+	pgtbl.unset_page_start(low_vadr, high_vadr, &pe);
+
+	cause::t r;
+	for (;;) {
+		uptr vadr;
+		u64 padr;
+		LEVEL pt;
+		r = pgtbl.unset_page_next(&pe, &vadr, &padr, &pt);
+		if (r != cause::OK)
+			break;
+
+		tg->add_range(vadr, size_of_type(pt), (pe.flags & pte::G) != 0);
+	}
+
+	pgtbl.unset_page_end(&pe);
+
+	return r == cause::END ? cause::OK : r;
+}
+
 /// 指定したvadrのTLBをクリアする
 void clear_tlb(void* vadr)
 {
 	asm volatile ("invlpg %0" : : "m"(*static_cast<u8*>(vadr)));
 }
 
+/// @brief  low_vadr から high_vadr まで stride ごとに TLB をクリアする。
+/// @param[in] global  範囲の全てのページがグローバルページならば true。
+//
+/// INVLPG は今の PCID とグローバルページのエントリしかクリアしない。
+/// PCID が有効なときは他の PCID のエントリが残っているかもしれないので、
+/// グローバルページでなければ全てフラッシュする。
+void clear_tlb_range(uptr low_vadr, uptr high_vadr, uptr stride, bool global)
+{
+	if (!global && x86::pcid_is_enabled()) {
+		clear_tlb_all();
+		return;
+	}
+
+	for (uptr vadr = low_vadr; vadr <= high_vadr; vadr += stride) {
+		clear_tlb(reinterpret_cast<void*>(vadr));
+
+		// 最後のページでアドレスが一周する。
+		if (vadr + stride < vadr)
+			break;
+	}
+}
+
+/// @brief  グローバルページと全ての PCID を含めて TLB をクリアする。
+void clear_tlb_all()
+{
+	const u64 cr4 = native::get_cr4_64();
+
+	if (cr4 & CR4_PGE) {
+		native::set_cr4(cr4 & ~CR4_PGE);
+		native::set_cr4(cr4);
+	} else {
+		native::set_cr3(native::get_cr3());
+	}
+}
+
 }  // namespace page
 }  // namespace arch
 
@@ -0,0 +1,305 @@
+/// @file   smp.cc
+/// @brief  Start application processors and inter processor interrupts.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "kerninit.hh"
+#include "native_cpu_node.hh"
+#include "native_thread.hh"
+#include <arch/global_vars.hh>
+#include <core/global_vars.hh>
+#include <core/intr_ctl.hh>
+#include <core/log.hh>
+#include <core/timer_ctl.hh>
+#include <cpu_ctl.hh>
+#include <util/string.hh>
+#include <x86/native_ops.hh>
+
+
+extern char _binary_arch_x86_64_kernel_ap_boot_bin_start[];
+extern char _binary_arch_x86_64_kernel_ap_boot_bin_size[];
+
+void lapic_eoi();
+
+namespace {
+
+enum {
+	/// ap_boot.S をコピーする物理アドレス。
+	/// STARTUP IPI のベクタはこのアドレスを 4KiB 単位で表す。
+	/// ap_boot.lds の開始アドレスと合わせる必要がある。
+	AP_BOOT_PADR = 0x1000,
+
+	/// INIT IPI の後で待つ時間(ns)。
+	INIT_WAIT_NS = 10 * 1000 * 1000,
+	/// STARTUP IPI の後で待つ時間(ns)。
+	STARTUP_WAIT_NS = 200 * 1000,
+	/// AP が起動を完了するまで待つ最長時間(ns)。
+	ONLINE_WAIT_NS = 100 * 1000 * 1000,
+
+	MSR_EFER = 0xc0000080,
+	EFER_LMA = 0x400,
+	CR4_PCIDE = 0x20000,
+};
+
+/// ap_boot.S の末尾に置くパラメータ。
+/// レイアウトを変えるときは ap_boot.S も修正する必要がある。
+struct ap_param
+{
+	u64 pml4;          ///< +0  AP の CR3。4GiB 未満のアドレスであること。
+	u64 entry_point;   ///< +8  64bit モードになった後のジャンプ先
+	u64 stack;         ///< +16 entry_point を実行するときの RSP
+	u64 cpu_node_id;   ///< +24 entry_point の第１引数
+	u64 cr4;           ///< +32
+	u64 efer;          ///< +40
+};
+
+intr_handler resched_ih;
+intr_handler call_ih;
+intr_handler message_ih;
+
+void resched_handler(intr_handler*)
+{
+	x86::get_native_cpu_node()->on_resched_ipi();
+}
+
+void call_handler(intr_handler*)
+{
+	x86::get_native_cpu_node()->on_call_ipi();
+}
+
+void message_handler(intr_handler*)
+{
+	x86::get_native_cpu_node()->on_message_ipi();
+}
+
+cause::t install_ipi_handlers()
+{
+	intr_ctl* ic = global_vars::core.intr_ctl_obj;
+
+	resched_ih.handler = resched_handler;
+	cause::t r = ic->install_handler(arch::INTR_IPI_RESCHED, &resched_ih);
+	if (is_fail(r))
+		return r;
+	ic->set_post_handler(arch::INTR_IPI_RESCHED, lapic_eoi);
+
+	call_ih.handler = call_handler;
+	r = ic->install_handler(arch::INTR_IPI_CALL, &call_ih);
+	if (is_fail(r))
+		return r;
+	ic->set_post_handler(arch::INTR_IPI_CALL, lapic_eoi);
+
+	message_ih.handler = message_handler;
+	r = ic->install_handler(arch::INTR_IPI_MESSAGE, &message_ih);
+	if (is_fail(r))
+		return r;
+	ic->set_post_handler(arch::INTR_IPI_MESSAGE, lapic_eoi);
+
+	return cause::OK;
+}
+
+/// @brief  ap_boot.S を AP_BOOT_PADR へコピーする。
+/// @return ap_boot.S の末尾の ap_param。
+//
+/// AP は AP_BOOT_PADR の物理アドレスのままページングを有効にするので、
+/// カーネルのページテーブルで AP_BOOT_PADR がストレートマップされている
+/// 必要がある。
+ap_param* setup_ap_boot()
+{
+	const u8* apboot_start =
+	    reinterpret_cast<u8*>(_binary_arch_x86_64_kernel_ap_boot_bin_start);
+	const uptr apboot_size =
+	    reinterpret_cast<uptr>(_binary_arch_x86_64_kernel_ap_boot_bin_size);
+
+	u8* dest = static_cast<u8*>(
+	    arch::map_phys_adr(AP_BOOT_PADR, arch::page::PHYS_L1_SIZE));
+	mem_copy(apboot_start, dest, apboot_size);
+
+	ap_param* app = reinterpret_cast<ap_param*>(
+	    up_align<uptr>(reinterpret_cast<uptr>(dest + apboot_size), 8));
+
+	app->pml4 = native::get_cr3_padr();
+	// PCIDE は 32bit モードではセットできない。
+	app->cr4 = native::get_cr4_64() & ~CR4_PCIDE;
+	app->efer = native::read_msr(MSR_EFER) & ~EFER_LMA;
+
+	return app;
+}
+
+/// @brief  AP を１つ起動する。
+//
+/// INIT-SIPI-SIPI の手順で起動し、AP が online になるまで待つ。
+cause::t boot_ap(x86::native_cpu_node* cn, ap_param* app)
+{
+	auto rt = x86::create_ap_boot_thread();
+	if (is_fail(rt))
+		return rt.cause();
+	x86::native_thread* t = rt.value();
+
+	app->entry_point = reinterpret_cast<u64>(ap_entry);
+	app->stack = reinterpret_cast<u64>(t) + t->stack_bytes;
+	app->cpu_node_id = cn->get_cpu_node_id();
+
+	const u8 lapic_id = cn->get_original_lapic_id();
+
+	{
+		preempt_disable_section _pds;
+		lapic_post_init_ipi(lapic_id);
+	}
+	timer_busy_wait(INIT_WAIT_NS);
+
+	// 起動中の AP は２回目の STARTUP IPI を無視する。
+	for (int i = 0; i < 2 && !cn->is_online(); ++i) {
+		{
+			preempt_disable_section _pds;
+			lapic_post_startup_ipi(lapic_id, AP_BOOT_PADR >> 12);
+		}
+		timer_busy_wait(STARTUP_WAIT_NS);
+	}
+
+	for (u64 t = 0; t < ONLINE_WAIT_NS; t += STARTUP_WAIT_NS) {
+		if (cn->is_online())
+			return cause::OK;
+
+		timer_busy_wait(STARTUP_WAIT_NS);
+	}
+
+	// AP が後から t のスタックを使うかもしれないので t は解放しない。
+	return cause::FAIL;
+}
+
+}  // namespace
+
+/// @brief  AP が 64bit モードになった後の入口。
+/// @param[in] cpu_node_id  この AP の cpu_node の ID。
+//
+/// boot_ap() で生成した thread の末尾をスタックとして実行する。
+/// この関数は戻らない。
+extern "C" void ap_entry(u64 cpu_node_id)
+{
+	arch::apic_ap_init(cpu_node_id);
+
+	x86::native_cpu_node* cn = x86::get_native_cpu_node();
+
+	// 割込みが入る前に IDT を使えるようにしておく。
+	global_vars::arch.native_cpu_ctl_obj->load();
+	cn->preempt_disable();
+
+	x86::native_thread* t = x86::get_current_native_thread();
+	cn->attach_boot_thread(t);
+	cn->load_running_thread(t);
+
+	cause::t r = cn->setup();
+	if (is_fail(r)) {
+		log()("!!! AP setup failed. cpu_node_id=").u(cpu_node_id)
+		    (" r=").u(r)();
+		for (;;)
+			native::hlt();
+	}
+
+	cn->preempt_enable();
+
+	cn->start_ap_message_loop();
+}
+
+/// @brief  全ての AP を起動する。
+//
+/// タイマと割込みが使える状態で BSP から呼び出す。
+/// 起動できなかった AP は online にならず、そのまま使わない。
+cause::t smp_setup()
+{
+	cause::t r = install_ipi_handlers();
+	if (is_fail(r))
+		return r;
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	if (cpu_nr <= 1)
+		return cause::OK;
+
+	ap_param* app = setup_ap_boot();
+
+	for (cpu_id_t i = 1; i < cpu_nr; ++i) {
+		x86::native_cpu_node* cn = x86::get_native_cpu_node(i);
+
+		r = boot_ap(cn, app);
+		if (is_fail(r)) {
+			log()("!!! AP did not start. cpu_node_id=").u(i)
+			    (" lapic_id=").u(cn->get_original_lapic_id())();
+		}
+	}
+
+	cpu_id_t online_nr = 0;
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		if (get_cpu_node(i)->is_online())
+			++online_nr;
+	}
+	log()("SMP: ").u(online_nr)('/').u(cpu_nr)(" CPUs online.")();
+
+	return cause::OK;
+}
+
+namespace arch {
+
+/// @brief  cpu で実行するスレッドを選び直させる。
+void request_resched(cpu_node* cpu)
+{
+	if (!cpu->is_online())
+		return;
+
+	preempt_disable_section _pds;
+
+	post_ipi(cpu->get_cpu_node_id(), INTR_IPI_RESCHED);
+}
+
+/// @brief  cpu で call->func(call->arg) を割込みとして実行させる。
+//
+/// 実行が終わると call->done が true になる。
+/// 終了を待つ場合は、待っている間に自分への IPI を受け付けられるように
+/// 割込み許可状態で待たなければならない。
+void call_on_cpu(cpu_node* cpu, cpu_call* call)
+{
+	call->done = false;
+
+	preempt_disable_section _pds;
+
+	if (cpu == get_cpu_node()) {
+		call->func(call->arg);
+		call->done = true;
+		return;
+	}
+
+	static_cast<x86::native_cpu_node*>(cpu)->push_cpu_call(call);
+
+	post_ipi(cpu->get_cpu_node_id(), INTR_IPI_CALL);
+}
+
+/// @brief  call_on_cpu() で依頼した call の実行が終わるまで待つ。
+//
+/// 割込み禁止状態の CPU 同士が互いに call を依頼して待つとデッドロック
+/// するので、待っている間は自分宛ての call も実行する。
+void wait_cpu_call(cpu_call* call)
+{
+	while (!call->done) {
+		{
+			preempt_disable_section _pds;
+			x86::get_native_cpu_node()->on_call_ipi();
+		}
+		cpu_relax();
+	}
+}
+
+}  // namespace arch
+
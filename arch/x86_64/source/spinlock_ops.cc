@@ -24,42 +24,12 @@
 
 namespace {
 
-inline s8 atomic8_xadd(s8 val, volatile s8* atom) {
-	asm volatile ("lock xaddb %0, %1"
-	              : "+r" (val), "+m" (*atom)
-	              : : "memory", "cc");
-	return val;
-}
-inline s16 atomic16_xadd(s16 val, volatile s16* atom) {
-	asm volatile ("lock xaddw %0, %1"
-	              : "+r" (val), "+m" (*atom)
-	              : : "memory", "cc");
-	return val;
-}
-inline s32 atomic32_xadd(s32 val, volatile s32* atom) {
+inline u32 atomic32_xadd(u32 val, volatile u32* atom) {
 	asm volatile ("lock xaddl %0, %1"
 	              : "+r" (val), "+m" (*atom)
 	              : : "memory", "cc");
 	return val;
 }
-inline s64 atomic64_xadd(s64 val, volatile s64* atom) {
-	asm volatile ("lock xaddq %0, %1"
-	              : "+r" (val), "+m" (*atom)
-	              : : "memory", "cc");
-	return val;
-}
-inline s8  atomic_xadd(s8 val,  volatile s8* atom)  {
-	return atomic8_xadd(val, atom);
-}
-inline s16 atomic_xadd(s16 val, volatile s16* atom) {
-	return atomic16_xadd(val, atom);
-}
-inline s32 atomic_xadd(s32 val, volatile s32* atom) {
-	return atomic32_xadd(val, atom);
-}
-inline s64 atomic_xadd(s64 val, volatile s64* atom) {
-	return atomic64_xadd(val, atom);
-}
 
 }  // namespace
 
@@ -68,8 +38,8 @@ namespace arch {
 
 bool spin_rwlock_ops::try_rlock()
 {
-	if (UNLIKELY(atomic_xadd(1, &atom) < 0)) {
-		atomic_sub(1, &atom);
+	if (UNLIKELY(atomic32_xadd(RBIAS, &cnts) & WMASK)) {
+		atomic32_sub(RBIAS, &cnts);
 		return false;
 	}
 
@@ -78,23 +48,36 @@ bool spin_rwlock_ops::try_rlock()
 
 bool spin_rwlock_ops::try_wlock()
 {
-	if (UNLIKELY(atomic_xadd(WLOCK, &atom) != 0)) {
-		atomic_sub(WLOCK, &atom);
-		return false;
-	}
-
-	return true;
+	return cnts == 0 && atomic32_compare_exchange(0, WLOCKED, &cnts) == 0;
 }
 
 void spin_rwlock_ops::un_rlock()
 {
-	atomic_sub(1, &atom);
+	atomic32_sub(RBIAS, &cnts);
 }
 
 void spin_rwlock_ops::un_wlock()
 {
-	atomic_sub(WLOCK, &atom);
+	atomic32_sub(WLOCKED, &cnts);
 }
 
-}  // namespace arch
+/// @brief  writer の状態にかかわらず reader の数を増やす。
+void spin_rwlock_ops::add_reader()
+{
+	atomic32_add(RBIAS, &cnts);
+}
 
+void spin_rwlock_ops::set_wwaiting()
+{
+	atomic32_add(WWAITING, &cnts);
+}
+
+/// @brief  reader と writer がいなくなっていれば WWAITING を WLOCKED に
+///         置き換えてロックする。
+bool spin_rwlock_ops::try_wlock_waiting()
+{
+	return cnts == WWAITING &&
+	       atomic32_compare_exchange(WWAITING, WLOCKED, &cnts) == WWAITING;
+}
+
+}  // namespace arch
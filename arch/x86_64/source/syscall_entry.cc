@@ -41,6 +41,7 @@ extern "C" cause::pair<ucpu> syscall_entry(const ucpu* data)
      * data[6] : %r9  (6th param)
      * data[7] : %rip
      * data[8] : %eflags
+     * data[9] : %rsp
      */
     if (data[0] < 100) {
         ret = uniqos::core_syscall_entry(data);
@@ -7,7 +7,10 @@
 #include <core/new_ops.hh>
 #include <core/page_pool.hh>
 #include <core/timer_ctl.hh>
+#include <native_pcid.hh>
+#include <util/string.hh>
 #include <x86/native_ops.hh>
+#include "native_pagetbl.hh"
 
 
 void event_drive();
@@ -209,6 +212,154 @@ void mempool_test()
 	log().p(th)("|TEST:").u(tn)("|sum:").x(n)();
 }
 
+namespace {
+
+enum {
+	/// pcid_bench() でアクセスするページ数
+	PCID_BENCH_PAGES = 64,
+	/// pcid_bench() でアドレス空間を切り替える回数
+	PCID_BENCH_LOOPS = 10000,
+};
+
+/// pcid_bench() のデータをマップする仮想アドレス。ユーザー空間の範囲。
+const uptr PCID_BENCH_VADR = U64(0x0000100000000000);
+
+/// @brief  カーネル空間を共有し、ユーザー空間に data をマップした
+///         アドレス空間を作る。
+cause::t pcid_bench_space(const uptr* data, x86::native_page_table* pt)
+{
+	uptr pml4_padr;
+	cause::t r = get_cpu_node()->page_alloc(arch::page::PHYS_L1, &pml4_padr);
+	if (is_fail(r))
+		return r;
+
+	arch::pte* pml4 = static_cast<arch::pte*>(
+	    arch::map_phys_adr(pml4_padr, arch::page::TABLE_SIZE));
+	mem_fill(0, pml4, arch::page::TABLE_SIZE / 2);
+
+	arch::pte* kern_pml4 = arch::page::get_table();
+	mem_copy(&kern_pml4[256], &pml4[256], arch::page::TABLE_SIZE / 2);
+	arch::page::unget_table(kern_pml4);
+
+	pt->set_toptable(pml4);
+
+	for (int i = 0; i < PCID_BENCH_PAGES; ++i) {
+		r = pt->set_page(
+		    PCID_BENCH_VADR + i * arch::page::PHYS_L1_SIZE, data[i],
+		    arch::page::PHYS_L1,
+		    arch::pte::P | arch::pte::RW | arch::pte::A | arch::pte::D);
+		if (is_fail(r))
+			return r;
+	}
+
+	return cause::OK;
+}
+
+void pcid_bench_release(x86::native_page_table* pt)
+{
+	x86::native_page_table::page_enum pe;
+	pt->unset_page_start(PCID_BENCH_VADR,
+	    PCID_BENCH_VADR + (PCID_BENCH_PAGES - 1) * arch::page::PHYS_L1_SIZE,
+	    &pe);
+
+	uptr vadr;
+	u64 padr;
+	arch::page::TYPE type;
+	while (pt->unset_page_next(&pe, &vadr, &padr, &type) == cause::OK)
+		;
+
+	pt->unset_page_end(&pe);
+
+	get_cpu_node()->page_dealloc(arch::page::PHYS_L1,
+	    arch::unmap_phys_adr(pt->get_toptable(), arch::page::TABLE_SIZE));
+}
+
+/// @brief  2 つのアドレス空間を交互に切り替えながらページにアクセスする。
+/// @return 経過した TSC サイクル数。
+u64 pcid_bench_run(const u64 cr3[2])
+{
+	const u64 start = arch::read_tsc();
+
+	for (int i = 0; i < PCID_BENCH_LOOPS; ++i) {
+		native::set_cr3(cr3[i & 1]);
+
+		for (int j = 0; j < PCID_BENCH_PAGES; ++j) {
+			const volatile u64* p = reinterpret_cast<const u64*>(
+			    PCID_BENCH_VADR + j * arch::page::PHYS_L1_SIZE);
+			*p;
+		}
+	}
+
+	return arch::read_tsc() - start;
+}
+
+/// @brief  PCID を使った場合と使わない場合の CR3 切り替えの時間を比べる。
+//
+/// PCID を使わないと CR3 を切り替えるたびに TLB がフラッシュされ、
+/// 全てのページで TLB ミスが発生する。
+void pcid_bench()
+{
+	if (!x86::pcid_is_enabled()) {
+		log()("pcid_bench: PCID is not available.")();
+		return;
+	}
+
+	uptr data[PCID_BENCH_PAGES];
+	int data_nr;
+	for (data_nr = 0; data_nr < PCID_BENCH_PAGES; ++data_nr) {
+		cause::t r = get_cpu_node()->page_alloc(
+		    arch::page::PHYS_L1, &data[data_nr]);
+		if (is_fail(r))
+			break;
+	}
+
+	x86::native_page_table pt[2] = {
+		x86::native_page_table(nullptr),
+		x86::native_page_table(nullptr),
+	};
+
+	if (data_nr == PCID_BENCH_PAGES &&
+	    is_ok(pcid_bench_space(data, &pt[0])) &&
+	    is_ok(pcid_bench_space(data, &pt[1])))
+	{
+		x86::pcid_tag tag[2];
+		u64 flush_cr3[2], pcid_cr3[2];
+
+		preempt_disable();
+
+		const u64 orig_cr3 = native::get_cr3();
+
+		for (int i = 0; i < 2; ++i) {
+			flush_cr3[i] = arch::unmap_phys_adr(
+			    pt[i].get_toptable(), arch::page::TABLE_SIZE);
+			pcid_cr3[i] = x86::pcid_make_cr3(flush_cr3[i], &tag[i]);
+		}
+
+		const u64 flush_cycles = pcid_bench_run(flush_cr3);
+		const u64 pcid_cycles = pcid_bench_run(pcid_cr3);
+
+		native::set_cr3(orig_cr3);
+
+		preempt_enable();
+
+		log()("pcid_bench: pages=").u(PCID_BENCH_PAGES)
+		     (" loops=").u(PCID_BENCH_LOOPS)()
+		     ("  flush: ").u(flush_cycles / PCID_BENCH_LOOPS)
+		     (" cycles/switch")()
+		     ("  pcid : ").u(pcid_cycles / PCID_BENCH_LOOPS)
+		     (" cycles/switch")();
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		if (pt[i].get_toptable())
+			pcid_bench_release(&pt[i]);
+	}
+	for (int i = 0; i < data_nr; ++i)
+		get_cpu_node()->page_dealloc(arch::page::PHYS_L1, data[i]);
+}
+
+}  // namespace
+
 bool test_init()
 {
 	rnd.init(0, 0);
@@ -219,6 +370,8 @@ bool test_init()
 
 void test(void*)
 {
+	pcid_bench();
+
 	for (;;) {
 		mempool_test();
 	}
@@ -19,6 +19,7 @@
 #include <arch/thread_ctl.hh>
 
 #include "native_cpu_node.hh"
+#include "native_fpu.hh"
 #include "native_thread.hh"
 #include <arch/global_vars.hh>
 #include <core/mempool.hh>
@@ -44,7 +45,10 @@ namespace x86 {
 
 native_thread::native_thread(thread_id tid) :
 	thread(tid),
-	stack_bytes(1 << THREAD_SIZE_SHIFTS)
+	stack_bytes(1 << THREAD_SIZE_SHIFTS),
+	fpu_state(nullptr),
+	fpu_mem(nullptr),
+	fpu_cpu(FPU_CPU_NONE)
 {
 }
 
@@ -56,9 +60,12 @@ native_thread::native_thread(
 ) :
 	thread(tid),
 	rs(text, param, reinterpret_cast<uptr>(this), stack_size),
-	stack_bytes(stack_size)
+	stack_bytes(stack_size),
+	fpu_state(nullptr),
+	fpu_mem(nullptr),
+	fpu_cpu(FPU_CPU_NONE)
 {
-	rs.cr3 = native::get_cr3();
+	rs.cr3 = native::get_cr3_padr();
 }
 
 
@@ -71,6 +78,7 @@ public:
 
 	cause::t setup();
 	cause::t create_boot_thread();
+	cause::pair<native_thread*> create_ap_boot_thread();
 
 	cause::pair<native_thread*> create_thread(
 	    cpu_node* owner_cpu, uptr text, uptr param);
@@ -82,7 +90,7 @@ private:
 private:
 	mempool* thread_mp;
 
-	//TODO:lock
+	spin_lock tid_lock;
 	thread_id next_tid;
 };
 
@@ -123,6 +131,22 @@ cause::t thread_ctl::create_boot_thread()
 	return cause::OK;
 }
 
+/// @brief AP の boot thread を生成する。
+//
+/// AP は生成した thread の末尾をスタックとして起動する。
+/// thread はまだどの cpu_node にも関連付けない。
+/// AP が自分の cpu_node に attach_boot_thread() で関連付ける。
+cause::pair<native_thread*> thread_ctl::create_ap_boot_thread()
+{
+	native_thread* t = new (*thread_mp) native_thread(get_next_tid());
+	if (!t)
+		return make_pair(cause::NOMEM, t);
+
+	t->ref_regset()->cr3 = native::get_cr3_padr();
+
+	return make_pair(cause::OK, t);
+}
+
 cause::pair<native_thread*> thread_ctl::create_thread(
     cpu_node* owner_cpu,
     uptr text,
@@ -148,6 +172,8 @@ cause::t thread_ctl::destroy_thread(native_thread* t)
 	if (is_fail(r))
 		return r;
 
+	fpu_free_state(t);
+
 	r = new_destroy(t, *thread_mp);
 	if (is_fail(r))
 		return r;
@@ -157,6 +183,8 @@ cause::t thread_ctl::destroy_thread(native_thread* t)
 
 thread_id thread_ctl::get_next_tid()
 {
+	spin_lock_section _tl_sec(tid_lock);
+
 	thread_id r = next_tid;
 
 	if (++next_tid == 0)
@@ -191,6 +219,11 @@ cause::t create_boot_thread()
 	return global_vars::arch.thread_ctl_obj->create_boot_thread();
 }
 
+cause::pair<native_thread*> create_ap_boot_thread()
+{
+	return global_vars::arch.thread_ctl_obj->create_ap_boot_thread();
+}
+
 cause::pair<native_thread*> create_thread(
     cpu_node* owner_cpu,
     uptr text,
@@ -245,6 +278,19 @@ void sleep_current_thread()
 	x86::get_native_cpu_node()->sleep_current_thread();
 }
 
+/// @brief  カーネルの中だけで動く thread を作る。
+//
+/// 作った thread は SLEEPING なので、thread::ready() で動かす。
+cause::pair<thread*> create_kernel_thread(
+    cpu_node* owner_cpu, void (*entry)(void* param), void* param)
+{
+	auto r = x86::create_thread(owner_cpu, entry, param);
+	if (is_fail(r))
+		return null_pair(r.cause());
+
+	return make_pair(cause::OK, static_cast<thread*>(r.value()));
+}
+
 void imitate_thread()
 {
 	get_current_thread()->imitate_owner_cpu();
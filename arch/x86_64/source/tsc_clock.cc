@@ -0,0 +1,295 @@
+/// @file   tsc_clock.cc
+/// @brief  Invariant TSC clock source with LAPIC TSC-deadline timer.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "kerninit.hh"
+#include <arch.hh>
+#include <core/clock_src.hh>
+#include <core/log.hh>
+#include <core/mempool.hh>
+
+
+namespace {
+
+enum {
+	CPUID1_ECX_TSC_DEADLINE = 0x01000000,
+	CPUID80000007_EDX_INVARIANT_TSC = 0x00000100,
+
+	/// 較正に使う時間(ns)。
+	CALIBRATE_NS = 10 * 1000 * 1000,
+
+	/// clock と nanosec の変換に使う固定小数点の小数部のビット数。
+	CONV_SHIFT = 32,
+};
+
+const u64 NANOSEC_PER_SEC = 1000000000;
+
+void cpuid(u32 leaf, u32 subleaf, u32* a, u32* b, u32* c, u32* d)
+{
+	asm volatile ("cpuid" :
+	    "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) :
+	    "a"(leaf), "c"(subleaf));
+}
+
+/// @brief  (x * mult) >> CONV_SHIFT を 128bit で計算する。
+inline u64 mul_shift(u64 x, u64 mult)
+{
+	typedef unsigned __int128 u128;
+
+	return static_cast<u64>((u128(x) * mult) >> CONV_SHIFT);
+}
+
+/// @brief  (x << CONV_SHIFT) / div を 128bit の除算を使わずに計算する。
+//
+/// div は 2^CONV_SHIFT 未満であること。
+inline u64 div_shift(u64 x, u64 div)
+{
+	return ((x / div) << CONV_SHIFT) +
+	       (((x % div) << CONV_SHIFT) / div);
+}
+
+
+/// @brief  Invariant TSC を clock にする clock_source。
+//
+/// clock は TSC の値そのままなので、時刻の取得は RDTSC 1 命令で済む。
+/// clock と nanosec の変換は起動時に求めた mult と CONV_SHIFT による
+/// 乗算とシフトで行う。
+///
+/// タイマは Local APIC の TSC-deadline モードを使い、set_timer() を
+/// 呼び出した CPU に設定する。全ての CPU の TSC は同期していると仮定する。
+class tsc_clock : public clock_source
+{
+	DISALLOW_COPY_AND_ASSIGN(tsc_clock);
+	friend class clock_source;
+
+public:
+	tsc_clock();
+
+	cause::t setup(clock_source* ref);
+
+private:
+	cause::t setup_ops();
+	cause::t calibrate(clock_source* ref);
+
+	cause::pair<tick_time> on_clock_source_UpdateClock();
+	cause::t on_clock_source_SetTimer(tick_time clock, message* msg);
+	cause::pair<u64> on_clock_source_ClockToNanosec(u64 clock);
+	cause::pair<u64> on_clock_source_NanosecToClock(u64 nanosec);
+
+private:
+	u64 tsc_hz;
+
+	/// nanosec = (clock * to_nanosec_mult) >> CONV_SHIFT
+	u64 to_nanosec_mult;
+	/// clock = (nanosec * to_clock_mult) >> CONV_SHIFT
+	u64 to_clock_mult;
+};
+
+tsc_clock::tsc_clock() :
+	tsc_hz(0)
+{
+	PerCpuTimer = true;
+}
+
+/// @param[in] ref  TSC の周波数の較正に使う clock_source。
+cause::t tsc_clock::setup(clock_source* ref)
+{
+	cause::t r = setup_ops();
+	if (is_fail(r))
+		return r;
+
+	r = calibrate(ref);
+	if (is_fail(r))
+		return r;
+
+	to_nanosec_mult = div_shift(NANOSEC_PER_SEC, tsc_hz);
+	to_clock_mult = div_shift(tsc_hz, NANOSEC_PER_SEC);
+
+	lapic_enable_tsc_deadline();
+
+	log()("TSC:").u(tsc_hz / 1000)("kHz")();
+
+	return cause::OK;
+}
+
+cause::t tsc_clock::setup_ops()
+{
+	operations* _ops = new (mem_alloc(sizeof (operations))) operations;
+	if (!_ops)
+		return cause::NOMEM;
+
+	_ops->init();
+
+	_ops->UpdateClock =
+	    clock_source::call_on_clock_source_UpdateClock<tsc_clock>;
+	_ops->SetTimer =
+	    clock_source::call_on_clock_source_SetTimer<tsc_clock>;
+	_ops->ClockToNanosec =
+	    clock_source::call_on_clock_source_ClockToNanosec<tsc_clock>;
+	_ops->NanosecToClock =
+	    clock_source::call_on_clock_source_NanosecToClock<tsc_clock>;
+
+	clock_source::ops = _ops;
+
+	return cause::OK;
+}
+
+/// @brief  ref の clock で CALIBRATE_NS だけ待つ間の TSC を数えて、
+///         TSC の周波数を求める。
+//
+/// 割込みで計測がずれないように、割込み禁止状態で待つ。
+cause::t tsc_clock::calibrate(clock_source* ref)
+{
+	auto wait_clk = ref->nanosec_to_clock(CALIBRATE_NS);
+	if (is_fail(wait_clk))
+		return wait_clk.cause();
+
+	const cpu_word ef = arch::intr_save();
+
+	auto start_clk = ref->update_clock();
+	const u64 start_tsc = arch::read_tsc();
+
+	cause::pair<tick_time> clk = start_clk;
+	if (is_ok(start_clk)) {
+		const tick_time end_clk = start_clk.value() + wait_clk.value();
+
+		for (;;) {
+			clk = ref->update_clock();
+			if (is_fail(clk) || clk.value() >= end_clk)
+				break;
+
+			arch::cpu_relax();
+		}
+	}
+	const u64 end_tsc = arch::read_tsc();
+
+	arch::intr_restore(ef);
+
+	if (is_fail(clk))
+		return clk.cause();
+
+	tick_time start = start_clk.value();
+	tick_time end = clk.value();
+	const u64 elapsed_clk =
+	    static_cast<tick_int>(end) - static_cast<tick_int>(start);
+
+	auto elapsed_ns = ref->clock_to_nanosec(elapsed_clk);
+	if (is_fail(elapsed_ns))
+		return elapsed_ns.cause();
+	if (elapsed_ns.value() == 0)
+		return cause::FAIL;
+
+	tsc_hz = (end_tsc - start_tsc) * NANOSEC_PER_SEC / elapsed_ns.value();
+	if (tsc_hz == 0)
+		return cause::FAIL;
+
+	return cause::OK;
+}
+
+cause::pair<tick_time> tsc_clock::on_clock_source_UpdateClock()
+{
+	tick_time clk(arch::read_tsc());
+
+	LatestClock = clk;
+
+	return cause::pair<tick_time>(cause::OK, clk);
+}
+
+/// @brief  この CPU の TSC-deadline タイマを clock に設定する。
+//
+/// 設定してから clock を過ぎていないか確かめるまで割込みを禁止する。
+/// 間に割込みが入ると、OUTOFRANGE を返した msg も送られてしまう。
+cause::t tsc_clock::on_clock_source_SetTimer(tick_time clock, message* msg)
+{
+	const cpu_word ef = arch::intr_save();
+
+	lapic_set_tsc_deadline(clock, msg);
+
+	cause::t r = cause::OK;
+
+	tick_time now(arch::read_tsc());
+	if (clock < now) {
+		// clock を過ぎている。
+		// 割込みはまだ処理していないので、msg は送られない。
+		lapic_set_tsc_deadline(0, nullptr);
+		r = cause::OUTOFRANGE;
+	}
+
+	arch::intr_restore(ef);
+
+	return r;
+}
+
+cause::pair<u64> tsc_clock::on_clock_source_ClockToNanosec(u64 clock)
+{
+	return cause::pair<u64>(cause::OK, mul_shift(clock, to_nanosec_mult));
+}
+
+cause::pair<u64> tsc_clock::on_clock_source_NanosecToClock(u64 nanosec)
+{
+	return cause::pair<u64>(cause::OK, mul_shift(nanosec, to_clock_mult));
+}
+
+/// @brief  Invariant TSC と TSC-deadline タイマが使えれば true。
+bool tsc_detect()
+{
+	u32 a, b, c, d;
+
+	cpuid(0x80000000, 0, &a, &b, &c, &d);
+	if (a < 0x80000007)
+		return false;
+
+	cpuid(0x80000007, 0, &a, &b, &c, &d);
+	if (!(d & CPUID80000007_EDX_INVARIANT_TSC))
+		return false;
+
+	cpuid(0x01, 0, &a, &b, &c, &d);
+	if (!(c & CPUID1_ECX_TSC_DEADLINE))
+		return false;
+
+	return true;
+}
+
+}  // namespace
+
+/// @brief  TSC の clock_source を作る。
+/// @param[in]  ref     TSC の較正に使う clock_source。
+/// @param[out] clksrc  作った clock_source。
+/// @retval cause::NODEV  Invariant TSC か TSC-deadline タイマが無い。
+//
+/// 失敗したときは ref をそのまま使えばよい。
+cause::t tsc_clock_setup(clock_source* ref, clock_source** clksrc)
+{
+	if (!tsc_detect())
+		return cause::NODEV;
+
+	tsc_clock* tsc = new (mem_alloc(sizeof (tsc_clock))) tsc_clock;
+	if (!tsc)
+		return cause::NOMEM;
+
+	cause::t r = tsc->setup(ref);
+	if (is_fail(r)) {
+		mem_dealloc(tsc);
+		return r;
+	}
+
+	*clksrc = tsc;
+
+	return cause::OK;
+}
+
@@ -68,13 +68,19 @@ protected:
 	}
 
 protected:
-	clock_source() {}
-	clock_source(const operations* _ops) : ops(_ops) {}
+	clock_source() : PerCpuTimer(false) {}
+	clock_source(const operations* _ops) : ops(_ops), PerCpuTimer(false) {}
 
 public:
 	tick_time get_latest_clock() const {
 		return LatestClock;
 	}
+	/// @brief  set_timer() が呼び出した CPU のタイマを設定するならば true。
+	//
+	/// そのときは満了した msg も呼び出した CPU へ送られる。
+	bool is_per_cpu_timer() const {
+		return PerCpuTimer;
+	}
 	cause::pair<tick_time> update_clock() {
 		return ops->UpdateClock(this);
 	}
@@ -92,6 +98,8 @@ protected:
 	const operations* ops;
 
 	tick_time LatestClock;
+
+	bool PerCpuTimer;
 };
 
 
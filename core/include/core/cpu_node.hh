@@ -24,10 +24,69 @@
 #include <core/basic.hh>
 #include <core/message_queue.hh>
 #include <core/thread_sched.hh>
+#include <util/atomic.hh>
 
 
 class page_pool;
 
+/// @brief  CPU ごとの空きページキャッシュ。
+//
+/// page_pool から batch ページずつまとめて補充し、high を超えたら
+/// batch ページずつまとめて返却する。
+/// 最近解放されたページ(hot)は上に積み、キャッシュに載っていない
+/// ページ(cold)は下に積む。割り当ては上から、返却は下から行う。
+/// 所有する CPU からプリエンプション禁止状態でのみ操作するので
+/// 排他制御は不要。
+class page_cache
+{
+public:
+	enum {
+		CAPACITY = 64,
+	};
+
+	page_cache() : high(0), low(0), batch(0), head(0), count(0) {}
+
+	void set_params(int _high, int _low, int _batch) {
+		high = _high;
+		low = _low;
+		batch = _batch;
+	}
+
+	int get_count() const { return count; }
+	bool is_empty() const { return count == 0; }
+	bool is_full() const { return count >= CAPACITY; }
+
+	void push_hot(uptr padr) {
+		pages[(head + count) % CAPACITY] = padr;
+		++count;
+	}
+	void push_cold(uptr padr) {
+		head = (head + CAPACITY - 1) % CAPACITY;
+		pages[head] = padr;
+		++count;
+	}
+	uptr pop_hot() {
+		--count;
+		return pages[(head + count) % CAPACITY];
+	}
+	uptr pop_cold() {
+		const uptr padr = pages[head];
+		head = (head + 1) % CAPACITY;
+		--count;
+		return padr;
+	}
+
+public:
+	int high;   ///< これを超えたら page_pool へ返却する。
+	int low;    ///< アイドル時にはこの数まで page_pool へ返却する。
+	int batch;  ///< page_pool との間でまとめて移動するページ数。
+
+private:
+	uptr pages[CAPACITY];
+	int head;   ///< 一番 cold なページのインデックス
+	int count;
+};
+
 /// Architecture independent part of cpu control.
 class cpu_node
 {
@@ -38,11 +97,17 @@ public:
 
 	cause::t set_page_pool_cnt(int cnt);
 	cause::t set_page_pool(int pri, page_pool* pp);
+	void set_proximity_domain(u32 pd) { proximity_domain = pd; }
+	u32 get_proximity_domain() const { return proximity_domain; }
 
 	cause::t setup();
 
 	cpu_id get_cpu_node_id() const { return cpu_node_id; }
 
+	/// CPU が起動してメッセージを処理できる状態なら true。
+	bool is_online() const { return online; }
+	void set_online() { online = true; }
+
 	void     attach_thread(thread* t);
 	cause::t detach_thread(thread* t);
 	void     ready_thread(thread* t);
@@ -54,25 +119,73 @@ public:
 
 	cause::t page_alloc(arch::page::TYPE page_type, uptr* padr);
 	cause::t page_dealloc(arch::page::TYPE page_type, uptr padr);
+	cause::t page_dealloc_cold(arch::page::TYPE page_type, uptr padr);
+	void drain_page_cache();
+	cause::t page_alloc_contig(uptr count, uptr align, uptr* padr);
+	cause::t page_dealloc_contig(uptr padr, uptr count);
 
-private:
+	u64 get_page_alloc_cnt(const page_pool* pp) const;
+	u64 get_remote_page_alloc_cnt(const page_pool* pp) const;
+
+protected:
 	static void preempt_wait();
 
+private:
+	enum {
+		/// L1 と L2 のページをキャッシュする。
+		PAGE_CACHE_LEVELS = 2,
+	};
+	bool use_page_cache(arch::page::TYPE page_type);
+	cause::t page_cache_alloc(arch::page::TYPE page_type, uptr* padr);
+	cause::t page_cache_dealloc(
+	    arch::page::TYPE page_type, uptr padr, bool cold);
+	void page_cache_drain(arch::page::TYPE page_type, int keep);
+	void count_page_alloc(int pri);
+
 protected:
 	cpu_id       cpu_node_id;
+	volatile bool online;
 	thread_sched threads;
 	cpu_id_t     page_pool_cnt;
 	page_pool* page_pools[CONFIG_MAX_CPUS];
+
+	/// この CPU が属する NUMA ノードの proximity domain
+	u32 proximity_domain;
+
+	/// page_pools[i] から割り当てたページ数。
+	/// この CPU だけがプリエンプション禁止状態で書き込む。
+	u64 page_alloc_cnt[CONFIG_MAX_CPUS];
+
+	/// 他の CPU がこの cpu_node を指定して page_pools[i] から
+	/// 割り当てたページ数。
+	atomic<u64> foreign_page_alloc_cnt[CONFIG_MAX_CPUS];
+
+	page_cache page_caches[PAGE_CACHE_LEVELS];
 };
 
 cpu_id_t get_cpu_node_count();
 cpu_node* get_cpu_node();
 cpu_node* get_cpu_node(cpu_id_t cpuid);
 
+/// @brief  arch::call_on_cpu() で他の CPU に実行させる関数。
+struct cpu_call
+{
+	forward_chain_node<cpu_call> chain_node;
+
+	void (*func)(void* arg);
+	void* arg;
+
+	/// func の実行が終わると true になる。
+	volatile bool done;
+};
+
 namespace arch {
 void post_intr_message(message* msg);
 void post_cpu_message(message* msg);
 void post_cpu_message(message* msg, cpu_node* cpu);
+void request_resched(cpu_node* cpu);
+void call_on_cpu(cpu_node* cpu, cpu_call* call);
+void wait_cpu_call(cpu_call* call);
 }  // namespace arch
 
 void post_message(message* msg); //TODO:OBSOLETED
@@ -0,0 +1,110 @@
+/// @file  core/dentry_cache.hh
+/// @brief Hashed node name cache.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_DENTRY_CACHE_HH_
+#define CORE_DENTRY_CACHE_HH_
+
+#include <core/fs.hh>
+#include <core/spinlock.hh>
+#include <util/chain.hh>
+
+
+class fs_dir_node;
+
+/// @brief  (親ノード, 名前) から子ノードを引くキャッシュ。
+//
+/// エントリは (親ノード, 名前のハッシュ値) でハッシュ表に入れる。
+/// 子ノードが無いことも負のエントリとして覚える。
+///
+/// 検索はロックを取らずに spin_seqlock の read 側で行い、同時に書き込み
+/// があれば読み直す。エントリは setup() で確保した配列から使い回し、
+/// 解放しないので、検索中にエントリが別の名前に変わっても不正なメモリ
+/// は読まない。
+///
+/// エントリが足りなくなったら、最近使っていないエントリを追い出す。
+/// 検索のたびに LRU を並べ替えるとロックが必要になるので、検索では
+/// referenced をセットするだけにして、追い出すときに referenced の
+/// エントリをもう一度 LRU の先頭へ戻す(CLOCK 方式)。
+class dentry_cache
+{
+	NONCOPYABLE(dentry_cache);
+
+public:
+	enum {
+		BUCKET_BITS = 10,
+		BUCKET_NR   = 1 << BUCKET_BITS,
+		ENTRY_NR    = 4096,
+
+		/// これより長い名前はキャッシュしない。
+		NAME_LEN_MAX = 39,
+	};
+
+public:
+	dentry_cache();
+
+	cause::t setup();
+
+	cause::pair<fs_node*> lookup(
+	    const fs_dir_node* parent, const fs::name_key& key);
+	void insert(
+	    const fs_dir_node* parent, const fs::name_key& key, fs_node* node);
+
+private:
+	struct entry
+	{
+		chain_node<entry> hash_chain_node;
+		chain_node<entry> lru_chain_node;
+
+		/// 使っていないエントリは nullptr。
+		const fs_dir_node* parent;
+		/// 負のエントリは nullptr。
+		fs_node*           node;
+		u32                hash;
+		fs::pathlen_t      len;
+		volatile bool      referenced;
+		char               name[NAME_LEN_MAX + 1];
+
+		bool match(const fs_dir_node* _parent, const fs::name_key& key)
+		    const;
+	};
+
+	typedef front_chain<entry, &entry::hash_chain_node> bucket_chain;
+	typedef chain<entry, &entry::lru_chain_node> lru_chain;
+
+	bucket_chain& bucket_of(const fs_dir_node* parent, u32 hash);
+	entry* find(const fs_dir_node* parent, const fs::name_key& key);
+	entry* evict();
+
+private:
+	/// ハッシュ表と LRU の書き換えを排他する。
+	spin_seqlock lock;
+
+	entry* entries;
+
+	/// 先頭が最近使ったエントリ。
+	lru_chain lru;
+
+	bucket_chain buckets[BUCKET_NR];
+};
+
+dentry_cache* get_dentry_cache();
+
+
+#endif  // include guard
+
@@ -49,6 +49,22 @@ pathlen_t   name_length(const char* path);
 int         name_compare(const char* name1, const char* name2);
 pathlen_t   name_copy(const char* src, char* dest);
 pathlen_t   name_normalize(const char* src, char* dest);
+u32         name_hash(const char* name, pathlen_t* len);
+
+/// @brief  Node name with precomputed length and hash.
+//
+/// Compute once per path component and pass down to dentry_cache.
+struct name_key
+{
+    explicit name_key(const char* _name) :
+        name(_name),
+        hash(name_hash(_name, &len))
+    {}
+
+    const char* name;
+    pathlen_t   len;
+    u32         hash;
+};
 
 cause::pair<generic_ns*> create_initial_ns();
 
@@ -94,6 +110,9 @@ public:
 
 private:
     cause::t follow_path(const char* path);
+    cause::t walk_rcu(const char* cwd, const char* path);
+    cause::t follow_path_rcu(const char* path);
+    void reset_walk();
     char* get_path_buffer();
     void push_node_and_forward(fs_node* fsnode, const char** name);
     bool pop_node();
@@ -103,6 +122,8 @@ private:
     generic_ns* const ns;
     node_off const    node_buf_nr;
     node_off          node_use_nr;
+    /// nodes[0] and nodes[ref_base] or later hold refs.
+    node_off          ref_base;
     char*             path_end;
     node              nodes[];
 };
@@ -25,6 +25,7 @@
 #include <core/driver.hh>
 #include <core/fs.hh>
 #include <core/ns.hh>
+#include <core/rcu.hh>
 #include <core/refcnt.hh>
 #include <core/spinlock.hh>
 
@@ -39,6 +40,7 @@ class fs_dev_node;
 class fs_ns;
 
 class io_node;
+class fs_page_cache;
 class process;
 
 const fs::pathlen_t PATHNAME_MAX = 0xffff;
@@ -218,6 +220,23 @@ public:
         typedef cause::t (*CloseNodeIF)(
             fs_mount* x, io_node* ion);
         CloseNodeIF CloseNode;
+
+        /// Filesystems which use fs_page_cache implement ReadPage and
+        /// WritePage.
+        typedef cause::t (*ReadPageIF)(
+            fs_mount* x, fs_node* node, u64 page_idx, void* page);
+        ReadPageIF ReadPage;
+
+        /// Optional. Read page_nr pages from page_idx by one request.
+        /// pages[i] receives page (page_idx + i).
+        typedef cause::t (*ReadPagesIF)(
+            fs_mount* x, fs_node* node, u64 page_idx, uptr page_nr,
+            void* const* pages);
+        ReadPagesIF ReadPages;
+
+        typedef cause::t (*WritePageIF)(
+            fs_mount* x, fs_node* node, u64 page_idx, const void* page);
+        WritePageIF WritePage;
     };
 
     // CreateNode
@@ -320,9 +339,54 @@ public:
         return cause::NOFUNC;
     }
 
+    // ReadPage
+    template <class T>
+    static cause::t call_on_ReadPage(
+        fs_mount* x, fs_node* node, u64 page_idx, void* page) {
+        return static_cast<T*>(x)->
+            on_ReadPage(node, page_idx, page);
+    }
+    static cause::t nofunc_ReadPage(
+        fs_mount*, fs_node*, u64, void*) {
+        return cause::NOFUNC;
+    }
+
+    // ReadPages
+    template <class T>
+    static cause::t call_on_ReadPages(
+        fs_mount* x, fs_node* node, u64 page_idx, uptr page_nr,
+        void* const* pages) {
+        return static_cast<T*>(x)->
+            on_ReadPages(node, page_idx, page_nr, pages);
+    }
+    static cause::t nofunc_ReadPages(
+        fs_mount*, fs_node*, u64, uptr, void* const*) {
+        return cause::NOFUNC;
+    }
+
+    // WritePage
+    template <class T>
+    static cause::t call_on_WritePage(
+        fs_mount* x, fs_node* node, u64 page_idx, const void* page) {
+        return static_cast<T*>(x)->
+            on_WritePage(node, page_idx, page);
+    }
+    static cause::t nofunc_WritePage(
+        fs_mount*, fs_node*, u64, const void*) {
+        return cause::NOFUNC;
+    }
+
     cause::pair<io_node*> open_node(fs_node* node, u32 flags) {
         return ifs->OpenNode(this, node, flags);
     }
+    cause::t read_page(fs_node* node, u64 page_idx, void* page) {
+        return ifs->ReadPage(this, node, page_idx, page);
+    }
+    cause::t read_pages(
+        fs_node* node, u64 page_idx, uptr page_nr, void* const* pages);
+    cause::t write_page(fs_node* node, u64 page_idx, const void* page) {
+        return ifs->WritePage(this, node, page_idx, page);
+    }
     cause::t create_dir_node(
         fs_dir_node* parent, const char* name, u32 flags);
     cause::pair<fs_reg_node*> create_reg_node(
@@ -364,6 +428,7 @@ public:
 	static cause::pair<fs_mount_info*> create(
 	    const char* source, const char* target);
 	static cause::t destroy(fs_mount_info* mp);
+	static void destroy_rcu(void* mp);
 
 	fs_ns*      ns;
 	fs_mount*   mount_obj;
@@ -377,6 +442,10 @@ public:
 	chain_node<fs_mount_info> fs_ns_chain_node;
 	chain_node<fs_mount_info> fs_node_chain_node;
 
+	/// fs_node::into_ns() はロックを取らずに mounts をたどるので、
+	/// アンマウントした後は猶予期間を待ってから解放する。
+	rcu_head rcu_hook;
+
 	char buf[0];
 };
 
@@ -405,14 +474,22 @@ public:
 
 	cause::pair<fs_node*> get_child_node(const char* name);
 	cause::pair<fs_node*> ref_child_node(const char* name);
+	cause::pair<fs_node*> ref_child_node(const fs::name_key& key);
 	fs_node* get_mounted_node();
 
+	cause::t enable_page_cache();
+	cause::t disable_page_cache();
+	fs_page_cache* get_page_cache() { return pcache; }
+
 	refcnt<> refs;
 
 private:
 	fs_mount* owner;
 	u32 node_type;
 
+	/// nullptr if page cache is not used.
+	fs_page_cache* pcache;
+
 	front_chain<fs_mount_info, &fs_mount_info::fs_node_chain_node>
 	    mounts;
 
@@ -440,6 +517,7 @@ public:
 public:
 	cause::t append_child_node(fs_node* child, const char* name);
 	cause::pair<fs_node*> ref_child_node(const char* name);
+	cause::pair<fs_node*> ref_child_node(const fs::name_key& key);
 	cause::pair<fs_reg_node*> create_child_reg_node(const char* name);
 
 private:
@@ -0,0 +1,195 @@
+/// @file  core/fs_page_cache.hh
+/// @brief Per fs_node page cache.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_FS_PAGE_CACHE_HH_
+#define CORE_FS_PAGE_CACHE_HH_
+
+#include <core/io_node.hh>
+#include <core/page.hh>
+#include <core/spinlock.hh>
+
+
+class fs_node;
+
+/// @brief  fs_page_cache の統計情報。
+struct fs_page_cache_stat
+{
+	u64 hits;             ///< キャッシュにあったページ数
+	u64 misses;           ///< デバイスから読んだページ数
+	u64 readahead_pages;  ///< 先読みで読んだページ数
+	u64 writeback_pages;  ///< デバイスへ書き戻したページ数
+};
+
+/// @brief  開いたファイルごとの先読みの状態。
+//
+/// ファイルを開くたびに作る fs_page_cache_io_node に持たせて
+/// fs_page_cache::read() へ渡す。
+struct fs_readahead
+{
+	fs_readahead() :
+		prev_page(U64(-1)),
+		start(0),
+		size(0),
+		trigger_page(U64(-1))
+	{}
+
+	u64  prev_page;     ///< 前回読んだ最後のページ
+	u64  start;         ///< 最後に先読みした窓の先頭のページ
+	uptr size;          ///< 窓のページ数。0 ならばランダムアクセス中。
+	u64  trigger_page;  ///< このページを読んだら次の窓を読む。
+};
+
+/// @brief  fs_node のデータをページ単位でキャッシュする。
+//
+/// ファイルの page_idx 番目のページを基数木で引く。基数木の節は 1 ページ
+/// で ENTRY_NR 個の子を持ち、葉はページの状態を持つ cache_page。
+///
+/// キャッシュに無いページは fs_mount::read_page() でデバイスから読み、
+/// 書き込んだページは dirty にしておいて writeback() でまとめて
+/// fs_mount::write_page() で書き戻す。
+/// 連続して読んでいるときは、後ろのページを先読みする(read_ahead())。
+/// 先読みする窓は連続して読むたびに倍にし、RA_MAX_PAGES で止める。
+/// 先読みは read() の中では行わず、窓を先読みスレッドへ渡して戻る。
+/// 先読みスレッドは窓のうちキャッシュに無いページが続くところを
+/// fs_mount::read_pages() で1回の要求として読む。
+/// 窓の先頭のページを読んだら、次の窓を先読みスレッドへ渡す。
+/// 連続していないところでキャッシュに無いページを読んだら、窓を捨てて
+/// 要求されたページだけを読む。
+///
+/// ページはデバイスから読み終えてからキャッシュに入れるので、キャッシュ
+/// にあるページは常に最新の内容を持つ。
+/// ページは destroy() まで解放しないので、一度キャッシュに入れたページの
+/// アドレスはロックを外しても使える。
+/// デバイスの読み書きはロックを外して行う。
+class fs_page_cache
+{
+	DISALLOW_COPY_AND_ASSIGN(fs_page_cache);
+
+public:
+	enum {
+		PAGE_SIZE  = arch::page::PHYS_L1_SIZE,
+
+		ENTRY_BITS = 9,
+		ENTRY_NR   = 1 << ENTRY_BITS,
+		ENTRY_MASK = ENTRY_NR - 1,
+
+		/// 先読みの窓の最初のページ数。
+		RA_INIT_PAGES = 4,
+		/// 先読みの窓の最大のページ数。
+		RA_MAX_PAGES  = 128,
+	};
+
+public:
+	fs_page_cache(fs_node* _owner);
+
+	void destroy();
+
+	u64  get_size();
+	void set_size(u64 bytes);
+
+	cause::pair<uptr> read(
+	    u64 off, void* data, uptr bytes, fs_readahead* ra = nullptr);
+	cause::pair<uptr> write(u64 off, const void* data, uptr bytes);
+
+	uptr readahead(u64 page_idx, uptr page_nr);
+	cause::t writeback();
+
+private:
+	enum {
+		/// ページの内容をデバイスへ書き戻していない。
+		DIRTY = 0x1,
+	};
+
+	struct cache_page
+	{
+		u8*         data;
+		volatile u8 flags;
+	};
+
+	bool covers(u64 page_idx) const {
+		return height * ENTRY_BITS >= 64 ||
+		       (page_idx >> (height * ENTRY_BITS)) == 0;
+	}
+
+	cache_page* lookup(u64 page_idx) const;
+	cause::t insert(u64 page_idx, cache_page* cp);
+	cause::pair<cache_page*> get_page(u64 page_idx, bool fill);
+	cause::pair<cache_page*> create_page(u64 page_idx, bool fill);
+	cause::pair<cache_page*> install_page(
+	    u64 page_idx, void* data, u8 flags);
+	cause::t write_full_page(u64 page_idx, const u8* data);
+	cause::pair<uptr> fill_pages(u64 page_idx, uptr page_nr);
+	void release(uptr entry, int h);
+	cause::t writeback(uptr entry, int h, u64 page_idx);
+
+	void read_ahead(fs_readahead* ra, u64 page_idx, bool miss);
+	void queue_readahead(u64 page_idx, uptr page_nr);
+	void cancel_readahead();
+	uptr clamp_pages(u64 page_idx, uptr page_nr);
+
+	static void* alloc_page();
+	static void free_page(void* page);
+
+private:
+	fs_node* owner;
+
+	/// 基数木と cache_page::flags、size_bytes、shared_ra を排他する。
+	spin_lock lock;
+
+	/// 各エントリは子の節のアドレスか cache_page*。
+	uptr root;
+	int  height;
+
+	u64  size_bytes;
+
+	/// read() に fs_readahead を渡さなかったときに使う。
+	/// read() はロックを取って写してから使い、読み終えたら書き戻す。
+	fs_readahead shared_ra;
+};
+
+/// @brief  fs_page_cache を通してファイルを読み書きする io_node。
+//
+/// ページキャッシュを使うファイルシステムは、開くたびにこれを作って
+/// fs_mount::interfaces::OpenNode から返す。先読みの状態は開いたファイル
+/// ごとに持つ。io_node::close() で解放する。
+class fs_page_cache_io_node : public io_node
+{
+	DISALLOW_COPY_AND_ASSIGN(fs_page_cache_io_node);
+
+public:
+	fs_page_cache_io_node(fs_node* _fsnode);
+
+	static cause::pair<io_node*> create(fs_node* fsnode);
+
+	static cause::t on_Close(fs_page_cache_io_node* x);
+	cause::t on_io_node_seek(
+	    seek_whence whence, offset rel_off, offset* abs_off);
+	cause::pair<uptr> on_Read(offset off, void* data, uptr bytes);
+	cause::pair<uptr> on_Write(offset off, const void* data, uptr bytes);
+
+private:
+	fs_node* fsnode;
+	fs_readahead ra;
+};
+
+void fs_page_cache_get_stat(fs_page_cache_stat* stat);
+
+
+#endif  // include guard
+
@@ -13,6 +13,7 @@
 
 class cpu_node;
 class ns_ctl;
+class dentry_cache;
 class device_ctl;
 class dev_node_ctl;
 class driver_ctl;
@@ -26,6 +27,10 @@ class process_ctl;
 class timer_ctl;
 class vadr_pool;
 
+namespace uniqos {
+class syscall_ctl;
+}
+
 namespace global_vars {
 
 struct _core
@@ -47,6 +52,8 @@ struct _core
 
 	ns_ctl*            ns_ctl_obj;
 
+	dentry_cache*      dentry_cache_obj;
+
 	device_ctl*        device_ctl_obj;
 
 	dev_node_ctl*      dev_node_ctl_obj;
@@ -67,6 +74,8 @@ struct _core
 
 	process_ctl*       process_ctl_obj;
 
+	uniqos::syscall_ctl* syscall_ctl_obj;
+
 	timer_ctl*         timer_ctl_obj;
 
 	vadr_pool*         vadr_pool_obj;
@@ -0,0 +1,126 @@
+/// @file  core/lockstat.hh
+/// @brief Spin lock statistics.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_LOCKSTAT_HH_
+#define CORE_LOCKSTAT_HH_
+
+#include <arch.hh>
+#include <config.h>
+
+
+class output_buffer;
+
+#if CONFIG_LOCKSTAT && defined KERNEL
+# define LOCKSTAT_ENABLED 1
+#else
+# define LOCKSTAT_ENABLED 0
+#endif
+
+/// @brief  ロックを取得した場所ごとの統計情報。
+struct lockstat_site
+{
+	const void* volatile caller;  ///< lock() を呼び出したアドレス
+	u64 acquire_cnt;              ///< ロックを取得した回数
+	u64 contended_cnt;            ///< すぐにロックできなかった回数
+	u64 spin_cycles;              ///< ロックを待った TSC サイクル数
+	u64 max_hold_cycles;          ///< 排他ロックを保持した最長 TSC サイクル数
+};
+
+lockstat_site* lockstat_get_site(const void* caller);
+void lockstat_acquired(lockstat_site* site, bool contended, u64 spin_cycles);
+void lockstat_released(lockstat_site* site, u64 hold_cycles);
+cause::t lockstat_dump(output_buffer& ob);
+
+/// @brief  spin_lock と spin_rwlock から呼び出す統計情報のフック。
+//
+/// ENABLE が false なら全て空の関数になり、holder も空のクラスになる。
+/// spin_lock は holder を継承するので、統計情報を取らなければ
+/// spin_lock のサイズも変わらない。
+template<bool ENABLE>
+class lockstat_hook
+{
+public:
+	class holder {};
+
+	class probe
+	{
+	public:
+		explicit probe(const void*) {}
+		void contend() {}
+		void acquired(holder*) {}
+	};
+
+	static void released(holder*) {}
+};
+
+template<>
+class lockstat_hook<true>
+{
+public:
+	/// 排他ロックを保持している間の情報
+	class holder
+	{
+		friend class lockstat_hook<true>;
+
+	protected:
+		holder() : site(nullptr) {}
+
+	private:
+		lockstat_site* site;
+		u64 acquired_tsc;
+	};
+
+	/// ロックを取得するまでの情報
+	class probe
+	{
+	public:
+		explicit probe(const void* caller) :
+			site(lockstat_get_site(caller)),
+			start_tsc(arch::read_tsc()),
+			contended(false)
+		{}
+
+		void contend() { contended = true; }
+
+		/// @param[in] h  排他ロックでなければ nullptr。
+		void acquired(holder* h) {
+			const u64 now = arch::read_tsc();
+			lockstat_acquired(site, contended, now - start_tsc);
+			if (h) {
+				h->site = site;
+				h->acquired_tsc = now;
+			}
+		}
+
+	private:
+		lockstat_site* site;
+		u64 start_tsc;
+		bool contended;
+	};
+
+	static void released(holder* h) {
+		if (h->site)
+			lockstat_released(h->site, arch::read_tsc() - h->acquired_tsc);
+	}
+};
+
+typedef lockstat_hook<LOCKSTAT_ENABLED> lockstat;
+
+
+#endif  // include guard
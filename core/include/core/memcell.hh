@@ -78,10 +78,14 @@ public:
 
 	cause::t reserve_1page(uptr* padr);
 	cause::t free_1page(uptr padr);
+	cause::t reserve_pages(sptr pages, sptr align, uptr* padr);
+
+	sptr get_max_run_pages() const;
 
 private:
 	cause::t _reserve_1page(uptr* padr);
 	cause::t _free_1page(uptr padr);
+	cause::t _reserve_pages(sptr pages, sptr align, uptr* padr);
 
 private:
 	/// メモリアドレスを表現するときは uptr を使う。
@@ -192,6 +196,7 @@ private:
 	}
 
 	bool import_uplevel_page();
+	int search_run(const cell* c, page_t pages, page_t align) const;
 
 public:
 	void dump(uptr total_mem, output_buffer& lt, uint level)
@@ -314,7 +319,7 @@ void mem_cell_base<CELLTYPE>::free_range(uptr from_adr, uptr to_adr)
 
 	for (cell_t cell = fr_cell; cell <= to_cell; ++cell) {
 		if (cell != fr_cell && cell != to_cell) {
-			cell_table[cell].table.set_true_all();
+			cell_table[cell].table.set_raw(free_pattern);
 			continue;
 		}
 
@@ -395,6 +400,33 @@ cause::t mem_cell_base<CELLTYPE>::free_1page(uptr padr)
 	return r;
 }
 
+/// @brief  連続した pages ページを予約する。
+/// @param[in] pages  予約するページ数。get_max_run_pages() 以下。
+/// @param[in] align  先頭ページのアラインメントをページ数で指定する。
+///                   2^n で、get_max_run_pages() 以下。
+/// @param[out] padr  予約したページの先頭アドレスを返す。
+template<class CELLTYPE>
+cause::t mem_cell_base<CELLTYPE>::reserve_pages(
+    sptr pages, sptr align, uptr* padr)
+{
+	const cause::t r = _reserve_pages(pages, align, padr);
+
+	if (is_ok(r))
+		alloc_pages += pages;
+
+	return r;
+}
+
+/// @brief  reserve_pages() で予約できる最大のページ数を返す。
+//
+/// cell の中でしか連続したページを探さないので、cell のページ数か
+/// int_bitset のビット数の小さいほうになる。
+template<class CELLTYPE>
+sptr mem_cell_base<CELLTYPE>::get_max_run_pages() const
+{
+	return min<sptr>(pages_in_cell(), BITMAP_BITS);
+}
+
 /// @brief １ページだけ予約する。
 /// @param[out] padr 予約した物理ページのアドレスを返す。
 /// @retval cause::OK 成功した。
@@ -456,6 +488,82 @@ cause::t mem_cell_base<CELLTYPE>::_free_1page(uptr padr)
 }
 
 
+/// @brief  連続した pages ページを予約する。
+//
+/// free_chain の先頭から SEARCH_CELLS 個の cell の中で探し、
+/// 見つからなければ上位レベルのページを１つ崩して新しい cell から予約する。
+/// 上位レベルのページを崩す処理はレベル数に比例するので O(log n)。
+template<class CELLTYPE>
+cause::t mem_cell_base<CELLTYPE>::_reserve_pages(
+    sptr pages, sptr align, uptr* padr)
+{
+	const int SEARCH_CELLS = 16;
+
+	if (pages <= 0 || pages > get_max_run_pages() ||
+	    align <= 0 || align > get_max_run_pages())
+		return cause::BADARG;
+
+	cell* c = free_chain.front();
+	int offset = -1;
+	for (int i = 0; c && i < SEARCH_CELLS; ++i, c = free_chain.next(c)) {
+		offset = search_run(c, pages, align);
+		if (offset >= 0)
+			break;
+	}
+
+	if (offset < 0) {
+		if (!import_uplevel_page())
+			return cause::NOMEM;
+
+		c = free_chain.front();
+		offset = search_run(c, pages, align);
+		if (offset < 0)
+			return cause::NOMEM;
+	}
+
+	const CELLTYPE run = pages >= BITMAP_BITS ?
+	    ~CELLTYPE(0) : (CELLTYPE(1) << pages) - 1;
+	c->table.set_raw(c->table.get_raw() & ~(run << offset));
+	free_pages -= pages;
+
+	if (c->table.is_false_all())
+		free_chain.remove(c);
+
+	*padr = get_page_adr(c, offset);
+
+	return cause::OK;
+}
+
+/// @brief  cell の中で連続した空きページを探す。
+/// @return 見つかった先頭ページの cell 内の位置を返す。
+///         見つからなければ -1 を返す。
+//
+/// ビット i が立っていれば i から始まる pages ページが空いている
+/// というビット列を、シフトと AND を log(pages) 回繰り返して作る。
+template<class CELLTYPE>
+int mem_cell_base<CELLTYPE>::search_run(
+    const cell* c, page_t pages, page_t align) const
+{
+	CELLTYPE m = c->table.get_raw();
+
+	for (page_t len = 1; len < pages; ) {
+		const page_t shift = min(len, pages - len);
+		m &= m >> shift;
+		len += shift;
+	}
+
+	// align ページごとの位置だけを残す。
+	if (align >= BITMAP_BITS)
+		m &= 1;
+	else if (align > 1)
+		m &= ~CELLTYPE(0) / ((CELLTYPE(1) << align) - 1);
+
+	if (m == 0)
+		return -1;
+
+	return find_first_setbit(m);
+}
+
 /// 上のレベルから 1 page だけ崩して 1 cell として取り込む。
 /// @retval true  Succeeds.
 /// @retval false No memory in uplevel.
@@ -50,6 +50,28 @@ private:
 	};
 	typedef front_forward_chain<memobj, &memobj::chain_node> obj_chain;
 
+	/// @brief  CPU ごとに memobj をキャッシュするための入れ物。
+	//
+	/// Bonwick の magazine と同じもの。node ごとに loaded と previous の
+	/// 2つを持ち、満杯／空の magazine は mempool の depot と交換する。
+	struct magazine
+	{
+		enum { ROUNDS = 30 };
+
+		bool is_empty() const { return rounds == 0; }
+		bool is_full() const { return rounds == ROUNDS; }
+		void push(memobj* obj) { objs[rounds++] = obj; }
+		memobj* pop() { return objs[--rounds]; }
+
+		forward_chain_node<magazine> chain_node;
+		u32 rounds;
+		memobj* objs[ROUNDS];
+	};
+	typedef front_forward_chain<magazine, &magazine::chain_node>
+	    magazine_chain;
+
+	class node;
+
 	class page
 	{
 	public:
@@ -59,6 +81,9 @@ private:
 		bool is_free() const;
 		u8* get_memory();
 
+		node* get_owner_node() { return owner_node; }
+		void set_owner_node(node* nd) { owner_node = nd; }
+
 		void init_as_onpage(const mempool& pool);
 		void init_as_offpage(const mempool& pool, void* _memory);
 		memobj* acquire();
@@ -78,6 +103,9 @@ private:
 
 		u8* memory;
 
+		/// このページを保持している mempool::node
+		node* owner_node;
+
 	public:
 		chain_node<page> mempool_node;
 	};
@@ -94,15 +122,24 @@ private:
 		void* acquire();
 		void release(void* ptr);
 
+		memobj* cache_acquire(mempool* owner);
+		bool cache_release(void* ptr, mempool* owner);
+		void drain_cache(mempool* owner);
+
 		sptr get_freeobj_cnt() const { return freeobj_cnt; }
+		sptr get_alloc_cnt() const { return alloc_cnt; }
+		void inc_alloc_cnt() { ++alloc_cnt; }
+		void dec_alloc_cnt() { --alloc_cnt; }
 
 		void push_page(page* new_page);
-		memobj* pop_freeobj(mempool* owner);
+		memobj* pop_freeobj();
 		void collect_free_pages(mempool* owner);
-		bool back_to_page(memobj* obj, mempool* owner);
+		void back_to_page(page* pg, memobj* obj, mempool* owner);
 
 	private:
 		void import_dirty_page(page* page);
+		memobj* _acquire();
+		void acquire_bulk(magazine* mag);
 
 	private:
 		sptr freeobj_cnt;
@@ -113,6 +150,16 @@ private:
 		page_bichain full_pages;
 
 		spin_lock lock;
+
+		/// 以下は node に対応する CPU がプリエンプション禁止状態で
+		/// のみアクセスするので、ロックも atomic 命令も使わない。
+
+		magazine* loaded;
+		magazine* previous;
+
+		/// この CPU で確保した数 - この CPU で解放した数。
+		/// 他の CPU で解放すると負数になることもある。
+		sptr alloc_cnt;
 	};
 
 public:
@@ -140,7 +187,7 @@ public:
 	u32 get_obj_size() const { return obj_size; }
 	uptr get_page_size() const { return page_size; }
 	u32 get_page_objs() const { return page_objs; }
-	sptr get_alloc_cnt() const { return alloc_cnt.load(); }
+	sptr get_alloc_cnt() const;
 
 	cause::pair<void*> acquire();
 	cause::pair<void*> acquire(cpu_id_t cpuid);
@@ -174,18 +221,27 @@ private:
 	void attach(page* pg);
 	page* new_page(int cpuid);
 	void delete_page(page* pg);
-	void back_to_page(cpu_id src_cpu, memobj* obj);
+	page* page_of_obj(memobj* obj);
+	void back_to_page(memobj* obj);
 
 	void set_node(int i, node* nd);
 	auto get_node(int i) -> node*;
 
+	void set_magazine_pool(mempool* mp) { magazine_mp = mp; }
+	magazine* new_magazine();
+	void delete_magazine(magazine* mag);
+	void drain_magazine(magazine* mag);
+	magazine* depot_exchange_full(magazine* empty);
+	magazine* depot_exchange_empty(magazine* full);
+	void depot_put_full(magazine* full);
+	void drain_depot();
+
 private:
 	const u32              obj_size;
 	const arch::page::TYPE page_type;
 	const uptr             page_size;
 	const u32              page_objs;  ///< ページの中にあるオブジェクト数
 
-	atomic<sptr>           alloc_cnt;
 	atomic<sptr>           page_cnt;
 	atomic<sptr>           shared_count;
 
@@ -195,6 +251,14 @@ private:
 
 	node* mempool_nodes[CONFIG_MAX_CPUS];
 
+	/// magazine の確保元。nullptr なら magazine を使わない。
+	mempool* magazine_mp;
+
+	/// CPU 間で magazine を受け渡すための depot。
+	magazine_chain depot_full;
+	magazine_chain depot_empty;
+	spin_lock      depot_lock;
+
 	char obj_name[32];
 
 // mem_allocator implement
@@ -221,9 +285,6 @@ private:
 	mp_mem_allocator _mem_allocator;
 };
 
-void* mem_alloc(u32 bytes);
-void mem_dealloc(void* mem);
-
 
 #endif  // CORE_MEMPOOL_HH_
 
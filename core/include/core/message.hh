@@ -27,6 +27,7 @@ public:
 	}
 
 	forward_chain_node<message> msgq_chain_node;
+	message* volatile inbox_next;  ///< message_inbox 用
 	handler_type handler;
 };
 
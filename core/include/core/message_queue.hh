@@ -29,6 +29,26 @@ private:
 	forward_chain<message, &message::msgq_chain_node> msg_chain;
 };
 
+/// @brief  他の CPU から message を受け取るための箱。
+//
+/// 複数の CPU から push() し、受け取る CPU だけが take_all() する。
+/// push() は cmpxchg でリストの先頭に繋ぐだけでロックは使わない。
+/// take_all() は xchg でリスト全体を取り出すので、１つずつ取り出す
+/// ときのような ABA 問題は起きない。
+class message_inbox
+{
+public:
+	message_inbox() : head(nullptr) {}
+
+	bool push(message* msg);
+	bool probe() const { return head != nullptr; }
+	int take_all(message_queue* q);
+
+private:
+	/// 最後に push() された message。inbox_next で古い方へ繋がる。
+	message* volatile head;
+};
+
 
 #endif  // include guard
 
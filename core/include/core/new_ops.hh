@@ -122,7 +122,82 @@ template<class T> inline cause::t new_destroy(T* p, mem_allocator& alloc)
     return cause::OK;
 }
 
-mem_allocator& generic_mem();
+
+/// @name shared mempool のサイズクラス
+/// shared mempool のオブジェクトサイズは 2^n と 1.5*2^n を交互に並べた
+/// ものなので、最上位ビットの位置とその１つ下のビットだけでクラスが決まる。
+/// @{
+
+enum {
+    MEM_CLASS_MIN_BITS = 5,   ///< 最小クラスは 32 バイト
+    MEM_CLASS_MAX_BITS = 20,  ///< 最大クラスは 1.5 MiB
+    MEM_CLASS_NR = (MEM_CLASS_MAX_BITS - MEM_CLASS_MIN_BITS + 1) * 2,
+};
+
+constexpr uint mem_class_msb_(uptr x)
+{
+    return sizeof (unsigned long long) * 8 - 1 - __builtin_clzll(x);
+}
+
+/// @brief  bytes が収まる最小のサイズクラスを返す。
+/// @return 大きすぎるときは MEM_CLASS_NR 以上の値を返す。
+//
+/// bytes が定数ならコンパイル時に計算できる。
+constexpr uint mem_size_class(uptr bytes)
+{
+    return bytes <= (UPTR(1) << MEM_CLASS_MIN_BITS) ? 0 :
+        (mem_class_msb_(bytes - 1) - MEM_CLASS_MIN_BITS) * 2 + 1 +
+        (((bytes - 1) >> (mem_class_msb_(bytes - 1) - 1)) & 1);
+}
+
+/// @brief  サイズクラスのオブジェクトサイズを返す。
+constexpr uptr mem_class_size(uint size_class)
+{
+    return size_class % 2 == 0 ?
+        UPTR(1) << (MEM_CLASS_MIN_BITS + size_class / 2) :
+        UPTR(3) << (MEM_CLASS_MIN_BITS + size_class / 2 - 1);
+}
+
+/// @}
+
+void* mem_alloc_class(uint size_class);
+void  mem_dealloc(void* mem);
+
+/// shared mempool から確保するときは、先頭に mempool へのポインタを置く。
+inline void* mem_alloc(u32 bytes)
+{
+    return mem_alloc_class(mem_size_class(bytes + sizeof (mempool*)));
+}
+
+/// @brief  generic_mem() が返す mem_allocator.
+//
+/// operator new から mem_alloc() を直接呼び出すので、
+/// new (generic_mem()) T のようにサイズが定数なら、サイズクラスの計算は
+/// コンパイル時に済む。
+class generic_mem_allocator : public mem_allocator
+{
+public:
+    generic_mem_allocator(const interfaces* _ifs) : mem_allocator(_ifs) {}
+};
+
+generic_mem_allocator& generic_mem();
+
+inline void* operator new (uptr size, generic_mem_allocator&) throw()
+{
+    return mem_alloc(size);
+}
+inline void operator delete (void* p, generic_mem_allocator&)
+{
+    mem_dealloc(p);
+}
+inline void* operator new[] (uptr size, generic_mem_allocator&) throw()
+{
+    return mem_alloc(size);
+}
+inline void operator delete[] (void* p, generic_mem_allocator&)
+{
+    mem_dealloc(p);
+}
 
 
 #endif  // CORE_NEW_OPS_HH_
@@ -16,6 +16,13 @@ cause::pair<uptr> page_alloc(cpu_id cpuid, page_level page_type);
 cause::t page_alloc(page_level page_type, uptr* padr);
 cause::t page_alloc(cpu_id cpuid, page_level page_type, uptr* padr);
 cause::t page_dealloc(page_level page_type, uptr padr);
+cause::t page_dealloc_cold(page_level page_type, uptr padr);
+
+cause::t page_alloc_contig(uptr count, uptr align, uptr* padr);
+cause::t page_dealloc_contig(uptr padr, uptr count);
+
+cause::t page_set_owner(uptr padr, void* owner);
+void* page_get_owner(uptr padr);
 
 
 #endif  // include guard
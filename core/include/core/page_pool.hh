@@ -8,6 +8,7 @@
 
 #include <core/pagetbl.hh>
 #include <core/memcell.hh>
+#include <core/spinlock.hh>
 
 
 /// @brief Page pool
@@ -28,11 +29,35 @@ public:
 
 	cause::t alloc(arch::page::TYPE pt, uptr* padr);
 	cause::t dealloc(arch::page::TYPE pt, uptr padr);
+	int alloc_pages(arch::page::TYPE pt, int n, uptr* padrs);
+	cause::t dealloc_pages(arch::page::TYPE pt, int n, const uptr* padrs);
+	cause::t alloc_contig(uptr count, uptr align, uptr* padr);
+	cause::t dealloc_contig(uptr padr, uptr count);
+
+	bool test_range(uptr padr);
+	cause::t set_page_owner(uptr padr, void* owner);
+	void* get_page_owner(uptr padr);
+
+	uptr get_free_bytes();
 
 	void dump(output_buffer& ob, uint level);
 
 private:
+	uptr owner_index(uptr padr) const {
+		return (padr - adr_offset) >> arch::page::L1_SIZE_BITS;
+	}
+	cause::t free_range_pages(uptr from, uptr to);
+
+private:
+	/// mem_cell_base は排他制御をしないので page_pool で排他する。
+	spin_lock lock;
+
 	mem_cell_base<uptr> page_base[arch::page::LEVEL_COUNT];
+
+	/// L1 ページごとに、そのページを使っているオブジェクトへのポインタを
+	/// 保持する。ページの先頭アドレスから所有者を O(1) で引くために使う。
+	void** page_owners;
+
 	uptr adr_offset;
 	uptr pool_bytes;
 
@@ -0,0 +1,82 @@
+/// @file  core/rcu.hh
+/// @brief Read-copy-update with epoch based grace periods.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_RCU_HH_
+#define CORE_RCU_HH_
+
+#include <core/basic.hh>
+#include <util/chain.hh>
+
+
+/// @brief  rcu_call() で猶予期間の後に呼び出す関数。
+//
+/// 解放するオブジェクトに埋め込んで使う。
+struct rcu_head
+{
+	typedef void (*func_type)(void* arg);
+
+	chain_node<rcu_head> rcu_chain_node;
+	u64       epoch;
+	func_type func;
+	void*     arg;
+};
+
+/// @defgroup rcu
+/// @{
+/// RCU の read 側はプリエンプション禁止区間にする。
+/// スレッドは message_loop() へ戻らなければ切り替わらないので、CPU が
+/// message_loop() を 1 周すれば、その CPU の read 側の区間は全て終わって
+/// いる(静止状態)。
+///
+/// rcu_call() は epoch を 1 つ進めて、その epoch を head に記録する。
+/// 全ての online の CPU がその epoch 以降に静止状態を通過したら、
+/// rcu_call() を呼び出した CPU の message_loop() で head->func(head->arg)
+/// を呼び出す。
+/// 停止中の CPU は read 側の区間に入っていないので待たない。
+/// 待っている CPU は、止まる前に rcu_wait_prepare() で遅れている CPU に
+/// message を送って静止状態を通過させ、その CPU に起こしてもらう。
+
+void rcu_read_lock();
+void rcu_read_unlock();
+
+void rcu_call(rcu_head* head, rcu_head::func_type func, void* arg);
+
+bool rcu_quiescent();
+bool rcu_wait_prepare();
+void rcu_idle_enter();
+void rcu_idle_exit();
+
+/// @}
+
+class rcu_read_section
+{
+	NONCOPYABLE(rcu_read_section);
+
+public:
+	rcu_read_section() {
+		rcu_read_lock();
+	}
+	~rcu_read_section() {
+		rcu_read_unlock();
+	}
+};
+
+
+#endif  // include guard
+
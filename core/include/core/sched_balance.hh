@@ -0,0 +1,36 @@
+/// @file  core/sched_balance.hh
+/// @brief Load balancing between cpu_node run queues.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_SCHED_BALANCE_HH_
+#define CORE_SCHED_BALANCE_HH_
+
+#include <core/basic.hh>
+
+
+class cpu_node;
+
+cause::t sched_balance_setup();
+bool sched_balance_idle(cpu_node* cn);
+void sched_balance_periodic();
+void sched_balance_wakeup(cpu_node* cn);
+void sched_balance_restart();
+
+
+#endif  // include guard
+
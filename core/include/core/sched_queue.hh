@@ -0,0 +1,149 @@
+/// @file  core/sched_queue.hh
+/// @brief Ready queues of thread_sched.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_SCHED_QUEUE_HH_
+#define CORE_SCHED_QUEUE_HH_
+
+#include <core/thread.hh>
+
+
+/// @brief  到着順に実行するキュー。
+//
+/// CONFIG_SCHED_FAIR == 0 のときに使う従来のラウンドロビン。
+class fifo_sched_queue
+{
+public:
+	fifo_sched_queue() : count(0) {}
+
+	void push(thread* t) {
+		queue.push_back(t);
+		++count;
+	}
+	thread* pop() {
+		thread* t = queue.pop_front();
+		if (t)
+			--count;
+		return t;
+	}
+	void remove(thread* t) {
+		queue.remove(t);
+		--count;
+	}
+
+	/// 次に pop() で取り出されるようにする。
+	void boost(thread* t) {
+		queue.remove(t);
+		queue.push_front(t);
+	}
+
+	int get_count() const { return count; }
+	u64 get_min_vruntime() const { return 0; }
+
+	/// 後ろから順に pred を満たす thread を探す。
+	template<class PRED> thread* find(PRED pred) {
+		for (thread* t = queue.back(); t; t = queue.prev(t)) {
+			if (pred(t))
+				return t;
+		}
+		return nullptr;
+	}
+
+	template<class FUNC> void for_each(FUNC func) {
+		for (thread* t = queue.front(); t; t = queue.next(t))
+			func(t);
+	}
+
+private:
+	chain<thread, &thread::_thread_sched_chainnode> queue;
+	int count;
+};
+
+/// @brief  vruntime が小さい順に実行するキュー。
+//
+/// vruntime は thread の実行時間を重みで割った値なので、重みに比例した
+/// CPU 時間が各 thread に割り当てられる。
+/// ready な thread は vruntime をキーにした leftist heap に入れるので、
+/// push / pop / remove は O(log n) になる。
+/// boost() された thread は heap とは別の urgent_queue に入れ、heap より
+/// 先に取り出す。
+class fair_sched_queue
+{
+public:
+	fair_sched_queue();
+
+	void push(thread* t);
+	thread* pop();
+	void remove(thread* t);
+	void boost(thread* t);
+
+	int get_count() const { return count; }
+	u64 get_min_vruntime() const { return min_vruntime; }
+
+	/// heap の中から pred を満たす thread を探す。
+	template<class PRED> thread* find(PRED pred) {
+		return find_heap(root, pred);
+	}
+
+	template<class FUNC> void for_each(FUNC func) {
+		for (thread* t = urgent_queue.front(); t; t = urgent_queue.next(t))
+			func(t);
+		for_each_heap(root, func);
+	}
+
+private:
+	static s32 npl(const thread* t) { return t ? t->sched_heap_npl : -1; }
+	static thread* merge(thread* a, thread* b);
+	void heap_remove(thread* t);
+
+	/// vruntime の大きい右側の部分木から探す。
+	template<class PRED> static thread* find_heap(thread* t, PRED& pred) {
+		if (!t)
+			return nullptr;
+		thread* r = find_heap(t->sched_heap_right, pred);
+		if (!r)
+			r = find_heap(t->sched_heap_left, pred);
+		if (!r && pred(t))
+			r = t;
+		return r;
+	}
+
+	template<class FUNC> static void for_each_heap(thread* t, FUNC& func) {
+		if (!t)
+			return;
+		func(t);
+		for_each_heap(t->sched_heap_left, func);
+		for_each_heap(t->sched_heap_right, func);
+	}
+
+private:
+	thread* root;
+
+	/// 今までに heap から取り出した thread の vruntime の最大値。
+	/// 長く眠っていた thread が CPU を独占しないように、
+	/// push() する thread の vruntime はこの値より小さくしない。
+	u64 min_vruntime;
+
+	int count;
+
+	chain<thread, &thread::_thread_sched_chainnode> urgent_queue;
+};
+
+
+#endif  // include guard
+
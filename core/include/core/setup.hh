@@ -21,6 +21,8 @@ cause::t driver_ctl_setup();
 cause::t timer_setup();
 cause::t module_ctl_init();
 cause::t fs_ctl_setup();
+cause::t fs_page_cache_setup();
+cause::t dentry_cache_setup();
 cause::t vadr_pool_setup();
 cause::t ata_setup();
 cause::t ahci_setup();
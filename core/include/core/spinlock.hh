@@ -21,26 +21,29 @@
 
 #include <util/atomic.hh>
 #include <arch/spinlock_ops.hh>
+#include <core/lockstat.hh>
 
 
-class spin_lock
+/// @brief キュー付きスピンロック
+//
+/// ロックを待つ CPU は CPU ごとのノードをキューにつないで、自分のノード
+/// だけを見て待つ。待っている CPU の間でキャッシュラインを奪い合わず、
+/// キューに入った順にロックを取得する。
+/// キューに入っている間はプリエンプション禁止状態のままにする。
+class spin_lock :
+	public arch::spin_lock_ops,
+	private lockstat::holder
 {
 	NONCOPYABLE(spin_lock);
 
-	enum {
-		UNLOCKED = 0,
-		LOCKED = 1,
-	};
-	atomic<u8> atom;
-
 public:
-	spin_lock() : atom(UNLOCKED) {}
+	spin_lock() {}
 
 	bool is_locked() const {
-		return atom.load() == LOCKED;
+		return spin_lock_ops::is_locked();
 	}
 	bool is_unlocked() const {
-		return atom.load() == UNLOCKED;
+		return !spin_lock_ops::is_locked();
 	}
 
 	void lock();
@@ -52,9 +55,8 @@ public:
 	void unlock_np();
 
 private:
-	bool _try_lock() {
-		return atom.exchange(LOCKED) == UNLOCKED;
-	}
+	void _lock_np(const void* caller);
+	void lock_queued();
 };
 
 
@@ -108,7 +110,13 @@ private:
 	spin_lock* _lock;
 };
 
-class spin_rwlock : public arch::spin_rwlock_ops
+/// @brief writer 優先の rwlock
+//
+/// writer が待っていれば新しい reader は wait_lock のキューに並ぶので、
+/// reader が続いても writer は待たされ続けない。
+class spin_rwlock :
+	public arch::spin_rwlock_ops,
+	private lockstat::holder
 {
 	NONCOPYABLE(spin_rwlock);
 
@@ -133,6 +141,14 @@ public:
 	void un_wlock(bool np) { np ? un_wlock_np() : un_wlock(); }
 	void un_wlock();
 	void un_wlock_np();
+
+private:
+	void _rlock_np(const void* caller);
+	void _wlock_np(const void* caller);
+
+private:
+	/// ロックを待つ reader と writer を並ばせる。
+	spin_lock wait_lock;
 };
 
 
@@ -235,6 +251,70 @@ private:
 	spin_rwlock* _lock;
 };
 
+/// @brief シーケンスロック
+//
+/// writer は spin_lock で排他し、書き込みの前後で seq を 1 ずつ進める。
+/// reader はロックを取らずに読み、read_begin() と read_retry() の間に
+/// seq が変わっていれば読み直す。reader は書きかけのデータを読むことが
+/// あるので、読んだ値は read_retry() が false を返すまで使ってはいけない。
+class spin_seqlock
+{
+	NONCOPYABLE(spin_seqlock);
+
+public:
+	spin_seqlock() : seq(0) {}
+
+	/// @return  read_retry() へ渡す値。
+	u32 read_begin() const {
+		for (;;) {
+			const u32 s = seq;
+			asm volatile ("" : : : "memory");
+			if (!(s & 1))
+				return s;
+			arch::cpu_relax();
+		}
+	}
+	/// @retval true  read_begin() の後で書き込まれたので読み直す。
+	bool read_retry(u32 s) const {
+		asm volatile ("" : : : "memory");
+		return seq != s;
+	}
+
+	void write_lock() {
+		lock.lock();
+		seq = seq + 1;
+		asm volatile ("" : : : "memory");
+	}
+	void write_unlock() {
+		asm volatile ("" : : : "memory");
+		seq = seq + 1;
+		lock.unlock();
+	}
+
+private:
+	spin_lock lock;
+	volatile u32 seq;
+};
+
+class spin_seqlock_write_section
+{
+	NONCOPYABLE(spin_seqlock_write_section);
+
+public:
+	spin_seqlock_write_section(spin_seqlock* lock) :
+		_lock(lock)
+	{
+		_lock->write_lock();
+	}
+	~spin_seqlock_write_section()
+	{
+		_lock->write_unlock();
+	}
+
+private:
+	spin_seqlock* _lock;
+};
+
 /** @defgroup spin_locked
  * @{
  * @brief Read locked or write locked return value holder classes.
@@ -23,6 +23,8 @@
 #include <core/basic-types.hh>
 
 
+struct fs_page_cache_stat;
+
 namespace uniqos {
 
 cause::pair<ucpu> sys_open(
@@ -57,6 +59,9 @@ cause::pair<ucpu> sys_mount(
     u32 flags,
     const void* data);
 
+cause::pair<ucpu> sys_page_cache_stat(
+    fs_page_cache_stat* stat);
+
 }  // namespace uniqos
 
 
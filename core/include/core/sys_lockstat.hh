@@ -0,0 +1,34 @@
+/// @file  core/sys_lockstat.hh
+/// @brief  Lock statistics syscall declarations.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_SYS_LOCKSTAT_HH_
+#define CORE_SYS_LOCKSTAT_HH_
+
+#include <core/basic-types.hh>
+
+
+namespace uniqos {
+
+cause::pair<ucpu> sys_lockstat(
+    int iod);
+
+}  // namespace uniqos
+
+
+#endif  // CORE_SYS_LOCKSTAT_HH_
@@ -0,0 +1,45 @@
+/// @file  core/sys_page.hh
+/// @brief  Physical page syscall declarations.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_SYS_PAGE_HH_
+#define CORE_SYS_PAGE_HH_
+
+#include <core/basic-types.hh>
+
+
+namespace uniqos {
+
+/// @brief  sys_page_stat() が返す page_pool ごとの統計情報。
+struct page_pool_stat
+{
+    u32 proximity_domain;  ///< page_pool が属する NUMA ノード
+    u32 reserved;
+    u64 free_bytes;        ///< 空きメモリのバイト数
+    u64 alloc_cnt;         ///< 全 CPU が割り当てたページ数
+    u64 remote_alloc_cnt;  ///< 別の NUMA ノードの CPU が割り当てたページ数
+};
+
+cause::pair<ucpu> sys_page_stat(
+    u32 index,
+    page_pool_stat* stat);
+
+}  // namespace uniqos
+
+
+#endif  // CORE_SYS_PAGE_HH_
@@ -0,0 +1,66 @@
+/// @file  core/sys_syscall.hh
+/// @brief  System call batching and statistics declarations.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_SYS_SYSCALL_HH_
+#define CORE_SYS_SYSCALL_HH_
+
+#include <core/basic-types.hh>
+
+
+namespace uniqos {
+
+/// @brief  sys_syscall_stat() が返すシステムコールごとの統計情報。
+struct syscall_stat
+{
+    enum {
+        HIST_NR = 32,
+    };
+
+    u64 call_cnt;      ///< 呼び出した回数
+    u64 total_cycles;  ///< 処理にかかった TSC サイクル数の合計
+
+    /// cycles_hist[i] は処理に 2^i 以上 2^(i+1) 未満の TSC サイクル数が
+    /// かかった回数。cycles_hist[0] は 2 未満、最後の要素はそれ以上の全て。
+    u64 cycles_hist[HIST_NR];
+};
+
+/// @brief  sys_batch() で実行するシステムコール 1 つ分。
+struct syscall_batch_entry
+{
+    ucpu nr;         ///< システムコール番号
+    ucpu args[6];    ///< 引数
+    ucpu ret_cause;  ///< 実行結果の cause::t を返す。
+    ucpu ret_value;  ///< 実行結果の値を返す。
+};
+
+cause::pair<ucpu> sys_syscall_stat(
+    u32 nr,
+    syscall_stat* stat);
+
+cause::pair<ucpu> sys_batch(
+    syscall_batch_entry* entries,
+    uptr count);
+
+cause::t syscall_setup();
+
+}  // namespace uniqos
+
+
+#endif  // CORE_SYS_SYSCALL_HH_
+
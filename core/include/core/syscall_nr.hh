@@ -30,6 +30,11 @@ enum SYSCALL_NR
     SYSCALL_MKDIR,
     SYSCALL_READENTS,
     SYSCALL_MOUNT,
+    SYSCALL_PAGE_STAT,
+    SYSCALL_LOCKSTAT,
+    SYSCALL_SYSCALL_STAT,
+    SYSCALL_BATCH,
+    SYSCALL_PAGE_CACHE_STAT,
 
     SYSCALL_NR,
 };
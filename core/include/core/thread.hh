@@ -21,6 +21,8 @@ class thread
 	DISALLOW_COPY_AND_ASSIGN(thread);
 
 	friend class thread_sched;
+	friend class fifo_sched_queue;
+	friend class fair_sched_queue;
 
 public:
 	thread(thread_id tid);
@@ -33,6 +35,18 @@ public:
 
 	void ready();
 
+	enum {
+		/// 標準の重み。
+		SCHED_WEIGHT_DEFAULT = 1024,
+	};
+	u32 get_sched_weight() const { return sched_weight; }
+	void set_sched_weight(u32 w) { sched_weight = w > 0 ? w : 1; }
+	void set_sched_urgent(bool urgent) { sched_urgent = urgent; }
+	void set_sched_pinned(bool pinned) { sched_pinned = pinned; }
+	volatile bool* ref_sched_on_cpu() { return &sched_on_cpu; }
+	u64 get_exec_tsc() const { return exec_tsc; }
+	u64 get_vruntime() const { return vruntime; }
+
 	chain_node<thread>& thread_sched_chainnode() {
 		return _thread_sched_chainnode;
 	}
@@ -58,6 +72,41 @@ private:
 	/// locked by thread_queue::thread_state_lock
 	bool      anti_sleep;
 
+	/// true なら ready() されたときに他の thread より先に実行する。
+	bool      sched_urgent;
+
+	/// true なら他の CPU へ移動しない。
+	bool      sched_pinned;
+
+	/// CPU がこの thread のレジスタを使っている間は true。
+	/// thread_queue::thread_state_lock を取って true にし、切り替えた後で
+	/// コンテキストを regset へ保存し終えたら false にする。
+	/// true の間は regset が古いので他の CPU へ移動しない。
+	volatile bool sched_on_cpu;
+
+	/// CPU 時間を割り当てる重み。
+	u32       sched_weight;
+
+	/// 実行時間を sched_weight で割った値。fair_sched_queue のキー。
+	u64       vruntime;
+
+	/// 実行した TSC サイクル数の合計。
+	u64       exec_tsc;
+
+	/// 最後に実行を始めたときの TSC。
+	u64       exec_start_tsc;
+
+	/// 最後に実行を止めたときの TSC。
+	/// これが新しいうちはキャッシュに情報が残っているとみなす。
+	u64       sched_last_tsc;
+
+	/// fair_sched_queue の heap のノード。
+	thread*   sched_heap_parent;
+	thread*   sched_heap_left;
+	thread*   sched_heap_right;
+	s32       sched_heap_npl;
+	bool      sched_boosted;
+
 	chain_node<thread> _thread_sched_chainnode;
 	chain_node<thread> _process_chainnode;
 };
@@ -19,7 +19,9 @@
 #ifndef CORE_THREAD_SCHED_HH_
 #define CORE_THREAD_SCHED_HH_
 
+#include <core/sched_queue.hh>
 #include <core/thread.hh>
+#include <util/atomic.hh>
 
 
 class cpu_node;
@@ -36,11 +38,11 @@ public:
 	cause::t attach_boot_thread(thread* t);
 
 	void attach(thread* t);
-	void detach(thread* t);
+	cause::t detach(thread* t);
 
 	thread* sleep_current_thread_np();
-	void ready(thread* t);
-	void ready_np(thread* t);
+	cause::t ready(thread* t);
+	cause::t ready_np(thread* t);
 
 	thread* get_running_thread() { return running_thread; }
 	void set_running_thread(thread* t);
@@ -49,9 +51,24 @@ public:
 
 	thread* exit_thread(thread* t);
 
+	int get_ready_cnt() const { return ready_queue.get_count(); }
+	bool migrate_to(thread_sched* dst, u64 hot_cycles);
+
+	/// 負荷分散の統計情報。
+	struct balance_stat
+	{
+		atomic<u64> steal_attempt;  ///< 他の CPU から thread を盗もうとした回数
+		atomic<u64> steal;          ///< 他の CPU から thread を盗めた回数
+		atomic<u64> migrate_in;     ///< 他の CPU から移ってきた thread の数
+		atomic<u64> migrate_out;    ///< 他の CPU へ移っていった thread の数
+	};
+	balance_stat& get_balance_stat() { return bal_stat; }
+	const balance_stat& get_balance_stat() const { return bal_stat; }
+
 void dump();
 private:
-	void _ready(thread* t);
+	cause::t _ready(thread* t);
+	void switch_running_thread(thread* t);
 
 private:
 	cpu_node* const owner_cpu;
@@ -60,9 +77,17 @@ private:
 
 	spin_rwlock thread_state_lock;
 
-	typedef fchain<thread, &thread::thread_sched_chainnode> thread_chain;
-	thread_chain ready_queue;
+#if CONFIG_SCHED_FAIR
+	typedef fair_sched_queue ready_queue_t;
+#else
+	typedef fifo_sched_queue ready_queue_t;
+#endif
+	ready_queue_t ready_queue;
+
+	typedef chain<thread, &thread::_thread_sched_chainnode> thread_chain;
 	thread_chain sleeping_queue;
+
+	balance_stat bal_stat;
 };
 
 
@@ -13,6 +13,8 @@
 
 enum { TICK_HZ = 1000000000, };
 
+class timer_store;
+
 class timer_message : public message
 {
 	friend class timer_ctl;
@@ -20,13 +22,30 @@ class timer_message : public message
 	typedef chain_node<timer_message> chain_node_type;
 
 public:
+	timer_message() :
+		nanosec_delay(0),
+		nanosec_slack(0),
+		armed_store(nullptr)
+	{}
+
 	chain_node_type timer_store_chain_node;
 
 	tick_time nanosec_delay;
 
+	/// 満了をこの時間(ns)まで遅らせてもよい。
+	/// 遅らせた範囲で満了する他のタイマと一緒に送り、割込みを減らす。
+	tick_time nanosec_slack;
+
 private:
 public:
 	tick_time expires_clock;
+	/// expires_clock に slack を加えた時刻。これより遅れてはならない。
+	tick_time latest_clock;
+
+	/// タイマを入れている timer_store。入っていなければ nullptr。
+	timer_store* volatile armed_store;
+	/// timer_store がタイマを外すときに使う。
+	u32 store_slot;
 };
 
 
@@ -53,6 +72,8 @@ public:
 
 
 cause::t timer_set(timer_message* m);
+cause::t timer_cancel(timer_message* m);
+cause::t timer_mod(timer_message* m, u64 nanosec_delay);
 
 
 #endif  // CORE_TIMER_HH_
@@ -30,6 +30,12 @@
 
 class output_buffer;
 
+/// @brief  timer_message を満了するまで保持する。
+//
+/// set() したタイマは msg->expires_clock から msg->latest_clock までの
+/// 間に送ればよい。next_clock() はこの幅を使って、できるだけ多くの
+/// タイマを一度に送れる時刻を返す。
+/// post() でタイマを送るときは msg->armed_store を nullptr にする。
 class timer_store
 {
 	DISALLOW_COPY_AND_ASSIGN(timer_store);
@@ -54,6 +60,10 @@ public: //TODO:operationsをdynamicに作ればpublicを外せる
 		typedef cause::type (*PostOP)(
 		    timer_store* x, tick_time clock);
 		PostOP Post;
+
+		typedef void (*RemoveOP)(
+		    timer_store* x, timer_message* msg);
+		RemoveOP Remove;
 	};
 
 	template<class X> static bool call_on_timer_store_Set(
@@ -71,6 +81,11 @@ public: //TODO:operationsをdynamicに作ればpublicを外せる
 		return static_cast<X*>(x)->on_timer_store_Post(clock);
 	}
 
+	template<class X> static void call_on_timer_store_Remove(
+	    timer_store* x, timer_message* msg) {
+		static_cast<X*>(x)->on_timer_store_Remove(msg);
+	}
+
 public:
 	bool set(timer_message* msg) {
 		return ops->Set(this, msg);
@@ -84,7 +99,14 @@ public:
 		return ops->Post(this, clock);
 	}
 
+	void remove(timer_message* msg) {
+		ops->Remove(this, msg);
+	}
+
 	operations* ops;
+
+	/// set() / next_clock() / post() はこの lock を取って呼び出す。
+	spin_lock lock;
 };
 
 
@@ -96,8 +118,11 @@ public:
 	timer_ctl();
 
 	void set_clock_source(clock_source* cs);
+	clock_source* get_clock_source() { return clk_src; }
 	void set_store(timer_store* tq);
+	void set_cpu_store(cpu_id_t cpu, timer_store* tq);
 	cause::type get_jiffy_tick(tick_time* tick);
+	void busy_wait(u64 nanosec);
 
 private:
 	clock_source* clk_src;
@@ -105,24 +130,50 @@ private:
 // timer_message database
 public:
 	cause::type set_timer(timer_message* msg);
+	cause::type cancel_timer(timer_message* msg);
+	cause::type mod_timer(timer_message* msg, u64 nanosec_delay);
 
 	void on_timer_message();
+	bool idle_enter(cpu_id_t cpu);
 
 private:
-	cause::type _set_timer(timer_message* msg, tick_time now_clock);
+	/// @brief  clk_src のタイマの設定。
+	//
+	/// clk_src->is_per_cpu_timer() ならば CPU ごとに使う。
+	/// そうでなければ events[0] だけを使う。
+	struct timer_event
+	{
+		message_with<timer_ctl*> msg;
+
+		/// clk_src に設定した時刻。
+		bool      programmed;
+		tick_time programmed_clock;
+	};
+
+	timer_event* get_event(cpu_id_t cpu) {
+		return &events[clk_src->is_per_cpu_timer() ? cpu : 0];
+	}
+	cause::type arm_timer(timer_event* ev, tick_time clock);
+	cause::type program_timer(timer_event* ev, tick_time clock);
+	void on_global_timer_message();
+	void on_cpu_timer_message(cpu_id_t cpu);
 
 private:
+	/// 全ての CPU で共有する events[0] の設定を保護する。
 	spin_lock lock;
 
-	message_with<timer_ctl*> timer_msg;
+	timer_event events[CONFIG_MAX_CPUS];
 
-	timer_store* store;
+	/// CPU ごとの timer_store。全ての CPU で同じ store を共有してもよい。
+	timer_store* stores[CONFIG_MAX_CPUS];
 
 public:
 	void dump(output_buffer& ob);
 };
 
 cause::t get_jiffy_tick(tick_time* tick);
+void timer_busy_wait(u64 nanosec);
+bool timer_idle_enter();
 
 
 #endif  // include guard
@@ -23,6 +23,8 @@ public:
 
 	cause::type on_timer_store_Post(tick_time clock);
 
+	void on_timer_store_Remove(timer_message* msg);
+
 private:
 	typedef chain<timer_message, &timer_message::timer_store_chain_node>
 	    message_chain;
@@ -0,0 +1,104 @@
+/// @file  core/timer_wheel.hh
+/// @brief Hierarchical timing wheel for timer messages.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_TIMER_WHEEL_HH_
+#define CORE_TIMER_WHEEL_HH_
+
+#include <core/timer_ctl.hh>
+
+
+class cpu_node;
+
+/// @brief  階層化したタイミングホイール。
+//
+/// clock を 2^clock_shift ごとに区切った単位を granule と呼ぶ。
+/// level n のスロットは 64^n granule の幅を持ち、1 周で 64^(n+1) granule
+/// を表す。タイマは満了までの granule 数で level を選び、満了時刻で
+/// スロットを選ぶので、登録は O(1) になる。
+/// 上位の level のスロットは、その時刻になったら下位の level へ入れ直す
+/// (cascade)。
+///
+/// スロットごとに空かどうかをビットマップで持っているので、post() は
+/// 空のスロットを飛ばして、満了したタイマと cascade するスロットだけを
+/// 処理する。
+///
+/// 満了したタイマは owner の CPU へ送る。
+class timer_wheel_store : public timer_store
+{
+public:
+	static cause::t setup();
+
+	timer_wheel_store(cpu_node* _owner, int _clock_shift, tick_time now);
+
+	bool on_timer_store_Set(timer_message* new_msg);
+
+	cause::pair<tick_time> on_timer_store_NextClock();
+
+	cause::type on_timer_store_Post(tick_time clock);
+
+	void on_timer_store_Remove(timer_message* msg);
+
+private:
+	enum {
+		SLOT_BITS = 6,
+		SLOT_CNT  = 1 << SLOT_BITS,
+		SLOT_MASK = SLOT_CNT - 1,
+		LEVEL_CNT = 6,
+	};
+
+	typedef chain<timer_message, &timer_message::timer_store_chain_node>
+	    message_chain;
+
+	struct wheel_level
+	{
+		/// bit n がセットされていれば slots[n] は空ではない。
+		u64 occupied;
+		message_chain slots[SLOT_CNT];
+	};
+
+	u64 to_granule(tick_time clock) const {
+		return static_cast<tick_int>(clock) >> clock_shift;
+	}
+
+	void insert(timer_message* msg);
+	void cascade(int level);
+	void post_slot(int slot, tick_time clock);
+	bool next_event(u64* granule, int* level, int first_level = 0) const;
+	u64  slot_granule(int level, int slot) const;
+	tick_time coalesce_clock(u64 first);
+
+private:
+	cpu_node* owner;
+	int clock_shift;
+
+	/// 処理が終わった granule。
+	u64 cur;
+
+	/// next_clock() で返した時刻、または、その後で Set したタイマの
+	/// 一番早い時刻。これより早いタイマが入ったときだけ Set() は true
+	/// を返す。
+	bool      armed;
+	tick_time armed_clock;
+
+	wheel_level levels[LEVEL_CNT];
+};
+
+
+#endif  // include guard
+
@@ -0,0 +1,103 @@
+/// @file  core/tlb_gather.hh
+/// @brief Batched TLB invalidation for page unmapping.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CORE_TLB_GATHER_HH_
+#define CORE_TLB_GATHER_HH_
+
+#include <core/pagetbl.hh>
+
+
+/// @brief  ページの割り当て解除をまとめて、TLB を一度にフラッシュする。
+//
+/// unmap() で外したページのアドレスの範囲と、空になったページテーブルを
+/// 集めておき、finish() でまとめて TLB をフラッシュする。
+/// 範囲のページ数が FLUSH_ALL_THRESHOLD を超えるときは、INVLPG を繰り返す
+/// 代わりに TLB を全てフラッシュする。
+/// 他の CPU へは 1 回のフラッシュにつき IPI を 1 回だけ送る。
+///
+/// 空になったページテーブルはフラッシュが終わってから解放する。
+/// 先に解放すると、他の CPU が TLB やページング構造のキャッシュに残った
+/// 古いテーブルを参照するかもしれない。
+///
+/// finish() は他の CPU のフラッシュが終わるまで待つので、スピンロックを
+/// 持ったまま呼び出さない方がよい。
+class tlb_gather
+{
+	DISALLOW_COPY_AND_ASSIGN(tlb_gather);
+
+public:
+	enum MODE {
+		/// 使用中のアドレス空間。全ての CPU の TLB をフラッシュする。
+		ACTIVE,
+		/// どの CPU も使っていないアドレス空間。フラッシュしない。
+		/// PCID は世代が変わるまで再利用しないので、破棄するプロセスの
+		/// TLB が残っていても問題ない。
+		INACTIVE,
+	};
+
+	enum {
+		/// これより多いページは個別にフラッシュしない。
+		FLUSH_ALL_THRESHOLD = 32,
+		/// 一度に集めるページテーブルの最大数。
+		/// 超えたときは途中でフラッシュする。
+		TABLE_PAGE_MAX = 16,
+	};
+
+public:
+	tlb_gather(page_table* pgtbl, MODE mode);
+	~tlb_gather();
+
+	cause::t unmap(uptr vadr, page_level level);
+	cause::t unmap_range(uptr low_vadr, uptr high_vadr);
+
+	void     add_range(uptr vadr, uptr bytes, bool global);
+	cause::t add_table_page(uptr padr);
+
+	cause::t finish();
+
+private:
+	bool is_empty() const { return range_low > range_high; }
+	void clear_range();
+
+	cause::t flush();
+	void flush_cpus();
+	void flush_local();
+	static void flush_on_cpu(void* arg);
+
+private:
+	/// pgtbl に nullptr を指定したときは使用中のページテーブル。
+	page_table* pgtbl;
+	bool        own_pgtbl;
+	MODE        mode;
+
+	/// フラッシュする範囲。
+	uptr range_low;
+	uptr range_high;
+	/// 範囲の中で一番小さいページのサイズ。
+	uptr stride;
+	/// 範囲のページが全てグローバルページならば true。
+	bool global;
+
+	int  table_page_cnt;
+	uptr table_pages[TABLE_PAGE_MAX];
+};
+
+
+#endif  // include guard
+
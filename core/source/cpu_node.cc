@@ -23,6 +23,9 @@
 #include <core/global_vars.hh>
 #include <core/log.hh>
 #include <core/page_pool.hh>
+#include <core/rcu.hh>
+#include <core/sched_balance.hh>
+#include <core/timer_ctl.hh>
 
 
 /// @class cpu_node
@@ -37,8 +40,17 @@
 
 cpu_node::cpu_node(cpu_id cpunode_id) :
 	cpu_node_id(cpunode_id),
-	threads(this)
+	online(false),
+	threads(this),
+	proximity_domain(0)
 {
+	for (auto& cnt : page_alloc_cnt)
+		cnt = 0;
+	for (auto& cnt : foreign_page_alloc_cnt)
+		cnt.store(0);
+
+	page_caches[arch::page::L1].set_params(48, 8, 16);
+	page_caches[arch::page::L2].set_params(8, 0, 2);
 }
 
 cause::t cpu_node::set_page_pool_cnt(int cnt)
@@ -52,6 +64,8 @@ cause::t cpu_node::set_page_pool_cnt(int cnt)
 }
 
 /// @brief  page_pool を指定する。
+/// @param[in] pri  優先順位。0 が最優先で、NUMA ローカルな page_pool を
+///                 指定する。
 cause::t cpu_node::set_page_pool(int pri, page_pool* pp)
 {
 	page_pools[pri] = pp;
@@ -80,19 +94,39 @@ cause::t cpu_node::detach_thread(thread* t)
 			return cause::BADARG;
 	}
 
-	threads.detach(t);
+	// 呼び出し元が owner_cpu を読んだ後で負荷分散により移った。
+	if (threads.detach(t) == cause::INVALID_OBJECT)
+		return t->get_owner_cpu()->detach_thread(t);
 
 	return cause::OK;
 }
 
+/// @brief  thread を ready にする。
+//
+/// thread が別の CPU のものなら、その CPU が次の割込みを待たずに
+/// thread を実行できるように IPI を送る。
 void cpu_node::ready_thread(thread* t)
 {
-	threads.ready(t);
+	preempt_disable_section _pds;
+
+	ready_thread_np(t);
 }
 
 void cpu_node::ready_thread_np(thread* t)
 {
-	threads.ready_np(t);
+	const cause::t r = threads.ready_np(t);
+	if (r == cause::INVALID_OBJECT) {
+		// 呼び出し元が owner_cpu を読んだ後で負荷分散により移った。
+		t->get_owner_cpu()->ready_thread_np(t);
+		return;
+	}
+
+	if (r == cause::OK && this != get_cpu_node())
+		arch::request_resched(this);
+
+#if CONFIG_NO_HZ
+	sched_balance_wakeup(this);
+#endif  // CONFIG_NO_HZ
 }
 
 /// @brief running_thread を設定する。
@@ -104,17 +138,47 @@ void cpu_node::force_set_running_thread(thread* t)
 	threads.set_running_thread(t);
 }
 
+/// @brief  割込みが入るまで CPU を止める。
+//
+/// NO_HZ のときは、次のタイマの時刻まで割込みが入らないように
+/// タイマを設定し直してから止める。
+/// 割込み禁止状態で呼び出す必要がある。
 void cpu_node::preempt_wait()
 {
+#if CONFIG_NO_HZ
+	// 満了したタイマを送ったときは止まらずに戻る。
+	if (timer_idle_enter())
+		return;
+#endif  // CONFIG_NO_HZ
+
+	// 猶予期間を待っている rcu_head があるときは、遅れている CPU に
+	// 静止状態を通過させてから止まる。遅れている CPU が無ければ
+	// 止まらずに戻る。
+	if (!rcu_wait_prepare())
+		return;
+
+	rcu_idle_enter();
 	arch::intr_wait();
+	rcu_idle_exit();
 }
 
 cause::t cpu_node::page_alloc(arch::page::TYPE page_type, uptr* padr)
 {
+	if (use_page_cache(page_type)) {
+		preempt_disable_section _pds;
+
+		// 別の CPU の cpu_node が指定された場合は page_pool から直接
+		// 確保する。
+		if (this == get_cpu_node())
+			return page_cache_alloc(page_type, padr);
+	}
+
 	for (cpu_id i = 0; i < page_pool_cnt; ++i) {
 		const cause::t r = page_pools[i]->alloc(page_type, padr);
-		if (is_ok(r))
+		if (is_ok(r)) {
+			count_page_alloc(i);
 			return cause::OK;
+		}
 	}
 
 	return cause::FAIL;
@@ -122,6 +186,17 @@ cause::t cpu_node::page_alloc(arch::page::TYPE page_type, uptr* padr)
 
 cause::t cpu_node::page_dealloc(arch::page::TYPE page_type, uptr padr)
 {
+	if (use_page_cache(page_type)) {
+		preempt_disable_section _pds;
+
+		if (this == get_cpu_node()) {
+			const cause::t r =
+			    page_cache_dealloc(page_type, padr, false);
+			if (r != cause::OUTOFRANGE)
+				return r;
+		}
+	}
+
 	for (cpu_id i = 0; i < page_pool_cnt; ++i) {
 		const cause::t r = page_pools[i]->dealloc(page_type, padr);
 		if (is_ok(r)) {
@@ -137,6 +212,194 @@ cause::t cpu_node::page_dealloc(arch::page::TYPE page_type, uptr padr)
 	return cause::FAIL;
 }
 
+/// @brief  しばらく使われていないページを解放する。
+//
+/// ページキャッシュの下に積むので、次の割り当てではなるべく使われない。
+cause::t cpu_node::page_dealloc_cold(arch::page::TYPE page_type, uptr padr)
+{
+	if (use_page_cache(page_type)) {
+		preempt_disable_section _pds;
+
+		if (this == get_cpu_node()) {
+			const cause::t r =
+			    page_cache_dealloc(page_type, padr, true);
+			if (r != cause::OUTOFRANGE)
+				return r;
+		}
+	}
+
+	return page_dealloc(page_type, padr);
+}
+
+/// @brief  ページキャッシュを low まで page_pool へ返却する。
+//
+/// CPU がアイドルになるときに、プリエンプション禁止状態で呼び出す。
+void cpu_node::drain_page_cache()
+{
+	for (int i = 0; i < PAGE_CACHE_LEVELS; ++i) {
+		const arch::page::TYPE page_type =
+		    static_cast<arch::page::TYPE>(i);
+
+		page_cache_drain(page_type, page_caches[i].low);
+	}
+}
+
+cause::t cpu_node::page_alloc_contig(uptr count, uptr align, uptr* padr)
+{
+	for (cpu_id i = 0; i < page_pool_cnt; ++i) {
+		const cause::t r =
+		    page_pools[i]->alloc_contig(count, align, padr);
+		if (is_ok(r)) {
+			count_page_alloc(i);
+			return cause::OK;
+		}
+		else if (r == cause::BADARG)
+			return r;
+	}
+
+	return cause::NOMEM;
+}
+
+cause::t cpu_node::page_dealloc_contig(uptr padr, uptr count)
+{
+	for (cpu_id i = 0; i < page_pool_cnt; ++i) {
+		const cause::t r = page_pools[i]->dealloc_contig(padr, count);
+		if (is_ok(r)) {
+			return cause::OK;
+		} else if (r == cause::OUTOFRANGE) {
+			continue;
+		} else {
+			log()("!!! cpu_node::page_dealloc_contig() failed. r=")
+			    .u(r)();
+			return r;
+		}
+	}
+
+	return cause::FAIL;
+}
+
+/// @brief  この CPU が pp から割り当てたページ数を返す。
+//
+/// page_alloc_cnt は持ち主の CPU が書き込み中かもしれないが、u64 の
+/// 読み出しは分断されないので統計としてはそのまま読んでよい。
+u64 cpu_node::get_page_alloc_cnt(const page_pool* pp) const
+{
+	for (cpu_id i = 0; i < page_pool_cnt; ++i) {
+		if (page_pools[i] == pp) {
+			const volatile u64* cnt = &page_alloc_cnt[i];
+			return *cnt + foreign_page_alloc_cnt[i].load();
+		}
+	}
+
+	return 0;
+}
+
+/// @brief  この CPU が pp から割り当てたページ数を、pp がリモートの
+///         NUMA ノードの page_pool であれば返す。
+u64 cpu_node::get_remote_page_alloc_cnt(const page_pool* pp) const
+{
+	if (pp->get_proximity_domain() == proximity_domain)
+		return 0;
+
+	return get_page_alloc_cnt(pp);
+}
+
+/// @brief  page_pools[pri] から割り当てたページを数える。
+//
+/// 自 CPU の cpu_node ならアトミック操作を使わずに数える。
+void cpu_node::count_page_alloc(int pri)
+{
+	preempt_disable_section _pds;
+
+	if (this == get_cpu_node())
+		++page_alloc_cnt[pri];
+	else
+		foreign_page_alloc_cnt[pri].inc();
+}
+
+bool cpu_node::use_page_cache(arch::page::TYPE page_type)
+{
+	return 0 <= page_type && page_type < int(PAGE_CACHE_LEVELS) &&
+	       page_pool_cnt > 0;
+}
+
+/// @brief  ページキャッシュからページを確保する。
+//
+/// キャッシュが空なら NUMA ローカルな page_pools[0] から batch ページを
+/// まとめて補充する。それもできなければ他の page_pool から確保する。
+cause::t cpu_node::page_cache_alloc(arch::page::TYPE page_type, uptr* padr)
+{
+	page_cache& pc = page_caches[page_type];
+
+	if (pc.is_empty()) {
+		uptr padrs[page_cache::CAPACITY];
+		const int n =
+		    page_pools[0]->alloc_pages(page_type, pc.batch, padrs);
+
+		for (int i = n - 1; i >= 0; --i)
+			pc.push_cold(padrs[i]);
+	}
+
+	if (!pc.is_empty()) {
+		*padr = pc.pop_hot();
+		++page_alloc_cnt[0];
+		return cause::OK;
+	}
+
+	for (cpu_id i = 1; i < page_pool_cnt; ++i) {
+		const cause::t r = page_pools[i]->alloc(page_type, padr);
+		if (is_ok(r)) {
+			++page_alloc_cnt[i];
+			return cause::OK;
+		}
+	}
+
+	return cause::FAIL;
+}
+
+/// @brief  ページキャッシュへページを返却する。
+/// @retval cause::OUTOFRANGE  padr は page_pools[0] のページではない。
+//
+/// page_pools[0] のページだけをキャッシュする。
+cause::t cpu_node::page_cache_dealloc(
+    arch::page::TYPE page_type, uptr padr, bool cold)
+{
+	if (!page_pools[0]->test_range(padr))
+		return cause::OUTOFRANGE;
+
+	page_cache& pc = page_caches[page_type];
+
+	if (cold)
+		pc.push_cold(padr);
+	else
+		pc.push_hot(padr);
+
+	if (pc.get_count() > pc.high)
+		page_cache_drain(page_type, pc.get_count() - pc.batch);
+
+	return cause::OK;
+}
+
+/// @brief  ページキャッシュのページを cold なほうから page_pools[0] へ
+///         返却する。
+/// @param[in] keep  キャッシュに残すページ数。
+void cpu_node::page_cache_drain(arch::page::TYPE page_type, int keep)
+{
+	page_cache& pc = page_caches[page_type];
+
+	uptr padrs[page_cache::CAPACITY];
+	int n = 0;
+	while (pc.get_count() > keep)
+		padrs[n++] = pc.pop_cold();
+
+	if (n == 0)
+		return;
+
+	const cause::t r = page_pools[0]->dealloc_pages(page_type, n, padrs);
+	if (is_fail(r))
+		log()("!!! cpu_node::page_cache_drain() failed. r=").u(r)();
+}
+
 cpu_id get_cpu_node_count()
 {
 	return global_vars::core.cpu_node_nr;
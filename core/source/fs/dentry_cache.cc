@@ -0,0 +1,204 @@
+/// @file  fs/dentry_cache.cc
+/// @brief dentry_cache class implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/dentry_cache.hh>
+
+#include <core/fs_ctl.hh>
+#include <core/global_vars.hh>
+#include <core/new_ops.hh>
+#include <util/string.hh>
+
+
+dentry_cache::dentry_cache() :
+	entries(nullptr)
+{
+}
+
+cause::t dentry_cache::setup()
+{
+	entries = static_cast<entry*>(mem_alloc(sizeof (entry) * ENTRY_NR));
+	if (!entries)
+		return cause::NOMEM;
+
+	for (int i = 0; i < ENTRY_NR; ++i) {
+		entry* e = new (&entries[i]) entry;
+		e->parent = nullptr;
+		e->node = nullptr;
+		e->referenced = false;
+		lru.push_back(e);
+	}
+
+	return cause::OK;
+}
+
+/// @brief  parent の子ノード key を探す。
+/// @retval cause::OK         子ノードを返す。
+/// @retval cause::NOENT      子ノードが無いことを覚えていた。
+/// @retval cause::NOT_FOUND  キャッシュに無い。
+//
+/// ロックは取らない。
+cause::pair<fs_node*> dentry_cache::lookup(
+    const fs_dir_node* parent, const fs::name_key& key)
+{
+	if (key.len > NAME_LEN_MAX)
+		return null_pair(cause::NOT_FOUND);
+
+	bucket_chain& bucket = bucket_of(parent, key.hash);
+
+	for (;;) {
+		const u32 seq = lock.read_begin();
+
+		// 書き込み中のチェインをたどると同じエントリを何度も見る
+		// ことがあるので、たどる回数を制限する。
+		entry* e = bucket.front();
+		for (int i = 0; e && i < ENTRY_NR; ++i) {
+			if (e->match(parent, key))
+				break;
+			e = bucket.next(e);
+		}
+
+		fs_node* node = e ? e->node : nullptr;
+
+		if (lock.read_retry(seq)) {
+			arch::cpu_relax();
+			continue;
+		}
+
+		if (!e)
+			return null_pair(cause::NOT_FOUND);
+
+		e->referenced = true;
+
+		if (!node)
+			return null_pair(cause::NOENT);
+
+		return make_pair(cause::OK, node);
+	}
+}
+
+/// @brief  parent の子ノード key を覚える。
+/// @param[in] node  子ノードが無ければ nullptr。
+//
+/// 同じ名前のエントリがあれば置き換える。
+void dentry_cache::insert(
+    const fs_dir_node* parent, const fs::name_key& key, fs_node* node)
+{
+	if (key.len > NAME_LEN_MAX)
+		return;
+
+	spin_seqlock_write_section _sws(&lock);
+
+	entry* e = find(parent, key);
+	if (e) {
+		lru.remove(e);
+	} else {
+		e = evict();
+		e->parent = parent;
+		e->hash = key.hash;
+		e->len = key.len;
+		mem_copy(key.name, e->name, key.len);
+		e->name[key.len] = '\0';
+
+		bucket_of(parent, key.hash).push_front(e);
+	}
+
+	e->node = node;
+	e->referenced = false;
+	lru.push_front(e);
+}
+
+bool dentry_cache::entry::match(
+    const fs_dir_node* _parent, const fs::name_key& key) const
+{
+	return hash == key.hash &&
+	       parent == _parent &&
+	       len == key.len &&
+	       mem_compare(name, key.name, key.len) == 0;
+}
+
+dentry_cache::bucket_chain& dentry_cache::bucket_of(
+    const fs_dir_node* parent, u32 hash)
+{
+	const u32 h = hash ^ (u32(reinterpret_cast<uptr>(parent) >> 4) *
+	                      0x9e3779b9U);
+
+	return buckets[h >> (32 - BUCKET_BITS)];
+}
+
+/// @brief  ロックを取った状態でエントリを探す。
+dentry_cache::entry* dentry_cache::find(
+    const fs_dir_node* parent, const fs::name_key& key)
+{
+	bucket_chain& bucket = bucket_of(parent, key.hash);
+
+	for (entry* e : bucket) {
+		if (e->match(parent, key))
+			return e;
+	}
+
+	return nullptr;
+}
+
+/// @brief  LRU の末尾からエントリを 1 つ取り出して、ハッシュ表から外す。
+//
+/// referenced のエントリは LRU の先頭へ戻す。全てのエントリが
+/// referenced でも 2 周目には referenced が消えているので必ず終わる。
+dentry_cache::entry* dentry_cache::evict()
+{
+	entry* e;
+	for (;;) {
+		e = lru.pop_back();
+		if (!e->referenced)
+			break;
+
+		e->referenced = false;
+		lru.push_front(e);
+	}
+
+	if (e->parent) {
+		bucket_of(e->parent, e->hash).remove(e);
+		e->parent = nullptr;
+	}
+
+	return e;
+}
+
+
+dentry_cache* get_dentry_cache()
+{
+	return global_vars::core.dentry_cache_obj;
+}
+
+cause::t dentry_cache_setup()
+{
+	dentry_cache* dc = new (generic_mem()) dentry_cache;
+	if (!dc)
+		return cause::NOMEM;
+
+	cause::t r = dc->setup();
+	if (is_fail(r)) {
+		new_destroy(dc, generic_mem());
+		return r;
+	}
+
+	global_vars::core.dentry_cache_obj = dc;
+
+	return cause::OK;
+}
+
@@ -151,7 +151,7 @@ cause::t fs_ctl::unmount(
 
     target_mi->mount_fsnode->remove_mount(target_mi);
 
-    fs_mount_info::destroy(target_mi);
+    rcu_call(&target_mi->rcu_hook, fs_mount_info::destroy_rcu, target_mi);
 
     return r;
 }
@@ -230,6 +230,14 @@ fs_ctl* get_fs_ctl()
 
 cause::t fs_ctl_setup()
 {
+	cause::t r1 = dentry_cache_setup();
+	if (is_fail(r1))
+		return r1;
+
+	r1 = fs_page_cache_setup();
+	if (is_fail(r1))
+		return r1;
+
 	fs_ctl* fsctl = new (generic_mem()) fs_ctl;
 	if (!fsctl)
 		return cause::NOMEM;
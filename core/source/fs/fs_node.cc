@@ -19,7 +19,10 @@
 
 #include <core/fs_ctl.hh>
 
+#include <core/dentry_cache.hh>
 #include <core/log.hh>
+#include <core/new_ops.hh>
+#include <core/fs_page_cache.hh>
 
 
 using namespace fs;
@@ -28,7 +31,8 @@ using namespace fs;
 
 fs_node::fs_node(fs_mount* mount_owner, u32 type) :
 	owner(mount_owner),
-	node_type(type)
+	node_type(type),
+	pcache(nullptr)
 {
 }
 
@@ -47,6 +51,10 @@ bool fs_node::is_dev() const
 	return  node_type == fs::NODETYPE_DEV;
 }
 
+/// @brief  ns でこのノードにマウントされたファイルシステムのルートを返す。
+//
+/// ロックを取らずに mounts をたどるので、rcu_read_section の中で
+/// 呼び出す必要がある。
 fs_node* fs_node::into_ns(generic_ns* ns)
 {
 	for (auto minfo : mounts) {
@@ -57,8 +65,12 @@ fs_node* fs_node::into_ns(generic_ns* ns)
 	return this;
 }
 
+/// @brief  into_ns() と同じだが、返すノードの refs を取り、このノードの
+///         refs を外す。
 fs_node* fs_node::ref_into_ns(generic_ns* ns)
 {
+	rcu_read_section _rrs;
+
 	for (auto minfo : mounts) {
 		if (minfo->ns == ns) {
 			fs_node* fsn = minfo->mount_obj->get_root_node();
@@ -101,6 +113,48 @@ cause::pair<fs_node*> fs_node::ref_child_node(const char* name)
 		return null_pair(cause::NOTDIR);
 }
 
+cause::pair<fs_node*> fs_node::ref_child_node(const fs::name_key& key)
+{
+	if (is_dir())
+		return static_cast<fs_dir_node*>(this)->ref_child_node(key);
+	else
+		return null_pair(cause::NOTDIR);
+}
+
+/// @brief  Create page cache of this node.
+//
+/// Filesystem driver calls this if it implements
+/// fs_mount::interfaces::ReadPage and WritePage.
+/// ReadPages is optional. OpenNode returns fs_page_cache_io_node::create().
+cause::t fs_node::enable_page_cache()
+{
+	if (pcache)
+		return cause::OK;
+
+	pcache = new (generic_mem()) fs_page_cache(this);
+	if (!pcache)
+		return cause::NOMEM;
+
+	return cause::OK;
+}
+
+/// @brief  Write back dirty pages and destroy page cache.
+cause::t fs_node::disable_page_cache()
+{
+	if (!pcache)
+		return cause::OK;
+
+	cause::t r = pcache->writeback();
+	if (is_fail(r))
+		return r;
+
+	pcache->destroy();
+	new_destroy(pcache, generic_mem());
+	pcache = nullptr;
+
+	return cause::OK;
+}
+
 fs_node* fs_node::get_mounted_node()
 {
 	// TODO:返した値が解放されないように、関数の外までロック範囲を広げる
@@ -134,6 +188,8 @@ cause::t fs_dir_node::append_child_node(fs_node* child, const char* name)
 
 	child_nodes_lock.wlock();
 	child_nodes.push_front(cn);
+	// 負のエントリがあれば置き換える。
+	get_dentry_cache()->insert(this, fs::name_key(name), child);
 	child_nodes_lock.un_wlock();
 
 	return cause::OK;
@@ -145,15 +201,41 @@ cause::t fs_dir_node::append_child_node(fs_node* child, const char* name)
 /// after use.
 cause::pair<fs_node*> fs_dir_node::ref_child_node(const char* name)
 {
+    return ref_child_node(fs::name_key(name));
+}
+
+/// @brief  Get child node instance with precomputed name hash.
+//
+/// Look up dentry_cache first without lock. On miss, search child_nodes
+/// and ask the filesystem, then remember the result even if the child
+/// node does not exist.
+/// fs_node is never removed from child_nodes, so it is safe to inc refs
+/// of the node found by lockless lookup.
+cause::pair<fs_node*> fs_dir_node::ref_child_node(const fs::name_key& key)
+{
+    dentry_cache* dcache = get_dentry_cache();
+
+    auto child = dcache->lookup(this, key);
+    if (is_ok(child)) {
+        child->refs.inc();
+        return child;
+    } else if (child.cause() == cause::NOENT) {
+        return child;
+    }
+
     spin_wlock_section _wlocksec(child_nodes_lock);
 
-    auto child = _search_cached_child_node(name);
+    child = _search_cached_child_node(key.name);
 
     if (child.cause() == cause::NOENT)
-        child = _ref_child_node(name);
+        child = _ref_child_node(key.name);
 
-    if (is_ok(child))
+    if (is_ok(child)) {
         child->refs.inc();
+        dcache->insert(this, key, child.value());
+    } else if (child.cause() == cause::NOENT) {
+        dcache->insert(this, key, nullptr);
+    }
 
     return child;
 }
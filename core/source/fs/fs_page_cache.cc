@@ -0,0 +1,837 @@
+/// @file  fs/fs_page_cache.cc
+/// @brief fs_page_cache class implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/fs_page_cache.hh>
+
+#include <arch/thread_ctl.hh>
+#include <core/cpu_node.hh>
+#include <core/fs_ctl.hh>
+#include <core/log.hh>
+#include <core/new_ops.hh>
+#include <core/page.hh>
+#include <core/setup.hh>
+#include <core/thread.hh>
+#include <util/string.hh>
+
+
+namespace {
+
+struct fs_page_cache_cpu_stat
+{
+	fs_page_cache_stat stat;
+} __attribute__((aligned(arch::CACHE_LINE_SIZE)));
+
+fs_page_cache_cpu_stat cpu_stats[CONFIG_MAX_CPUS];
+
+void count_stat(u64 fs_page_cache_stat::* member, u64 n)
+{
+	preempt_disable_section _pds;
+
+	cpu_stats[arch::get_cpu_node_id()].stat.*member += n;
+}
+
+/// 先読みスレッドへ渡す先読みの窓。
+struct readahead_req
+{
+	chain_node<readahead_req> _chain_node;
+
+	fs_page_cache* pcache;
+	u64            page_idx;
+	uptr           page_nr;
+};
+
+/// 先読みスレッドが読み終えるのを待つ thread。
+struct readahead_waiter
+{
+	chain_node<readahead_waiter> _chain_node;
+
+	thread* thr;
+	bool    queued;
+};
+
+/// @brief  fs_page_cache の先読みをする thread。
+//
+/// fs_page_cache::read() は窓を reqs に積んで thr を ready() するだけで
+/// 戻り、デバイスからの読み込みを待たない。
+struct readahead_worker
+{
+	spin_lock lock;
+
+	chain<readahead_req, &readahead_req::_chain_node> reqs;
+	chain<readahead_waiter, &readahead_waiter::_chain_node> waiters;
+
+	/// thr が今読んでいる fs_page_cache。
+	fs_page_cache* running;
+
+	thread* thr;
+};
+
+readahead_worker* ra_worker;
+
+io_node::interfaces fs_page_cache_io_node_ifs;
+
+void readahead_worker_main(void* param)
+{
+	readahead_worker* w = static_cast<readahead_worker*>(param);
+
+	for (;;) {
+		w->lock.lock();
+		readahead_req* req = w->reqs.pop_front();
+		w->running = req ? req->pcache : nullptr;
+		w->lock.unlock();
+
+		if (!req) {
+			// 眠る前に積まれていれば ready() されているので、
+			// 眠らずに戻ってくる。
+			sleep_current_thread();
+			continue;
+		}
+
+		req->pcache->readahead(req->page_idx, req->page_nr);
+
+		new_destroy(req, generic_mem());
+
+		// 待っている thread はロックを取って確かめるので、ロックを
+		// 外すまで readahead_waiter は無くならない。
+		w->lock.lock();
+		w->running = nullptr;
+		while (readahead_waiter* waiter = w->waiters.pop_front()) {
+			waiter->queued = false;
+			waiter->thr->ready();
+		}
+		w->lock.unlock();
+	}
+}
+
+}  // namespace
+
+
+/// @param[in] _owner  キャッシュするデータを持つ fs_node。
+fs_page_cache::fs_page_cache(fs_node* _owner) :
+	owner(_owner),
+	root(0),
+	height(0),
+	size_bytes(0)
+{
+}
+
+/// @brief  全てのページを解放する。dirty なページは書き戻さない。
+//
+/// 先読みスレッドへ渡した窓は捨て、読んでいる途中ならば読み終わるのを
+/// 待つ。
+void fs_page_cache::destroy()
+{
+	cancel_readahead();
+
+	spin_lock_section _sls(&lock);
+
+	release(root, height);
+
+	root = 0;
+	height = 0;
+}
+
+u64 fs_page_cache::get_size()
+{
+	spin_lock_section _sls(&lock);
+
+	return size_bytes;
+}
+
+void fs_page_cache::set_size(u64 bytes)
+{
+	spin_lock_section _sls(&lock);
+
+	size_bytes = bytes;
+}
+
+/// @brief  off から bytes を data へ読み込む。
+/// @param[in] ra  開いたファイルの先読みの状態。
+///                nullptr ならばこの fs_page_cache の状態を使う。
+//
+/// ファイルの末尾を超えた分は読まない。
+/// ra を渡さずに同時に読んだときは、shared_ra への更新の一方が失われる
+/// ことがあるが、先読みの窓がずれるだけなので構わない。
+cause::pair<uptr> fs_page_cache::read(
+    u64 off, void* data, uptr bytes, fs_readahead* ra)
+{
+	const u64 file_size = get_size();
+	if (off >= file_size)
+		return make_pair(cause::OK, uptr(0));
+
+	bytes = min<u64>(bytes, file_size - off);
+
+	fs_readahead local_ra;
+	if (!ra) {
+		lock.lock();
+		local_ra = shared_ra;
+		lock.unlock();
+	}
+	fs_readahead* const _ra = ra ? ra : &local_ra;
+
+	u8* _data = static_cast<u8*>(data);
+	uptr read_bytes = 0;
+	cause::t r = cause::OK;
+	while (read_bytes < bytes) {
+		const u64 page_idx = off / PAGE_SIZE;
+
+		auto cp = get_page(page_idx, true);
+		if (is_fail(cp)) {
+			r = cp.cause();
+			break;
+		}
+
+		read_ahead(_ra, page_idx, cp.cause() == cause::END);
+
+		const uptr start = off % PAGE_SIZE;
+		const uptr size = min(bytes - read_bytes, PAGE_SIZE - start);
+		mem_copy(&cp.value()->data[start], _data, size);
+
+		off += size;
+		_data += size;
+		read_bytes += size;
+	}
+
+	if (!ra) {
+		lock.lock();
+		shared_ra = local_ra;
+		lock.unlock();
+	}
+
+	return make_pair(r, read_bytes);
+}
+
+/// @brief  data から bytes を off へ書き込む。
+//
+/// 書き込んだページは dirty にするだけで、デバイスへは書き込まない。
+cause::pair<uptr> fs_page_cache::write(u64 off, const void* data, uptr bytes)
+{
+	const u8* _data = static_cast<const u8*>(data);
+	uptr write_bytes = 0;
+	while (write_bytes < bytes) {
+		const uptr start = off % PAGE_SIZE;
+		const uptr size = min(bytes - write_bytes, PAGE_SIZE - start);
+
+		if (size == PAGE_SIZE) {
+			cause::t r = write_full_page(off / PAGE_SIZE, _data);
+			if (is_fail(r))
+				return make_pair(r, write_bytes);
+		} else {
+			auto cp = get_page(off / PAGE_SIZE, true);
+			if (is_fail(cp))
+				return make_pair(cp.cause(), write_bytes);
+
+			mem_copy(_data, &cp.value()->data[start], size);
+
+			lock.lock();
+			cp.value()->flags |= DIRTY;
+			lock.unlock();
+		}
+
+		off += size;
+		_data += size;
+		write_bytes += size;
+
+		lock.lock();
+		if (off > size_bytes)
+			size_bytes = off;
+		lock.unlock();
+	}
+
+	return make_pair(cause::OK, write_bytes);
+}
+
+/// @brief  page_idx から page_nr ページのうち、キャッシュに無いページを
+///         デバイスから読む。
+/// @return  読んだページ数。
+//
+/// キャッシュに無いページが続くところごとに、fill_pages() で1回の要求
+/// として読む。
+uptr fs_page_cache::readahead(u64 page_idx, uptr page_nr)
+{
+	uptr read_nr = 0;
+	uptr i = 0;
+	while (i < page_nr) {
+		uptr run = 0;
+
+		lock.lock();
+		while (i < page_nr && lookup(page_idx + i))
+			++i;
+		while (i + run < page_nr && run < RA_MAX_PAGES &&
+		       !lookup(page_idx + i + run))
+			++run;
+		lock.unlock();
+
+		if (run == 0)
+			break;
+
+		auto r = fill_pages(page_idx + i, run);
+		if (is_fail(r))
+			break;
+
+		read_nr += r.value();
+		i += run;
+	}
+
+	count_stat(&fs_page_cache_stat::readahead_pages, read_nr);
+
+	return read_nr;
+}
+
+/// @brief  dirty なページを全てデバイスへ書き戻す。
+cause::t fs_page_cache::writeback()
+{
+	lock.lock();
+	const uptr _root = root;
+	const int _height = height;
+	lock.unlock();
+
+	return writeback(_root, _height, 0);
+}
+
+/// @brief  ロックを取った状態でページを探す。
+fs_page_cache::cache_page* fs_page_cache::lookup(u64 page_idx) const
+{
+	if (!covers(page_idx))
+		return nullptr;
+
+	uptr e = root;
+	for (int h = height; h > 0; --h) {
+		if (!e)
+			return nullptr;
+
+		const uptr* node = reinterpret_cast<const uptr*>(e);
+		e = node[(page_idx >> ((h - 1) * ENTRY_BITS)) & ENTRY_MASK];
+	}
+
+	return reinterpret_cast<cache_page*>(e);
+}
+
+/// @brief  ロックを取った状態で基数木に cp を入れる。
+cause::t fs_page_cache::insert(u64 page_idx, cache_page* cp)
+{
+	while (!covers(page_idx)) {
+		if (root) {
+			void* node = alloc_page();
+			if (!node)
+				return cause::NOMEM;
+
+			mem_fill(0, node, PAGE_SIZE);
+			reinterpret_cast<uptr*>(node)[0] = root;
+			root = reinterpret_cast<uptr>(node);
+		}
+
+		++height;
+	}
+
+	uptr* slot = &root;
+	for (int h = height; h > 0; --h) {
+		if (!*slot) {
+			void* node = alloc_page();
+			if (!node)
+				return cause::NOMEM;
+
+			mem_fill(0, node, PAGE_SIZE);
+			*slot = reinterpret_cast<uptr>(node);
+		}
+
+		uptr* node = reinterpret_cast<uptr*>(*slot);
+		slot = &node[(page_idx >> ((h - 1) * ENTRY_BITS)) & ENTRY_MASK];
+	}
+
+	*slot = reinterpret_cast<uptr>(cp);
+
+	return cause::OK;
+}
+
+/// @brief  page_idx のページを返す。無ければ作る。
+/// @param[in] fill  新しく作ったページをデバイスから読むならば true。
+/// @retval cause::OK   キャッシュにあった。
+/// @retval cause::END  キャッシュに無かったので作った。
+cause::pair<fs_page_cache::cache_page*> fs_page_cache::get_page(
+    u64 page_idx, bool fill)
+{
+	lock.lock();
+	cache_page* cp = lookup(page_idx);
+	lock.unlock();
+
+	if (cp) {
+		count_stat(&fs_page_cache_stat::hits, 1);
+		return make_pair(cause::OK, cp);
+	}
+
+	count_stat(&fs_page_cache_stat::misses, 1);
+
+	auto r = create_page(page_idx, fill);
+	if (is_fail(r))
+		return r;
+
+	return make_pair(cause::END, r.value());
+}
+
+/// @brief  ページを作ってキャッシュに入れる。
+//
+/// ファイルの末尾より後ろのページはデバイスから読まずに 0 で埋める。
+/// デバイスから読んでいる間に他のスレッドが同じページを入れていたら、
+/// 作ったページを捨ててそちらを返す。
+cause::pair<fs_page_cache::cache_page*> fs_page_cache::create_page(
+    u64 page_idx, bool fill)
+{
+	void* data = alloc_page();
+	if (!data)
+		return null_pair(cause::NOMEM);
+
+	if (fill && page_idx * PAGE_SIZE < get_size()) {
+		cause::t r = owner->get_owner()->read_page(owner, page_idx, data);
+		if (is_fail(r)) {
+			free_page(data);
+			return null_pair(r);
+		}
+	} else {
+		mem_fill(0, data, PAGE_SIZE);
+	}
+
+	auto r = install_page(page_idx, data, 0);
+	if (r.cause() == cause::EXIST)
+		return make_pair(cause::OK, r.value());
+
+	return r;
+}
+
+/// @brief  中身を用意した data を cache_page にしてキャッシュに入れる。
+/// @param[in] flags  cache_page::flags の初期値。
+/// @retval cause::OK     data を入れた。
+/// @retval cause::EXIST  他のスレッドが先に入れていた。data は解放して、
+///                       先に入れたページを返す。
+//
+/// 失敗したときも data は解放する。
+cause::pair<fs_page_cache::cache_page*> fs_page_cache::install_page(
+    u64 page_idx, void* data, u8 flags)
+{
+	cache_page* cp = new (generic_mem()) cache_page;
+	if (!cp) {
+		free_page(data);
+		return null_pair(cause::NOMEM);
+	}
+
+	cp->data = static_cast<u8*>(data);
+	cp->flags = flags;
+
+	spin_lock_section _sls(&lock);
+
+	cache_page* exist = lookup(page_idx);
+	if (exist) {
+		new_destroy(cp, generic_mem());
+		free_page(data);
+		return make_pair(cause::EXIST, exist);
+	}
+
+	cause::t r = insert(page_idx, cp);
+	if (is_fail(r)) {
+		new_destroy(cp, generic_mem());
+		free_page(data);
+		return null_pair(r);
+	}
+
+	return make_pair(cause::OK, cp);
+}
+
+/// @brief  page_idx のページ全体を data で書き換える。
+//
+/// キャッシュに無ければデバイスから読まずに、data を写したページを
+/// 作ってからキャッシュに入れる。0 で埋めたページが他のスレッドから
+/// 見えることはない。
+cause::t fs_page_cache::write_full_page(u64 page_idx, const u8* data)
+{
+	lock.lock();
+	cache_page* cp = lookup(page_idx);
+	lock.unlock();
+
+	if (!cp) {
+		void* page = alloc_page();
+		if (!page)
+			return cause::NOMEM;
+
+		mem_copy(data, page, PAGE_SIZE);
+
+		auto r = install_page(page_idx, page, DIRTY);
+		if (r.cause() != cause::EXIST)
+			return r.cause();
+
+		cp = r.value();
+	}
+
+	mem_copy(data, cp->data, PAGE_SIZE);
+
+	lock.lock();
+	cp->flags |= DIRTY;
+	lock.unlock();
+
+	return cause::OK;
+}
+
+/// @brief  page_idx から page_nr ページを1回の要求でデバイスから読んで
+///         キャッシュに入れる。
+/// @return  キャッシュに入れたページ数。
+//
+/// 読んでいる間に他のスレッドが入れたページは捨てる。
+cause::pair<uptr> fs_page_cache::fill_pages(u64 page_idx, uptr page_nr)
+{
+	void** pages = static_cast<void**>(mem_alloc(sizeof (void*) * page_nr));
+	if (!pages)
+		return zero_pair(cause::NOMEM);
+
+	for (uptr i = 0; i < page_nr; ++i) {
+		pages[i] = alloc_page();
+		if (!pages[i]) {
+			for (uptr j = 0; j < i; ++j)
+				free_page(pages[j]);
+			mem_dealloc(pages);
+			return zero_pair(cause::NOMEM);
+		}
+	}
+
+	cause::t r = owner->get_owner()->read_pages(
+	    owner, page_idx, page_nr, pages);
+	if (is_fail(r)) {
+		for (uptr i = 0; i < page_nr; ++i)
+			free_page(pages[i]);
+		mem_dealloc(pages);
+		return zero_pair(r);
+	}
+
+	// install_page() は入れなかったページを解放する。
+	uptr install_nr = 0;
+	for (uptr i = 0; i < page_nr; ++i) {
+		auto cp = install_page(page_idx + i, pages[i], 0);
+		if (cp.cause() == cause::OK)
+			++install_nr;
+	}
+
+	mem_dealloc(pages);
+
+	return make_pair(cause::OK, install_nr);
+}
+
+/// @brief  高さ h の entry 以下のページを全て解放する。
+void fs_page_cache::release(uptr entry, int h)
+{
+	if (!entry)
+		return;
+
+	if (h == 0) {
+		cache_page* cp = reinterpret_cast<cache_page*>(entry);
+		free_page(cp->data);
+		new_destroy(cp, generic_mem());
+		return;
+	}
+
+	const uptr* node = reinterpret_cast<const uptr*>(entry);
+	for (int i = 0; i < ENTRY_NR; ++i)
+		release(node[i], h - 1);
+
+	free_page(reinterpret_cast<void*>(entry));
+}
+
+/// @brief  高さ h の entry 以下の dirty なページを書き戻す。
+/// @param[in] page_idx  entry の最初のページ番号。
+//
+/// 節は destroy() まで解放せず、エントリは 0 から変わるだけなので、
+/// ロックを取らずにたどる。
+cause::t fs_page_cache::writeback(uptr entry, int h, u64 page_idx)
+{
+	if (!entry)
+		return cause::OK;
+
+	if (h > 0) {
+		const uptr* node = reinterpret_cast<const uptr*>(entry);
+		const int shift = (h - 1) * ENTRY_BITS;
+		for (int i = 0; i < ENTRY_NR; ++i) {
+			cause::t r = writeback(
+			    node[i], h - 1, page_idx + (u64(i) << shift));
+			if (is_fail(r))
+				return r;
+		}
+		return cause::OK;
+	}
+
+	cache_page* cp = reinterpret_cast<cache_page*>(entry);
+
+	// 書き戻している間に書き込まれたら、もう一度 dirty になる。
+	lock.lock();
+	const bool dirty = cp->flags & DIRTY;
+	cp->flags &= ~DIRTY;
+	lock.unlock();
+
+	if (!dirty)
+		return cause::OK;
+
+	cause::t r = owner->get_owner()->write_page(owner, page_idx, cp->data);
+	if (is_fail(r)) {
+		lock.lock();
+		cp->flags |= DIRTY;
+		lock.unlock();
+		return r;
+	}
+
+	count_stat(&fs_page_cache_stat::writeback_pages, 1);
+
+	return cause::OK;
+}
+
+/// @brief  page_idx を読んだ後で、必要ならば先読みする。
+/// @param[in] miss  page_idx がキャッシュに無かったならば true。
+void fs_page_cache::read_ahead(fs_readahead* ra, u64 page_idx, bool miss)
+{
+	const bool seq = page_idx == 0 ||
+	                 page_idx == ra->prev_page ||
+	                 page_idx == ra->prev_page + 1;
+
+	ra->prev_page = page_idx;
+
+	if (miss) {
+		if (!seq) {
+			// ランダムアクセスなので先読みしない。
+			ra->size = 0;
+			ra->trigger_page = U64(-1);
+			return;
+		}
+
+		// 連続して読んでいるのに先読みが間に合わなかったので、
+		// 窓を大きくする。
+		ra->size = ra->size ? min<uptr>(ra->size * 2, RA_MAX_PAGES) :
+		                      uptr(RA_INIT_PAGES);
+		ra->start = page_idx + 1;
+		ra->trigger_page = ra->start;
+
+		queue_readahead(ra->start, clamp_pages(ra->start, ra->size));
+	} else if (page_idx == ra->trigger_page) {
+		// 窓を読み始めたので、窓の残りを読み終わる前に次の窓を読む。
+		const u64 next = ra->start + ra->size;
+		ra->size = min<uptr>(ra->size * 2, RA_MAX_PAGES);
+		ra->start = next;
+		ra->trigger_page = next;
+
+		queue_readahead(next, clamp_pages(next, ra->size));
+	}
+}
+
+/// @brief  page_idx から page_nr ページの先読みを先読みスレッドへ渡す。
+//
+/// 先読みスレッドが無いときや要求を作れないときは、その場で読む。
+void fs_page_cache::queue_readahead(u64 page_idx, uptr page_nr)
+{
+	if (page_nr == 0)
+		return;
+
+	readahead_worker* w = ra_worker;
+	readahead_req* req = w ? new (generic_mem()) readahead_req : nullptr;
+	if (!req) {
+		readahead(page_idx, page_nr);
+		return;
+	}
+
+	req->pcache = this;
+	req->page_idx = page_idx;
+	req->page_nr = page_nr;
+
+	w->lock.lock();
+	w->reqs.push_back(req);
+	w->lock.unlock();
+
+	w->thr->ready();
+}
+
+/// @brief  先読みスレッドへ渡したこの fs_page_cache の窓を捨てる。
+//
+/// 先読みスレッドがこの fs_page_cache を読んでいれば、読み終わるまで
+/// 眠って待つ。
+void fs_page_cache::cancel_readahead()
+{
+	readahead_worker* w = ra_worker;
+	if (!w)
+		return;
+
+	readahead_waiter waiter;
+	waiter.thr = get_current_thread();
+	waiter.queued = false;
+
+	for (;;) {
+		w->lock.lock();
+
+		for (readahead_req* req = w->reqs.front(); req; ) {
+			readahead_req* next = w->reqs.next(req);
+			if (req->pcache == this) {
+				w->reqs.remove(req);
+				new_destroy(req, generic_mem());
+			}
+			req = next;
+		}
+
+		const bool busy = w->running == this;
+		if (busy && !waiter.queued) {
+			w->waiters.push_back(&waiter);
+			waiter.queued = true;
+		}
+
+		w->lock.unlock();
+
+		if (!busy)
+			break;
+
+		sleep_current_thread();
+	}
+}
+
+/// @brief  page_idx から page_nr ページのうち、ファイルの末尾までの
+///         ページ数を返す。
+uptr fs_page_cache::clamp_pages(u64 page_idx, uptr page_nr)
+{
+	const u64 end = (get_size() + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (page_idx >= end)
+		return 0;
+
+	return min<u64>(page_nr, end - page_idx);
+}
+
+void* fs_page_cache::alloc_page()
+{
+	uptr padr;
+	cause::t r = page_alloc(arch::page::PHYS_L1, &padr);
+	if (is_fail(r))
+		return nullptr;
+
+	return arch::map_phys_adr(padr, PAGE_SIZE);
+}
+
+void fs_page_cache::free_page(void* page)
+{
+	const uptr padr = arch::unmap_phys_adr(page, PAGE_SIZE);
+
+	cause::t r = page_dealloc(arch::page::PHYS_L1, padr);
+	if (is_fail(r))
+		log()(SRCPOS)("!!! page_dealloc() failed. r=").u(r)();
+}
+
+
+// fs_page_cache_io_node
+
+fs_page_cache_io_node::fs_page_cache_io_node(fs_node* _fsnode) :
+	io_node(&fs_page_cache_io_node_ifs),
+	fsnode(_fsnode)
+{
+}
+
+/// @brief  fsnode を開いた io_node を作る。
+//
+/// fsnode は fs_node::enable_page_cache() を済ませていなければならない。
+cause::pair<io_node*> fs_page_cache_io_node::create(fs_node* fsnode)
+{
+	if (!fsnode->get_page_cache())
+		return null_pair(cause::INVALID_OBJECT);
+
+	fs_page_cache_io_node* ion =
+	    new (generic_mem()) fs_page_cache_io_node(fsnode);
+	if (!ion)
+		return null_pair(cause::NOMEM);
+
+	return make_pair(cause::OK, static_cast<io_node*>(ion));
+}
+
+cause::t fs_page_cache_io_node::on_Close(fs_page_cache_io_node* x)
+{
+	return new_destroy(x, generic_mem());
+}
+
+cause::t fs_page_cache_io_node::on_io_node_seek(
+    seek_whence whence, offset rel_off, offset* abs_off)
+{
+	return io_node::usual_seek(
+	    fsnode->get_page_cache()->get_size(), whence, rel_off, abs_off);
+}
+
+/// 同じ io_node を複数のスレッドで同時に読むと ra の更新が重なるが、
+/// 先読みの窓がずれるだけなので構わない。
+cause::pair<uptr> fs_page_cache_io_node::on_Read(
+    offset off, void* data, uptr bytes)
+{
+	if (off < 0)
+		return zero_pair(cause::BADARG);
+
+	return fsnode->get_page_cache()->read(off, data, bytes, &ra);
+}
+
+cause::pair<uptr> fs_page_cache_io_node::on_Write(
+    offset off, const void* data, uptr bytes)
+{
+	if (off < 0)
+		return zero_pair(cause::BADARG);
+
+	return fsnode->get_page_cache()->write(off, data, bytes);
+}
+
+
+/// @brief  fs_page_cache_io_node の interfaces と先読みスレッドを用意する。
+cause::t fs_page_cache_setup()
+{
+	fs_page_cache_io_node_ifs.init();
+	fs_page_cache_io_node_ifs.Close =
+	    io_node::call_on_Close<fs_page_cache_io_node>;
+	fs_page_cache_io_node_ifs.seek =
+	    io_node::call_on_io_node_seek<fs_page_cache_io_node>;
+	fs_page_cache_io_node_ifs.Read =
+	    io_node::call_on_Read<fs_page_cache_io_node>;
+	fs_page_cache_io_node_ifs.Write =
+	    io_node::call_on_Write<fs_page_cache_io_node>;
+
+	readahead_worker* w = new (generic_mem()) readahead_worker;
+	if (!w)
+		return cause::NOMEM;
+
+	w->running = nullptr;
+
+	auto thr = arch::create_kernel_thread(
+	    get_cpu_node(), readahead_worker_main, w);
+	if (is_fail(thr)) {
+		new_destroy(w, generic_mem());
+		return thr.cause();
+	}
+
+	w->thr = thr.value();
+
+	ra_worker = w;
+
+	return cause::OK;
+}
+
+/// @brief  全ての CPU の統計情報を合計して返す。
+void fs_page_cache_get_stat(fs_page_cache_stat* stat)
+{
+	mem_fill(0, stat, sizeof *stat);
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		const fs_page_cache_stat& s = cpu_stats[i].stat;
+		stat->hits            += s.hits;
+		stat->misses          += s.misses;
+		stat->readahead_pages += s.readahead_pages;
+		stat->writeback_pages += s.writeback_pages;
+	}
+}
+
@@ -150,6 +150,29 @@ int name_compare(const char* name1, const char* name2)
 	}
 }
 
+/// @brief  Hash node name.
+/// @param[out] len  Node name byte nums without splitter.
+/// @return  FNV-1a hash value of node name.
+u32 name_hash(const char* name, pathlen_t* len)
+{
+	u32 hash = 2166136261U;
+	uint n;
+	bool escape = false;
+
+	for (n = 0; ; ++n) {
+		if (name_is_end(escape, name + n))
+			break;
+
+		hash = (hash ^ u8(name[n])) * 16777619U;
+
+		escape = name[n] == ESCAPE;
+	}
+
+	*len = n;
+
+	return hash;
+}
+
 /// @brief   Copy node name.
 /// @return  Copied node name byte nums without '\0'.
 pathlen_t name_copy(const char* src, char* dest)
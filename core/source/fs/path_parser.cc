@@ -19,7 +19,9 @@
 
 #include <core/fs_ctl.hh>
 
+#include <core/dentry_cache.hh>
 #include <core/process.hh>
+#include <core/rcu.hh>
 #include <util/string.hh>
 
 
@@ -68,11 +70,21 @@ namespace fs {
 /// であれば、まだ同名のノードが無いと判断できる。
 /// 既存のノードを参照するときは path_parser::create() の戻り値が cause::OK、
 /// かつ、get_edge_node()->fsnode != nullptr であることを確認する必要がある。
+///
+/// パス名は、まず RCU の read 側で dentry_cache だけを使ってたどる
+/// (RCU walk)。このときはノードの refs を操作しないので、同時にパス名を
+/// たどっても refs のキャッシュラインを奪い合わない。
+/// dentry_cache に無い名前があれば、最初からノードごとに refs を取って
+/// たどり直す(ref walk)。
+/// RCU walk が成功したときは、ルートノードと、末端のノードとその親ノード
+/// だけが refs を持つ。fs_node は解放されないので、途中のノードのポインタ
+/// もそのまま使えるが、呼び出し元は末端とその親だけを使うこと。
 
 path_parser::path_parser(generic_ns* fsns, node_off node_nr) :
 	ns(fsns),
 	node_buf_nr(node_nr),
 	node_use_nr(0),
+	ref_base(1),
 	path_end(get_path_buffer())
 {
 	fs_node* root = static_cast<fs_ns*>(ns)->ref_root();
@@ -85,6 +97,9 @@ path_parser::path_parser(generic_ns* fsns, node_off node_nr) :
 path_parser::~path_parser()
 {
 	for (node_off i = 0; i < node_use_nr; ++i) {
+		if (i != 0 && i < ref_base)
+			continue;
+
 		fs_node* fsn = nodes[i].fsnode;
 		if (fsn)
 			fsn->refs.dec();
@@ -133,6 +148,13 @@ cause::pair<path_parser*> path_parser::_create(
 
     path_parser* obj = _obj.value();
 
+    if (obj->walk_rcu(cwd, path) == cause::OK) {
+        *obj->path_end = '\0';
+        return make_pair(cause::OK, obj);
+    }
+
+    obj->reset_walk();
+
     if (path_is_relative(path)) {
         // follow cwd.
         cause::t r = obj->follow_path(cwd);
@@ -174,6 +196,7 @@ cause::pair<path_parser*> path_parser::optimize()
 	}
 
 	y->node_use_nr = node_use_nr;
+	y->ref_base = ref_base;
 	node_use_nr = 0;
 
 	uptr path_off = path_end - my_path;
@@ -307,7 +330,7 @@ cause::t path_parser::follow_path(const char* path)
             continue;
         }
 
-        auto child = fsnode->ref_child_node(path);
+        auto child = fsnode->ref_child_node(name_key(path));
         if (child.cause() == cause::NOENT) {
             fsnode = nullptr;
         } else if (is_fail(child)) {
@@ -321,6 +344,90 @@ cause::t path_parser::follow_path(const char* path)
     return cause::OK;
 }
 
+/// @brief  RCU walk でパス名をたどる。
+/// @retval cause::OK  成功した。末端とその親の refs を取った。
+/// @retval other      ref walk でたどり直す必要がある。
+cause::t path_parser::walk_rcu(const char* cwd, const char* path)
+{
+    rcu_read_section _rrs;
+
+    // RCU walk の間は refs を取らない。
+    ref_base = node_buf_nr;
+
+    if (path_is_relative(path)) {
+        cause::t r = follow_path_rcu(cwd);
+        if (is_fail(r))
+            return r;
+    }
+
+    cause::t r = follow_path_rcu(path);
+    if (is_fail(r))
+        return r;
+
+    ref_base = node_use_nr > 2 ? node_use_nr - 2 : 1;
+    for (node_off i = ref_base; i < node_use_nr; ++i) {
+        fs_node* fsn = nodes[i].fsnode;
+        if (fsn)
+            fsn->refs.inc();
+    }
+
+    return cause::OK;
+}
+
+/// @brief  follow_path() と同じ。ただし dentry_cache だけを使い、
+///         refs を取らない。
+/// @retval cause::NOT_FOUND  dentry_cache に無い名前があった。
+cause::t path_parser::follow_path_rcu(const char* path)
+{
+    dentry_cache* dcache = get_dentry_cache();
+    fs_node* fsnode = edge_node()->fsnode;
+
+    for (;;) {
+        path = path_skip_splitter(path);
+
+        if (*path == '\0')
+            break;
+
+        if (!fsnode)
+            return cause::NOENT;
+
+        if (path_skip_current(&path)) {
+            continue;
+        } else if (path_skip_parent(&path)) {
+            if (!pop_node())
+                return cause::NOENT;
+            fsnode = edge_node()->fsnode;
+            continue;
+        }
+
+        if (!fsnode->is_dir())
+            return cause::NOTDIR;
+
+        auto child = dcache->lookup(
+            static_cast<fs_dir_node*>(fsnode), name_key(path));
+        if (child.cause() == cause::NOENT) {
+            fsnode = nullptr;
+        } else if (is_fail(child)) {
+            return child.cause();
+        } else {
+            fsnode = child.value()->into_ns(ns);
+        }
+        push_node_and_forward(fsnode, &path);
+    }
+
+    return cause::OK;
+}
+
+/// @brief  RCU walk でたどったノードを捨ててルートノードに戻す。
+//
+/// RCU walk が失敗したときはルートノード以外の refs を取っていない。
+void path_parser::reset_walk()
+{
+    node_use_nr = 1;
+    ref_base = 1;
+    path_end = nodes[0].name + 1;
+}
+
 char* path_parser::get_path_buffer()
 {
 	return reinterpret_cast<char*>(&nodes[node_buf_nr]);
@@ -354,7 +461,9 @@ bool path_parser::pop_node()
 
 	--node_use_nr;
 
-	nodes[node_use_nr].fsnode->refs.dec();
+	fs_node* fsn = nodes[node_use_nr].fsnode;
+	if (node_use_nr >= ref_base && fsn)
+		fsn->refs.dec();
 
 	path_end = const_cast<char*>(
 	    path_rskip_splitter(nodes[node_use_nr].name));
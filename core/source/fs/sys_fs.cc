@@ -19,6 +19,7 @@
 
 #include <core/process.hh>
 #include <core/fs_ctl.hh>
+#include <core/fs_page_cache.hh>
 
 #include <core/sys_fs.hh>
 
@@ -31,13 +32,14 @@ cause::pair<ucpu> sys_open(
 {
     fs_ctl* fsctl = get_fs_ctl();
     process* proc = get_current_process();
-    spin_wlock_section proc_lock(proc->ref_lock());
 
+    // パス名をたどる間はプロセスのロックを取らない。
     auto pathnodes = fs::path_parser::create(proc, path);
     if (is_fail(pathnodes))
         return zero_pair(pathnodes.cause());
 
     fs_node* target = pathnodes->get_edge_fsnode();
+    fs_node* found = nullptr;
     if (!target) {
         fs_node* _parent = pathnodes->get_edge_parent_fsnode();
         if (!_parent->is_dir()) {
@@ -46,18 +48,34 @@ cause::pair<ucpu> sys_open(
         }
 
         fs_dir_node* parent = static_cast<fs_dir_node*>(_parent);
-        auto child = parent->create_child_reg_node(
-            pathnodes->get_edge_name());
-        if (is_fail(child)) {
+        const char* name = pathnodes->get_edge_name();
+
+        spin_wlock_section proc_lock(proc->ref_lock());
+
+        // ロックを取る前に同じプロセスの別のスレッドが作っていれば、
+        // それを開く。
+        auto child = parent->ref_child_node(name);
+        if (is_ok(child)) {
+            target = found = child.value();
+        } else if (child.cause() != cause::NOENT) {
             fs::path_parser::destroy(pathnodes);
             return zero_pair(child.cause());
+        } else {
+            auto reg = parent->create_child_reg_node(name);
+            if (is_fail(reg)) {
+                fs::path_parser::destroy(pathnodes);
+                return zero_pair(reg.cause());
+            }
+
+            target = reg.value();
         }
-
-        target = child.value();
     }
 
     auto ion = target->open(flags);
 
+    if (found)
+        found->refs.dec();
+
     fs::path_parser::destroy(pathnodes);
 
     /*
@@ -67,6 +85,8 @@ cause::pair<ucpu> sys_open(
         return zero_pair(ion.cause());
     }
 
+    spin_wlock_section proc_lock(proc->ref_lock());
+
     auto iod = proc->append_io_desc(ion.value(), 0);
     if (is_fail(iod)) {
         return zero_pair(iod.cause());
@@ -166,5 +186,14 @@ cause::pair<ucpu> sys_unmount(
     return zero_pair(r);
 }
 
+/// @brief  全ての fs_page_cache の統計情報を返す。
+cause::pair<ucpu> sys_page_cache_stat(
+    fs_page_cache_stat* stat)
+{
+    fs_page_cache_get_stat(stat);
+
+    return zero_pair(cause::OK);
+}
+
 }  // namespace uniqos
 
@@ -65,6 +65,9 @@ void fs_mount::interfaces::init()
     ReleaseNode    = fs_mount::nofunc_ReleaseNode;
     OpenNode       = fs_mount::nofunc_OpenNode;
     CloseNode      = fs_mount::nofunc_CloseNode;
+    ReadPage       = fs_mount::nofunc_ReadPage;
+    ReadPages      = fs_mount::nofunc_ReadPages;
+    WritePage      = fs_mount::nofunc_WritePage;
 }
 
 cause::t fs_mount::create_dir_node(
@@ -104,6 +107,26 @@ cause::pair<fs_reg_node*> fs_mount::create_reg_node(
 	return child;
 }
 
+/// @brief  page_idx から page_nr ページを pages へ読む。
+//
+/// ReadPages を実装していないファイルシステムでは ReadPage で1ページ
+/// ずつ読む。
+cause::t fs_mount::read_pages(
+    fs_node* node, u64 page_idx, uptr page_nr, void* const* pages)
+{
+	cause::t r = ifs->ReadPages(this, node, page_idx, page_nr, pages);
+	if (r != cause::NOFUNC)
+		return r;
+
+	for (uptr i = 0; i < page_nr; ++i) {
+		r = ifs->ReadPage(this, node, page_idx + i, pages[i]);
+		if (is_fail(r))
+			return r;
+	}
+
+	return cause::OK;
+}
+
 
 // fs_mount_info
 
@@ -146,6 +169,11 @@ cause::t fs_mount_info::destroy(fs_mount_info* mp)
 	return cause::OK;
 }
 
+void fs_mount_info::destroy_rcu(void* mp)
+{
+	destroy(static_cast<fs_mount_info*>(mp));
+}
+
 
 // fs_rootfs_drv
 
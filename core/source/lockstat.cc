@@ -0,0 +1,138 @@
+/// @file   lockstat.cc
+/// @brief  Spin lock statistics.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/lockstat.hh>
+
+#include <core/output_buffer.hh>
+#include <util/atomic.hh>
+
+
+#if LOCKSTAT_ENABLED
+
+namespace {
+
+enum {
+	/// 記録できるロックの取得場所の数。2^n であること。
+	LOCKSTAT_SITES = 1024,
+};
+
+/// lockstat_site の caller をキーにしたオープンアドレスのハッシュ表。
+/// spin_lock の中から呼ばれるので、ロックを使わずに cmpxchg で登録する。
+lockstat_site sites[LOCKSTAT_SITES];
+
+/// 表が一杯になったときは全てここに記録する。
+lockstat_site overflow_site;
+
+inline uptr site_hash(const void* caller)
+{
+	const uptr x = reinterpret_cast<uptr>(caller);
+
+	return (x ^ (x >> 10)) & (LOCKSTAT_SITES - 1);
+}
+
+}  // namespace
+
+/// @brief  caller に対応する lockstat_site を返す。
+//
+/// 初めての caller なら空いている lockstat_site を割り当てる。
+lockstat_site* lockstat_get_site(const void* caller)
+{
+	uptr i = site_hash(caller);
+
+	for (int n = 0; n < LOCKSTAT_SITES; ++n) {
+		lockstat_site* site = &sites[i];
+
+		const void* c = site->caller;
+		if (c == caller)
+			return site;
+
+		if (c == nullptr) {
+			c = reinterpret_cast<const void*>(
+			    arch::atomic_compare_exchange(
+			        uptr(0),
+			        reinterpret_cast<uptr>(caller),
+			        reinterpret_cast<volatile uptr*>(&site->caller)));
+			if (c == nullptr || c == caller)
+				return site;
+		}
+
+		i = (i + 1) & (LOCKSTAT_SITES - 1);
+	}
+
+	return &overflow_site;
+}
+
+void lockstat_acquired(lockstat_site* site, bool contended, u64 spin_cycles)
+{
+	arch::atomic_add(u64(1), &site->acquire_cnt);
+
+	if (contended) {
+		arch::atomic_add(u64(1), &site->contended_cnt);
+		arch::atomic_add(spin_cycles, &site->spin_cycles);
+	}
+}
+
+void lockstat_released(lockstat_site* site, u64 hold_cycles)
+{
+	for (;;) {
+		const u64 max = site->max_hold_cycles;
+		if (hold_cycles <= max)
+			break;
+
+		if (arch::atomic_compare_exchange(
+		    max, hold_cycles, &site->max_hold_cycles) == max)
+			break;
+	}
+}
+
+/// @brief  記録した統計情報を出力する。
+cause::t lockstat_dump(output_buffer& ob)
+{
+	ob("caller            acquire   contended spin_cycles max_hold")();
+
+	for (const lockstat_site& site : sites) {
+		if (!site.caller)
+			continue;
+
+		ob.x(reinterpret_cast<uptr>(site.caller), 16)(' ')
+		  .u(site.acquire_cnt, 9)(' ')
+		  .u(site.contended_cnt, 9)(' ')
+		  .u(site.spin_cycles, 11)(' ')
+		  .u(site.max_hold_cycles)();
+	}
+
+	if (overflow_site.acquire_cnt) {
+		ob("(overflow)        ")
+		  .u(overflow_site.acquire_cnt, 9)(' ')
+		  .u(overflow_site.contended_cnt, 9)(' ')
+		  .u(overflow_site.spin_cycles, 11)(' ')
+		  .u(overflow_site.max_hold_cycles)();
+	}
+
+	return cause::OK;
+}
+
+#else  // LOCKSTAT_ENABLED
+
+cause::t lockstat_dump(output_buffer&)
+{
+	return cause::NOFUNC;
+}
+
+#endif  // LOCKSTAT_ENABLED
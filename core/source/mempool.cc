@@ -32,7 +32,8 @@
 /// ロック制御する必要がある。
 
 mempool::page::page() :
-	acquire_cnt(0)
+	acquire_cnt(0),
+	owner_node(nullptr)
 {
 }
 
@@ -120,7 +121,10 @@ void mempool::page::init(const mempool& owner)
 // mempool::node
 
 mempool::node::node() :
-	freeobj_cnt(0)
+	freeobj_cnt(0),
+	loaded(nullptr),
+	previous(nullptr),
+	alloc_cnt(0)
 {
 }
 
@@ -134,23 +138,7 @@ void* mempool::node::acquire()
 {
 	spin_lock_section _sls(lock);
 
-	memobj* obj = free_objs.pop_front();
-	if (obj) {
-		--freeobj_cnt;
-	} else {
-		page* pg = free_pages.front();
-		if (pg == 0)
-			return 0;
-
-		obj = pg->acquire();
-
-		if (pg->is_full()) {
-			free_pages.pop_front(); // == pg
-			full_pages.push_front(pg);
-		}
-	}
-
-	return obj;
+	return _acquire();
 }
 
 /// memobj を解放する。
@@ -165,8 +153,113 @@ void mempool::node::release(void* ptr)
 	++freeobj_cnt;
 }
 
+/// @brief  magazine から memobj を１つ取り出す。
+/// @return 補充できる memobj が無ければ nullptr を返す。
+//
+/// この node に対応する CPU から、プリエンプション禁止状態で呼び出す
+/// 必要がある。loaded と previous のどちらかに memobj があればロックも
+/// atomic 命令も使わない。
+mempool::memobj* mempool::node::cache_acquire(mempool* owner)
+{
+	if (loaded && !loaded->is_empty())
+		return loaded->pop();
+
+	if (previous && !previous->is_empty()) {
+		magazine* tmp = loaded;
+		loaded = previous;
+		previous = tmp;
+		return loaded->pop();
+	}
+
+	// loaded と previous が空なので depot の満杯の magazine と交換する。
+	magazine* full = owner->depot_exchange_full(previous);
+	if (full) {
+		previous = loaded;
+		loaded = full;
+		return loaded->pop();
+	}
+
+	// depot にも無ければ node から一括で補充する。
+	if (!loaded) {
+		loaded = owner->new_magazine();
+		if (!loaded)
+			return nullptr;
+	}
+
+	acquire_bulk(loaded);
+
+	if (loaded->is_empty())
+		return nullptr;
+
+	return loaded->pop();
+}
+
+/// @brief  memobj を magazine へ返す。
+/// @retval true   magazine へ返した。
+/// @retval false  magazine を用意できなかった。呼び出し元で release() する。
+//
+/// cache_acquire() と同じく、プリエンプション禁止状態で呼び出す必要がある。
+/// 別の CPU で確保した memobj でもこの CPU の magazine へ返すので、
+/// 確保した CPU の node のロックは取らない。
+bool mempool::node::cache_release(void* ptr, mempool* owner)
+{
+	memobj* obj = new (ptr) memobj;
+
+	if (loaded && !loaded->is_full()) {
+		loaded->push(obj);
+		return true;
+	}
+
+	if (previous && !previous->is_full()) {
+		magazine* tmp = loaded;
+		loaded = previous;
+		previous = tmp;
+		loaded->push(obj);
+		return true;
+	}
+
+	// loaded と previous が満杯なので depot の空の magazine と交換する。
+	magazine* empty = owner->depot_exchange_empty(previous);
+	if (!empty) {
+		empty = owner->new_magazine();
+		if (!empty)
+			return false;
+
+		// 満杯の previous は depot へ渡す。
+		if (previous)
+			owner->depot_put_full(previous);
+	}
+
+	previous = loaded;
+	loaded = empty;
+	loaded->push(obj);
+
+	return true;
+}
+
+/// @brief  magazine の memobj をすべてページへ戻し、magazine を解放する。
+//
+/// この node に対応する CPU から呼び出すか、mempool を破棄するときのように
+/// 他の CPU がこの node を使っていないときに呼び出す必要がある。
+void mempool::node::drain_cache(mempool* owner)
+{
+	if (loaded) {
+		owner->drain_magazine(loaded);
+		owner->delete_magazine(loaded);
+		loaded = nullptr;
+	}
+
+	if (previous) {
+		owner->drain_magazine(previous);
+		owner->delete_magazine(previous);
+		previous = nullptr;
+	}
+}
+
 void mempool::node::push_page(page* new_page)
 {
+	new_page->set_owner_node(this);
+
 	lock.lock();
 
 	free_pages.push_front(new_page);
@@ -174,78 +267,135 @@ void mempool::node::push_page(page* new_page)
 	lock.unlock();
 }
 
-/// free_objs から memobj を１つ解放する。
-/// @return free_objs が空か、memobj の解放に成功すると nullptr を返す。
-///         memobj の解放に失敗すると失敗した memobj へのポインタを返す。
-///         失敗したときは memobj が他の node に属している。
+/// free_objs から memobj を１つ取り出す。
+/// @return free_objs が空なら nullptr を返す。
 //
-/// 失敗した場合に返される memobj は free_objs から外されている。
-mempool::memobj* mempool::node::pop_freeobj(mempool* owner)
+/// 取り出した memobj は mempool::back_to_page() でページへ戻す。
+mempool::memobj* mempool::node::pop_freeobj()
 {
-	lock.lock();
+	spin_lock_section _sls(lock);
 
 	memobj* obj = free_objs.pop_front();
+	if (obj)
+		--freeobj_cnt;
 
-	// back_to_page() は独自にロックしているので、ここで unlock する。
-	lock.unlock();
-
-	if (obj == nullptr || back_to_page(obj, owner))
-		return nullptr;
-	else
-		return obj;
+	return obj;
 }
 
+/// SAVE_FREEOBJS を超える free_objs をページへ戻す。
+//
+/// 戻す先のページは mempool::page_of_obj() で直接求めるので、
+/// 処理時間は戻す memobj の数に比例する。
 void mempool::node::collect_free_pages(mempool* owner)
 {
 	const sptr SAVE_FREEOBJS = 64;
 
-	const sptr n = freeobj_cnt - SAVE_FREEOBJS;
-	for (sptr i = 0; i < n; ++i) {
-		memobj* obj = free_objs.pop_front();
-		if (back_to_page(obj, owner))
-			--freeobj_cnt;
-		else
-			free_objs.pop_front();
+	obj_chain objs;
+
+	lock.lock();
+
+	for (; freeobj_cnt > SAVE_FREEOBJS; --freeobj_cnt)
+		objs.push_front(free_objs.pop_front());
+
+	// back_to_page() は戻し先の node をロックするので、ここで unlock する。
+	lock.unlock();
+
+	for (;;) {
+		memobj* obj = objs.pop_front();
+		if (!obj)
+			break;
+
+		owner->back_to_page(obj);
 	}
 }
 
 /// mempool::page から確保した memobj を元の mempool::page へ戻す。
+/// @param[in] pg     obj を含む page。この node に属していなければならない。
+/// @param[in] obj    戻す memobj。
 /// @param[in] owner  ページのサイズ情報へのアクセスとページの解放に使用する
-/// @retval true   obj の解放に成功した。
-/// @retval false  obj の解放に失敗した。obj は別のnodeに属している。
-bool mempool::node::back_to_page(memobj* obj, mempool* owner)
+void mempool::node::back_to_page(page* pg, memobj* obj, mempool* owner)
 {
-	spin_lock_section _sls(lock);
+	lock.lock();
 
-	for (page* pg = free_pages.front(); pg; pg = free_pages.next(pg)) {
-		if (pg->release(*owner, obj)) {
-			if (pg->is_free()) {
-				free_pages.remove(pg);
-				owner->delete_page(pg);
-			}
-			return true;
-		}
+	const bool was_full = pg->is_full();
+
+	if (UNLIKELY(!pg->release(*owner, obj))) {
+		lock.unlock();
+		log()(SRCPOS)("(): !!!memobj is out of page. obj:")(obj)
+		     (" page:")(pg)();
+		return;
 	}
 
-	for (page* pg = full_pages.front(); pg; pg = full_pages.next(pg)) {
-		if (pg->release(*owner, obj)) {
+	if (pg->is_free()) {
+		if (was_full)
 			full_pages.remove(pg);
-			free_pages.push_front(pg);
-			return true;
+		else
+			free_pages.remove(pg);
+
+		lock.unlock();
+
+		owner->delete_page(pg);
+		return;
+	}
+
+	if (was_full) {
+		full_pages.remove(pg);
+		free_pages.push_front(pg);
+	}
+
+	lock.unlock();
+}
+
+/// @brief  空きの memobj を１つ確保する。
+//
+/// lock を取得してから呼び出す必要がある。
+mempool::memobj* mempool::node::_acquire()
+{
+	memobj* obj = free_objs.pop_front();
+	if (obj) {
+		--freeobj_cnt;
+	} else {
+		page* pg = free_pages.front();
+		if (pg == 0)
+			return 0;
+
+		obj = pg->acquire();
+
+		if (pg->is_full()) {
+			free_pages.pop_front(); // == pg
+			full_pages.push_front(pg);
 		}
 	}
 
-	return false;
+	return obj;
+}
+
+/// @brief  mag が満杯になるまで memobj を補充する。
+//
+/// ロックは１回だけ取得する。空きの memobj が足りなければ満杯にならない。
+void mempool::node::acquire_bulk(magazine* mag)
+{
+	spin_lock_section _sls(lock);
+
+	while (!mag->is_full()) {
+		memobj* obj = _acquire();
+		if (!obj)
+			break;
+
+		mag->push(obj);
+	}
 }
 
 void mempool::node::import_dirty_page(page* page)
 {
+	page->set_owner_node(this);
+
 	lock.lock();
 
 	if (page->is_full())
-		free_pages.push_front(page);
-	else
 		full_pages.push_front(page);
+	else
+		free_pages.push_front(page);
 
 	lock.unlock();
 }
@@ -259,10 +409,10 @@ mempool::mempool(u32 _obj_size, arch::page::TYPE ptype, mempool* _page_pool) :
 	          auto_page_type(obj_size) : ptype),
 	page_size(arch::page::size_of_type(page_type)),
 	page_objs((page_size - sizeof (page)) / obj_size),
-	alloc_cnt(0),
 	page_cnt(0),
 	shared_count(0),
-	page_pool(_page_pool)
+	page_pool(_page_pool),
+	magazine_mp(nullptr)
 {
 	obj_name[0] = '\0';
 
@@ -277,20 +427,20 @@ void mempool::setup_mem_allocator(const mem_allocator::interfaces* ifs)
 
 cause::t mempool::destroy()
 {
-	if (alloc_cnt.load() != 0 ||
+	if (get_alloc_cnt() != 0 ||
 	    page_cnt.load() != 0 ||
 	    shared_count.load() != 0)
 	{
 		log()("FAULT:")
 		(SRCPOS)("(): Bad operation.")()
-		("| alloc_cnt: ").u(alloc_cnt.load())
+		("| alloc_cnt: ").u(get_alloc_cnt())
 		(", page_cnt: ").u(page_cnt.load())()
 		(", shared_count: ").u(shared_count.load())();
 
 		return cause::FAIL;
 	}
 
-	if (collect_all_freeobjs())
+	if (!collect_all_freeobjs())
 		return cause::FAIL;
 
 	return cause::OK;
@@ -385,6 +535,9 @@ void mempool::collect_free_pages()
 
 	const cpu_id cpuid = arch::get_cpu_node_id();
 
+	mempool_nodes[cpuid]->drain_cache(this);
+	drain_depot();
+
 	mempool_nodes[cpuid]->collect_free_pages(this);
 }
 
@@ -392,10 +545,10 @@ void mempool::collect_one_freeobj()
 {
 	cpu_id cur_cpuid = arch::get_cpu_node_id();
 
-	memobj* obj = mempool_nodes[cur_cpuid]->pop_freeobj(this);
+	memobj* obj = mempool_nodes[cur_cpuid]->pop_freeobj();
 
 	if (obj)
-		back_to_page(cur_cpuid, obj);
+		back_to_page(obj);
 }
 
 /// freeobj をすべて回収する。
@@ -407,14 +560,21 @@ bool mempool::collect_all_freeobjs()
 {
 	const cpu_id cpu_num = get_cpu_node_count();
 
+	for (cpu_id cpu = 0; cpu < cpu_num; ++cpu)
+		mempool_nodes[cpu]->drain_cache(this);
+
+	drain_depot();
+
 	for (cpu_id cpu = 0; cpu < cpu_num; ++cpu) {
 
 		sptr objcnt = mempool_nodes[cpu]->get_freeobj_cnt();
 		for (sptr i = 0; i < objcnt; ++i) {
 
-			memobj* obj = mempool_nodes[cpu]->pop_freeobj(this);
-			if (obj)
-				back_to_page(cpu, obj);
+			memobj* obj = mempool_nodes[cpu]->pop_freeobj();
+			if (!obj)
+				break;
+
+			back_to_page(obj);
 		}
 	}
 
@@ -426,6 +586,19 @@ bool mempool::collect_all_freeobjs()
 	return true;
 }
 
+sptr mempool::get_alloc_cnt() const
+{
+	const cpu_id cpu_num = get_cpu_node_count();
+
+	sptr cnt = 0;
+	for (cpu_id cpu = 0; cpu < cpu_num; ++cpu) {
+		if (mempool_nodes[cpu])
+			cnt += mempool_nodes[cpu]->get_alloc_cnt();
+	}
+
+	return cnt;
+}
+
 void mempool::set_obj_name(const char* name)
 {
 	str_copy(name, obj_name, sizeof obj_name - 1);
@@ -440,7 +613,7 @@ void mempool::dump(output_buffer& ob, uint level)
 		("\npage_type   : ").u(page_type, 12)
 		(" |page_size      : ").u(page_size, 12)
 		("\npage_objs   : ").u(page_objs, 12)
-		("\nalloc_cnt   : ").s(alloc_cnt.load(), 12)
+		("\nalloc_cnt   : ").s(get_alloc_cnt(), 12)
 		(" |page_cnt       : ").s(page_cnt.load(), 12)();
 	}
 
@@ -456,7 +629,7 @@ void mempool::dump_table(output_buffer& ob)
 {
 	ob.str(obj_name, 14)(' ').
 	   u(obj_size, 11)(' ').
-	   u(alloc_cnt.load(), 11)(' ').
+	   u(get_alloc_cnt(), 11)(' ').
 	   u(page_cnt.load(), 11)(' ')();
 }
 
@@ -483,9 +656,17 @@ void* mempool::_alloc(cpu_id_t cpuid)
 {
 	preempt_disable_section _pds;
 
+	const cpu_id_t cur_cpuid = arch::get_cpu_node_id();
+
 	node* nd = mempool_nodes[cpuid];
 
-	void* r = nd->acquire();
+	// 他の CPU の magazine は触れないので node から直接確保する。
+	void* r = nullptr;
+	if (magazine_mp && cpuid == cur_cpuid)
+		r = nd->cache_acquire(this);
+
+	if (!r)
+		r = nd->acquire();
 	if (!r) {
 		page* pg = new_page(cpuid);
 		if (UNLIKELY(!pg))
@@ -502,18 +683,22 @@ void* mempool::_alloc(cpu_id_t cpuid)
 	}
 
 	if (r)
-		alloc_cnt.add(1);
+		mempool_nodes[cur_cpuid]->inc_alloc_cnt();
 
 	return r;
 }
 
+/// プリエンプション禁止状態で呼び出す必要がある。
 void mempool::_dealloc(void* ptr)
 {
 	const int cpuid = arch::get_cpu_node_id();
 
-	mempool_nodes[cpuid]->release(ptr);
+	node* nd = mempool_nodes[cpuid];
+
+	if (!magazine_mp || !nd->cache_release(ptr, this))
+		nd->release(ptr);
 
-	alloc_cnt.sub(1);
+	nd->dec_alloc_cnt();
 }
 
 mempool::page* mempool::new_page(int cpuid)
@@ -534,6 +719,12 @@ mempool::page* mempool::new_page(int cpuid)
 		}
 
 		pg->init_as_offpage(*this, mem);
+
+		if (is_fail(page_set_owner(padr, pg))) {
+			page_pool->dealloc(pg);
+			page_dealloc(page_type, padr);
+			return 0;
+		}
 	} else {
 		pg = new (mem) page;
 		pg->init_as_onpage(*this);
@@ -551,6 +742,7 @@ void mempool::delete_page(page* pg)
 	if (page_pool) {
 		const uptr adr =
 		    arch::unmap_phys_adr(pg->get_memory(), page_size);
+		page_set_owner(adr, nullptr);
 		page_pool->dealloc(pg);
 		page_dealloc(page_type, adr);
 	} else {
@@ -565,24 +757,131 @@ void mempool::delete_page(page* pg)
 	page_cnt.sub(1);
 }
 
-void mempool::back_to_page(cpu_id src_cpuid, memobj* obj)
+/// @brief  obj を含む mempool::page を返す。
+//
+/// ONPAGE の場合はページ先頭に mempool::page があるので、アドレスを
+/// ページサイズで切り捨てるだけで求まる。
+/// OFFPAGE の場合は new_page() で page_set_owner() に記録した値を引く。
+mempool::page* mempool::page_of_obj(memobj* obj)
+{
+	const uptr head =
+	    down_align<uptr>(reinterpret_cast<uptr>(obj), page_size);
+
+	if (!page_pool)
+		return reinterpret_cast<page*>(head);
+
+	const uptr padr = arch::unmap_phys_adr(
+	    reinterpret_cast<void*>(head), page_size);
+
+	return static_cast<page*>(page_get_owner(padr));
+}
+
+/// @brief  obj を確保元の page へ戻す。
+//
+/// page を保持している node を直接求めるので、node やページの数に
+/// よらず O(1) で戻せる。
+void mempool::back_to_page(memobj* obj)
+{
+	page* pg = page_of_obj(obj);
+	node* nd = pg ? pg->get_owner_node() : nullptr;
+	if (UNLIKELY(!nd)) {
+		log()(SRCPOS)
+		    ("(): !!!freeobj source not found.")();
+		return;
+	}
+
+	nd->back_to_page(pg, obj, this);
+}
+
+mempool::magazine* mempool::new_magazine()
+{
+	auto mem = magazine_mp->acquire();
+	if (is_fail(mem))
+		return nullptr;
+
+	magazine* mag = new (mem.value()) magazine;
+	mag->rounds = 0;
+
+	return mag;
+}
+
+void mempool::delete_magazine(magazine* mag)
+{
+	mag->~magazine();
+	operator delete (mag, mag);
+
+	magazine_mp->release(mag);
+}
+
+/// @brief  mag の memobj をすべてページへ戻す。
+void mempool::drain_magazine(magazine* mag)
+{
+	while (!mag->is_empty())
+		back_to_page(mag->pop());
+}
+
+/// @brief  空の magazine と depot の満杯の magazine を交換する。
+/// @param[in] empty  depot へ渡す空の magazine。nullptr でもよい。
+/// @return 満杯の magazine を返す。depot に無ければ nullptr を返し、
+///         empty は depot へ渡さない。
+mempool::magazine* mempool::depot_exchange_full(magazine* empty)
+{
+	spin_lock_section _sls(depot_lock);
+
+	magazine* full = depot_full.pop_front();
+	if (full && empty)
+		depot_empty.push_front(empty);
+
+	return full;
+}
+
+/// @brief  満杯の magazine と depot の空の magazine を交換する。
+/// @param[in] full  depot へ渡す満杯の magazine。nullptr でもよい。
+/// @return 空の magazine を返す。depot に無ければ nullptr を返し、
+///         full は depot へ渡さない。
+mempool::magazine* mempool::depot_exchange_empty(magazine* full)
+{
+	spin_lock_section _sls(depot_lock);
+
+	magazine* empty = depot_empty.pop_front();
+	if (empty && full)
+		depot_full.push_front(full);
+
+	return empty;
+}
+
+/// @brief  満杯の magazine を depot へ渡す。
+void mempool::depot_put_full(magazine* full)
+{
+	spin_lock_section _sls(depot_lock);
+
+	depot_full.push_front(full);
+}
+
+/// @brief  depot の magazine をすべて解放する。
+void mempool::drain_depot()
 {
-	const cpu_id last_cpu = get_cpu_node_count() - 1;
-	cpu_id cpuid = src_cpuid;
 	for (;;) {
-		if (cpuid > 0)
-			--cpuid;
-		else
-			cpuid = last_cpu;
+		depot_lock.lock();
+		magazine* mag = depot_full.pop_front();
+		depot_lock.unlock();
 
-		if (cpuid == src_cpuid) {
-			log()(SRCPOS)
-			    ("(): !!!freeobj source not found.");
+		if (!mag)
 			break;
-		}
 
-		if (mempool_nodes[cpuid]->back_to_page(obj, this))
+		drain_magazine(mag);
+		delete_magazine(mag);
+	}
+
+	for (;;) {
+		depot_lock.lock();
+		magazine* mag = depot_empty.pop_front();
+		depot_lock.unlock();
+
+		if (!mag)
 			break;
+
+		delete_magazine(mag);
 	}
 }
 
@@ -26,9 +26,10 @@
 #include <core/new_ops.hh>
 
 
-void* mem_alloc(u32 bytes)
+void* mem_alloc_class(uint size_class)
 {
-	return global_vars::core.mempool_ctl_obj->shared_allocate(bytes);
+	return global_vars::core.mempool_ctl_obj->shared_allocate_class(
+	    size_class);
 }
 
 void mem_dealloc(void* mem)
@@ -42,8 +43,11 @@ void mem_dealloc(void* mem)
 mempool_ctl::mempool_ctl() :
 	mempool_mp(nullptr),
 	node_mp(nullptr),
-	offpage_mp(nullptr)
+	offpage_mp(nullptr),
+	magazine_mp(nullptr)
 {
+	for (uint i = 0; i < MEM_CLASS_NR; ++i)
+		shared_class_map[i] = nullptr;
 }
 
 cause::t mempool_ctl::setup()
@@ -70,10 +74,18 @@ void mempool_ctl::move_to(mempool_ctl* dest)
 	dest->offpage_mp = this->offpage_mp;
 	this->offpage_mp = nullptr;
 
+	dest->magazine_mp = this->magazine_mp;
+	this->magazine_mp = nullptr;
+
 	this->shared_chain.move_to(&dest->shared_chain);
 
 	this->exclusived_chain.move_to(&dest->exclusived_chain);
 
+	for (uint i = 0; i < MEM_CLASS_NR; ++i) {
+		dest->shared_class_map[i] = this->shared_class_map[i];
+		this->shared_class_map[i] = nullptr;
+	}
+
 	dest->after_move();
 }
 
@@ -187,6 +199,8 @@ cause::pair<mempool*> mempool_ctl::create_exclusived_mp(
 		new_mp->set_node(i, nd);
 	}
 
+	new_mp->set_magazine_pool(magazine_mp);
+
 	new_mp->setup_mem_allocator(&_mp_allocator_ifs);
 
 	exclusived_chain_lock.wlock();
@@ -248,16 +262,18 @@ heap* mem_to_heap(void* mem)
 
 void* mempool_ctl::shared_allocate(u32 bytes)
 {
-	const u32 size = mempool::normalize_obj_size(bytes + sizeof (mempool*));
+	return shared_allocate_class(mem_size_class(bytes + sizeof (mempool*)));
+}
 
-	mempool* pool = 0;
-	for (mempool* mp : shared_chain) {
-		if (mp->get_obj_size() >= size) {
-			pool = mp;
-			break;
-		}
-	}
+/// @brief  サイズクラスに対応する shared mempool から確保する。
+//
+/// shared_class_map を引くだけなので、shared mempool の数によらず O(1)。
+void* mempool_ctl::shared_allocate_class(uint size_class)
+{
+	if (UNLIKELY(size_class >= MEM_CLASS_NR))
+		return 0;
 
+	mempool* pool = shared_class_map[size_class];
 	if (!pool)
 		return 0;
 
@@ -345,6 +361,15 @@ cause::t mempool_ctl::setup_mp()
 		return mp.cause();
 	offpage_mp = mp.data();
 
+	// magazine_mp を生成する。
+	// magazine_mp 自身と、これより前に生成した mempool は magazine を
+	// 使わない。
+	mp = create_exclusived_mp(
+	    sizeof (mempool::magazine), arch::page::INVALID, mempool::ONPAGE);
+	if (is_fail(mp))
+		return mp.cause();
+	magazine_mp = mp.value();
+
 	return cause::OK;
 }
 
@@ -369,12 +394,28 @@ cause::t mempool_ctl::setup_shared_mp()
 		mp->inc_shared_count();
 	}
 
+	build_shared_class_map();
+
 	return cause::OK;
 }
 
+/// @brief  shared_class_map を作る。
+//
+/// 各サイズクラスには、そのクラスのサイズが収まる最小の shared mempool を
+/// 割り当てる。
+void mempool_ctl::build_shared_class_map()
+{
+	for (uint i = 0; i < MEM_CLASS_NR; ++i)
+		shared_class_map[i] = find_shared(mem_class_size(i));
+}
+
 cause::t mempool_ctl::unsetup_mp()
 {
-	cause::t r = destroy_exclusived_mp(offpage_mp);
+	cause::t r = destroy_exclusived_mp(magazine_mp);
+	if (is_fail(r))
+		return r;
+
+	r = destroy_exclusived_mp(offpage_mp);
 	if (is_fail(r))
 		return r;
 
@@ -454,6 +495,8 @@ cause::t mempool_ctl::create_shared(u32 objsize, mempool** new_mp)
 		(*new_mp)->set_node(i, nd);
 	}
 
+	(*new_mp)->set_magazine_pool(magazine_mp);
+
 	for (mempool* mp = shared_chain.front();
 	     mp;
 	     mp = shared_chain.next(mp))
@@ -475,6 +518,7 @@ void mempool_ctl::destroy_shared(mempool* mp)
 	mp->destroy();
 
 	shared_chain.remove(mp);
+	build_shared_class_map();
 
 	destroy_mp(mp);
 
@@ -635,7 +679,7 @@ cause::t mempool_post_setup()
 	return global_vars::core.mempool_ctl_obj->post_setup();
 }
 
-mem_allocator& generic_mem()
+generic_mem_allocator& generic_mem()
 {
 	return global_vars::core.mempool_ctl_obj->shared_mem();
 }
@@ -45,6 +45,7 @@ public:
 	cause::t destroy_exclusived_mp(mempool* mp);
 
 	void* shared_allocate(u32 bytes);
+	void* shared_allocate_class(uint size_class);
 	void shared_deallocate(void* mem);
 
 	void dump(output_buffer& ob);
@@ -54,6 +55,7 @@ private:
 	cause::t unsetup_mp();
 	cause::t setup_shared_mp();
 	cause::t unsetup_shared_mp();
+	void build_shared_class_map();
 
 	mempool* find_shared(u32 objsize);
 	cause::t create_shared(u32 objsize, mempool** new_mp);
@@ -75,24 +77,31 @@ private:
 	/// page source of offpage mempool.
 	mempool* offpage_mp;
 
+	/// mempool::magazine の生成に使う。
+	mempool* magazine_mp;
+
 	mempool_chain shared_chain;
 	mempool_chain exclusived_chain;
 
+	/// サイズクラスから shared mempool を引くための表。
+	/// setup_shared_mp() で shared_chain から作る。
+	mempool* shared_class_map[MEM_CLASS_NR];
+
 	spin_rwlock exclusived_chain_lock;
 
 // mem_allocator implement
 public:
-	mem_allocator& shared_mem() { return _shared_mem; }
+	generic_mem_allocator& shared_mem() { return _shared_mem; }
 
 	const mem_allocator::interfaces* get_mp_allocator_ifs() const {
 		return &_mp_allocator_ifs;
 	}
 
 private:
-	class shared_mem_allocator : public mem_allocator
+	class shared_mem_allocator : public generic_mem_allocator
 	{
 	public:
-		shared_mem_allocator() : mem_allocator(&_ifs) {}
+		shared_mem_allocator() : generic_mem_allocator(&_ifs) {}
 		void init();
 
 	private:
@@ -19,6 +19,8 @@
 
 #include <core/message_queue.hh>
 
+#include <util/atomic.hh>
+
 
 message_queue::message_queue()
 {
@@ -57,3 +59,52 @@ bool message_queue::deliv_all_np()
 
 	return true;
 }
+
+/// @brief  message を追加する。
+/// @retval true   空の箱に追加した。受け取る CPU を起こす必要がある。
+/// @retval false  既に message があった。受け取る CPU は起こされている。
+bool message_inbox::push(message* msg)
+{
+	volatile uptr* h = reinterpret_cast<volatile uptr*>(&head);
+
+	for (;;) {
+		message* old = head;
+		msg->inbox_next = old;
+
+		const uptr r = arch::atomic_compare_exchange(
+		    reinterpret_cast<uptr>(old), reinterpret_cast<uptr>(msg), h);
+		if (r == reinterpret_cast<uptr>(old))
+			return old == nullptr;
+	}
+}
+
+/// @brief  全ての message を取り出して、届いた順に q へ移す。
+/// @return 移した message の数。
+//
+/// 受け取る CPU で preempt_disable 状態で呼び出す。
+int message_inbox::take_all(message_queue* q)
+{
+	if (!probe())
+		return 0;
+
+	message* msg = reinterpret_cast<message*>(
+	    arch::atomic_exchange(uptr(0),
+	        reinterpret_cast<volatile uptr*>(&head)));
+
+	// head から辿ると新しい順なので、逆順にしてから q へ移す。
+	message* rev = nullptr;
+	while (msg) {
+		message* next = msg->inbox_next;
+		msg->inbox_next = rev;
+		rev = msg;
+		msg = next;
+	}
+
+	int n = 0;
+	for (; rev; rev = rev->inbox_next) {
+		q->push(rev);
+		++n;
+	}
+
+	return n;
+}
@@ -20,6 +20,8 @@
 #include <core/page.hh>
 
 #include <core/cpu_node.hh>
+#include <core/global_vars.hh>
+#include <core/page_pool.hh>
 
 
 cause::pair<uptr> page_alloc(page_level page_type)
@@ -61,3 +63,63 @@ cause::t page_dealloc(page_level page_type, uptr padr)
 	return cpu->page_dealloc(page_type, padr);
 }
 
+/// @brief  しばらく触っていないページを解放する。
+//
+/// CPU のページキャッシュの cold 側に入るので、すぐには再利用されない。
+cause::t page_dealloc_cold(page_level page_type, uptr padr)
+{
+	cpu_node* cpu = get_cpu_node();
+
+	return cpu->page_dealloc_cold(page_type, padr);
+}
+
+/// @brief  物理的に連続した L1 ページを確保する。
+/// @param[in] count  確保する L1 ページ数。
+/// @param[in] align  先頭アドレスのアラインメント。2^n バイトで指定する。
+/// @param[out] padr  確保したメモリの先頭物理アドレスを返す。
+cause::t page_alloc_contig(uptr count, uptr align, uptr* padr)
+{
+	cpu_node* cpu = get_cpu_node();
+
+	return cpu->page_alloc_contig(count, align, padr);
+}
+
+/// @brief  page_alloc_contig() で確保したメモリを解放する。
+cause::t page_dealloc_contig(uptr padr, uptr count)
+{
+	cpu_node* cpu = get_cpu_node();
+
+	return cpu->page_dealloc_contig(padr, count);
+}
+
+
+/// @brief  ページの所有者を記録する。
+/// @param[in] padr   page_alloc() で割り当てたページの先頭アドレス。
+/// @param[in] owner  ページの所有者。nullptr を指定すると記録を消す。
+cause::t page_set_owner(uptr padr, void* owner)
+{
+	page_pool** const pps = global_vars::core.page_pool_objs;
+	const u32 n = global_vars::core.page_pool_nr;
+
+	for (u32 i = 0; i < n; ++i) {
+		const cause::t r = pps[i]->set_page_owner(padr, owner);
+		if (r != cause::OUTOFRANGE)
+			return r;
+	}
+
+	return cause::OUTOFRANGE;
+}
+
+/// @brief  page_set_owner() で記録したページの所有者を返す。
+void* page_get_owner(uptr padr)
+{
+	page_pool** const pps = global_vars::core.page_pool_objs;
+	const u32 n = global_vars::core.page_pool_nr;
+
+	for (u32 i = 0; i < n; ++i) {
+		if (pps[i]->test_range(padr))
+			return pps[i]->get_page_owner(padr);
+	}
+
+	return nullptr;
+}
@@ -20,6 +20,7 @@
  */
 
 page_pool::page_pool(u32 _proximity_domain) :
+	page_owners(nullptr),
 	page_range_cnt(0),
 	proximity_domain(_proximity_domain)
 {
@@ -79,7 +80,12 @@ void page_pool::copy_range_from(const page_pool& src)
 /// @return 必要なデータエリアのサイズをバイト数で返す。
 uptr page_pool::calc_workbuf_bytes()
 {
-	return page_base[arch::page::HIGHEST].calc_buf_size(pool_bytes);
+	const uptr cell_bytes =
+	    page_base[arch::page::HIGHEST].calc_buf_size(pool_bytes);
+	const uptr owner_bytes =
+	    sizeof (void*) * up_div<uptr>(pool_bytes, arch::page::L1_SIZE);
+
+	return up_align<uptr>(cell_bytes, sizeof (void*)) + owner_bytes;
 }
 
 /// @param[in] mem_bytes 管理対象メモリの合計サイズ。
@@ -89,6 +95,18 @@ bool page_pool::init(uptr buf_bytes, void* buf)
 {
 	page_base[arch::page::HIGHEST].set_buf(buf, pool_bytes);
 
+	const uptr cell_bytes = up_align<uptr>(
+	    page_base[arch::page::HIGHEST].calc_buf_size(pool_bytes),
+	    sizeof (void*));
+	const uptr owners = up_div<uptr>(pool_bytes, arch::page::L1_SIZE);
+	if (cell_bytes + sizeof (void*) * owners > buf_bytes)
+		return false;
+
+	page_owners = reinterpret_cast<void**>(
+	    reinterpret_cast<u8*>(buf) + cell_bytes);
+	for (uptr i = 0; i < owners; ++i)
+		page_owners[i] = nullptr;
+
 	return true;
 }
 
@@ -109,7 +127,10 @@ void page_pool::build()
 cause::t page_pool::alloc(page_level level, uptr* padr)
 {
 	uptr _padr;
+
+	lock.lock();
 	const cause::t r = page_base[level].reserve_1page(&_padr);
+	lock.unlock();
 
 	*padr = _padr + adr_offset;
 	return r;
@@ -117,19 +138,200 @@ cause::t page_pool::alloc(page_level level, uptr* padr)
 
 cause::t page_pool::dealloc(page_level level, uptr padr)
 {
-	bool hit = false;
-	for (uint i = 0; i < page_range_cnt; ++i) {
-		if (page_ranges[i].test(padr)) {
-			hit = true;
+	if (!test_range(padr))
+		return cause::OUTOFRANGE;
+
+	padr -= adr_offset;
+
+	spin_lock_section _sls(lock);
+
+	return page_base[level].free_1page(padr);
+}
+
+/// @brief  まとめてページを確保する。
+/// @param[in] n       確保するページ数。
+/// @param[out] padrs  確保したページのアドレスを返す。
+/// @return 確保できたページ数を返す。
+//
+/// ロックを１回しか取らないので、CPU ごとのページキャッシュを
+/// 補充するときに使う。
+int page_pool::alloc_pages(page_level level, int n, uptr* padrs)
+{
+	spin_lock_section _sls(lock);
+
+	int i;
+	for (i = 0; i < n; ++i) {
+		uptr padr;
+		if (is_fail(page_base[level].reserve_1page(&padr)))
 			break;
+
+		padrs[i] = padr + adr_offset;
+	}
+
+	return i;
+}
+
+/// @brief  まとめてページを解放する。
+/// @param[in] n      解放するページ数。
+/// @param[in] padrs  解放するページのアドレス。全て管理範囲内であること。
+cause::t page_pool::dealloc_pages(page_level level, int n, const uptr* padrs)
+{
+	spin_lock_section _sls(lock);
+
+	for (int i = 0; i < n; ++i) {
+		const cause::t r =
+		    page_base[level].free_1page(padrs[i] - adr_offset);
+		if (is_fail(r))
+			return r;
+	}
+
+	return cause::OK;
+}
+
+/// @brief  物理的に連続した L1 ページを確保する。
+/// @param[in] count  確保する L1 ページ数。
+/// @param[in] align  先頭アドレスのアラインメント。2^n バイトで指定する。
+/// @param[out] padr  確保したメモリの先頭物理アドレスを返す。
+/// @retval cause::BADARG  count か align が大きすぎる。
+/// @retval cause::NOMEM   連続した空きメモリがない。
+//
+/// count ページを含むことができる一番小さいレベルのページをまとめて予約し、
+/// 余った部分は解放する。
+cause::t page_pool::alloc_contig(uptr count, uptr align, uptr* padr)
+{
+	const uptr bytes = count << arch::page::L1_SIZE_BITS;
+
+	if (count == 0 || (align & (align - 1)) != 0)
+		return cause::BADARG;
+
+	for (int lv = 0; lv <= arch::page::HIGHEST; ++lv) {
+		const uptr page_size = UPTR(1) << arch::page::bits_of_level(lv);
+		const sptr max_pages = page_base[lv].get_max_run_pages();
+
+		const uptr pages = up_div(bytes, page_size);
+		const uptr align_pages = max<uptr>(align / page_size, 1);
+		if (pages > uptr(max_pages) || align_pages > uptr(max_pages))
+			continue;
+
+		spin_lock_section _sls(lock);
+
+		uptr rel;
+		const cause::t r =
+		    page_base[lv].reserve_pages(pages, align_pages, &rel);
+		if (is_fail(r))
+			return r;
+
+		// 余った部分を返却する。
+		const cause::t r2 =
+		    free_range_pages(rel + bytes, rel + pages * page_size);
+		if (is_fail(r2)) {
+			log()("!!! page_pool::alloc_contig() failed. r=").u(r2)();
+			// 返却できなかった余りは諦めて、確保した分だけ戻す。
+			free_range_pages(rel, rel + bytes);
+			return r2;
 		}
+
+		*padr = rel + adr_offset;
+
+		return cause::OK;
 	}
-	if (!hit)
+
+	return cause::BADARG;
+}
+
+/// @brief  alloc_contig() で確保したメモリを解放する。
+/// @param[in] padr   解放するメモリの先頭物理アドレス。
+/// @param[in] count  解放する L1 ページ数。
+cause::t page_pool::dealloc_contig(uptr padr, uptr count)
+{
+	const uptr bytes = count << arch::page::L1_SIZE_BITS;
+
+	if (!test_range(padr) || !test_range(padr + bytes - 1))
 		return cause::OUTOFRANGE;
 
 	padr -= adr_offset;
 
-	return page_base[level].free_1page(padr);
+	spin_lock_section _sls(lock);
+
+	return free_range_pages(padr, padr + bytes);
+}
+
+/// @brief  [from, to) の範囲のページを解放する。
+/// @param[in] from  adr_offset からの相対アドレス。L1 ページ境界。
+/// @param[in] to    adr_offset からの相対アドレス。L1 ページ境界。
+//
+/// アラインメントが合っていて範囲に収まる一番大きなレベルのページ単位で
+/// 解放する。
+cause::t page_pool::free_range_pages(uptr from, uptr to)
+{
+	while (from < to) {
+		int lv;
+		uptr page_size;
+		for (lv = arch::page::HIGHEST; lv > 0; --lv) {
+			page_size = UPTR(1) << arch::page::bits_of_level(lv);
+			if ((from & (page_size - 1)) == 0 && from + page_size <= to)
+				break;
+		}
+		if (lv == 0)
+			page_size = UPTR(1) << arch::page::bits_of_level(0);
+
+		const cause::t r = page_base[lv].free_1page(from);
+		if (is_fail(r))
+			return r;
+
+		from += page_size;
+	}
+
+	return cause::OK;
+}
+
+/// @brief  padr が page_pool の管理範囲内かどうかを返す。
+bool page_pool::test_range(uptr padr)
+{
+	for (uint i = 0; i < page_range_cnt; ++i) {
+		if (page_ranges[i].test(padr))
+			return true;
+	}
+
+	return false;
+}
+
+/// @brief  ページの所有者を記録する。
+/// @param[in] padr   ページの先頭物理アドレス。
+/// @param[in] owner  ページの所有者。nullptr で記録を消す。
+/// @retval cause::OUTOFRANGE  padr が管理範囲外。
+cause::t page_pool::set_page_owner(uptr padr, void* owner)
+{
+	if (!test_range(padr))
+		return cause::OUTOFRANGE;
+
+	page_owners[owner_index(padr)] = owner;
+
+	return cause::OK;
+}
+
+/// @brief  set_page_owner() で記録したページの所有者を返す。
+/// @return padr が管理範囲外なら nullptr を返す。
+void* page_pool::get_page_owner(uptr padr)
+{
+	if (!test_range(padr))
+		return nullptr;
+
+	return page_owners[owner_index(padr)];
+}
+
+/// @brief  空きメモリのバイト数を返す。
+uptr page_pool::get_free_bytes()
+{
+	spin_lock_section _sls(lock);
+
+	uptr bytes = 0;
+	for (int i = 0; i <= arch::page::HIGHEST; ++i) {
+		bytes += page_base[i].get_free_pages() <<
+		    arch::page::bits_of_level(i);
+	}
+
+	return bytes;
 }
 
 void page_pool::dump(output_buffer& ob, uint level)
@@ -19,6 +19,8 @@
 
 #include <core/pagetbl.hh>
 
+#include <core/tlb_gather.hh>
+
 
 uptr page_size_of_level(page_level level)
 {
@@ -72,22 +74,21 @@ cause::t page_map(
 /// @brief Unset page table map.
 //
 /// @note アクティブなページテーブルを変更するときはpgtblにnullptrを
-///   指定する必要がある。pgtblがnullptrのときはTLBをクリアする。
+///   指定する必要がある。pgtblがnullptrのときは全てのCPUのTLBを
+///   クリアする。
+/// 複数のページを外すときは tlb_gather を直接使う方がよい。
 cause::t page_unmap(
     page_table* pgtbl,
     uptr vadr,
     page_level level)
 {
-	page_table* _pgtbl = pgtbl ? pgtbl : arch::page::get_table();
+	tlb_gather tg(pgtbl,
+	    pgtbl ? tlb_gather::INACTIVE : tlb_gather::ACTIVE);
 
-	cause::t r = arch::page::unmap(_pgtbl, vadr, level);
+	cause::t r = tg.unmap(vadr, level);
 
-	if (!pgtbl)
-		arch::page::clear_tlb(reinterpret_cast<void*>(vadr));
+	cause::t r2 = tg.finish();
 
-	if (!pgtbl)
-		arch::page::unget_table(_pgtbl);
-
-	return r;
+	return is_fail(r) ? r : r2;
 }
 
@@ -0,0 +1,266 @@
+/// @file   rcu.cc
+/// @brief  RCU implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/rcu.hh>
+
+#include <arch.hh>
+#include <core/cpu_node.hh>
+#include <core/message.hh>
+#include <util/atomic.hh>
+
+
+namespace {
+
+/// @brief  CPU ごとの RCU の状態。
+struct rcu_cpu_state
+{
+	/// この CPU が最後に静止状態を通過したときの rcu_epoch。
+	volatile u64 qs_epoch;
+
+	/// 停止中ならば true。
+	volatile u8  idle;
+
+	/// 猶予期間が終わるのを待って停止しているならば true。
+	volatile u8  waiting;
+
+	/// kick_msg を送って、まだ処理されていなければ true。
+	volatile u8  kick_busy;
+
+	/// wake_msg を送って、まだ処理されていなければ true。
+	volatile u8  wake_busy;
+
+	/// 静止状態を通過していないこの CPU に、message_loop() を
+	/// 1 周させるために送る。
+	message kick_msg;
+
+	/// 猶予期間が終わるのを待って停止しているこの CPU を起こす。
+	message wake_msg;
+
+	/// 猶予期間を待っている rcu_head。epoch の順に並ぶ。
+	/// この CPU だけがプリエンプション禁止状態で操作する。
+	chain<rcu_head, &rcu_head::rcu_chain_node> wait_q;
+} __attribute__((aligned(arch::CACHE_LINE_SIZE)));
+
+rcu_cpu_state rcu_cpus[CONFIG_MAX_CPUS];
+
+/// rcu_call() のたびに 1 つ進める。
+volatile u64 rcu_epoch = 1;
+
+/// @brief  rcu_epoch を 1 つ進める。
+/// @return  進めた後の rcu_epoch。
+u64 advance_epoch()
+{
+	for (;;) {
+		const u64 old = rcu_epoch;
+		if (arch::atomic_compare_exchange(old, old + 1, &rcu_epoch) ==
+		    old)
+		{
+			return old + 1;
+		}
+	}
+}
+
+/// @brief  全ての online の CPU が静止状態を通過した epoch を返す。
+u64 completed_epoch()
+{
+	u64 done = rcu_epoch;
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		if (!get_cpu_node(i)->is_online())
+			continue;
+
+		const rcu_cpu_state& st = rcu_cpus[i];
+		if (st.idle)
+			continue;
+
+		const u64 qs = st.qs_epoch;
+		if (qs < done)
+			done = qs;
+	}
+
+	return done;
+}
+
+void on_wake(message*)
+{
+	rcu_cpu_state& st = rcu_cpus[arch::get_cpu_node_id()];
+
+	arch::atomic_exchange(u8(false), &st.wake_busy);
+}
+
+/// @brief  kick_msg を処理している CPU は静止状態を通過しているので、
+///         猶予期間が終わるのを待って停止している CPU を起こす。
+//
+/// 起こされた CPU は rcu_quiescent() で猶予期間が終わったか確かめ、
+/// まだならもう一度 rcu_wait_prepare() で遅れている CPU を起こす。
+void on_kick(message*)
+{
+	const cpu_id_t self = arch::get_cpu_node_id();
+
+	// 先に kick_busy を下ろすので、この後で立った waiting は
+	// 次の kick_msg で見逃さない。
+	arch::atomic_exchange(u8(false), &rcu_cpus[self].kick_busy);
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		rcu_cpu_state& st = rcu_cpus[i];
+		if (i == self || !st.waiting)
+			continue;
+
+		if (arch::atomic_exchange(u8(true), &st.wake_busy))
+			continue;
+
+		st.wake_msg.handler = on_wake;
+		arch::post_cpu_message(&st.wake_msg, get_cpu_node(i));
+	}
+}
+
+}  // namespace
+
+
+void rcu_read_lock()
+{
+	preempt_disable();
+}
+
+void rcu_read_unlock()
+{
+	preempt_enable();
+}
+
+/// @brief  今 read 側の区間にいる CPU が全て区間を抜けたら func を
+///         呼び出す。
+//
+/// 呼び出す前に、読み手から head を含むオブジェクトが見えないように
+/// しておくこと。func は message_loop() から呼び出すので、眠っては
+/// いけない。
+void rcu_call(rcu_head* head, rcu_head::func_type func, void* arg)
+{
+	preempt_disable_section _pds;
+
+	head->func = func;
+	head->arg = arg;
+	// atomic_compare_exchange はメモリバリアにもなるので、
+	// オブジェクトを外した後で epoch が進む。
+	head->epoch = advance_epoch();
+
+	rcu_cpus[arch::get_cpu_node_id()].wait_q.push_back(head);
+}
+
+/// @brief  静止状態を通過したことを記録して、猶予期間が終わった
+///         rcu_head の関数を呼び出す。
+/// @retval true  関数を呼び出した。
+//
+/// message_loop() から割込み禁止状態で呼び出す。
+bool rcu_quiescent()
+{
+	rcu_cpu_state& st = rcu_cpus[arch::get_cpu_node_id()];
+
+	st.qs_epoch = rcu_epoch;
+
+	rcu_head* head = st.wait_q.front();
+	if (!head)
+		return false;
+
+	const u64 done = completed_epoch();
+	if (head->epoch > done)
+		return false;
+
+	do {
+		st.wait_q.pop_front();
+		head->func(head->arg);
+		head = st.wait_q.front();
+	} while (head && head->epoch <= done);
+
+	return true;
+}
+
+/// @brief  CPU を止める前に、猶予期間を待っている rcu_head があれば
+///         まだ静止状態を通過していない CPU に message_loop() を
+///         1 周させる。
+/// @retval true  止まってよい。猶予期間が終わるまでに、遅れている CPU の
+///               どれかがこの CPU を起こす。
+/// @retval false 遅れている CPU は無いので、止まらずに rcu_quiescent() を
+///               呼び出す。
+//
+/// 忙しい CPU は message_loop() へなかなか戻らないので、kick_msg を送って
+/// 戻らせる。
+/// message_loop() から割込み禁止状態で呼び出す。
+bool rcu_wait_prepare()
+{
+	const cpu_id_t self = arch::get_cpu_node_id();
+	rcu_cpu_state& st = rcu_cpus[self];
+
+	const rcu_head* head = st.wait_q.front();
+	if (!head)
+		return true;
+
+	// 遅れている CPU を調べる前に waiting を立てるので、その CPU が
+	// この後で kick_msg を処理すれば必ず起こされる。
+	arch::atomic_exchange(u8(true), &st.waiting);
+
+	bool lagging = false;
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		cpu_node* cn = get_cpu_node(i);
+		if (i == self || !cn->is_online())
+			continue;
+
+		rcu_cpu_state& x = rcu_cpus[i];
+		if (x.idle || x.qs_epoch >= head->epoch)
+			continue;
+
+		lagging = true;
+
+		if (arch::atomic_exchange(u8(true), &x.kick_busy))
+			continue;
+
+		x.kick_msg.handler = on_kick;
+		arch::post_cpu_message(&x.kick_msg, cn);
+	}
+
+	if (!lagging)
+		st.waiting = false;
+
+	return lagging;
+}
+
+/// @brief  CPU を止める前に呼び出す。
+void rcu_idle_enter()
+{
+	rcu_cpu_state& st = rcu_cpus[arch::get_cpu_node_id()];
+
+	st.qs_epoch = rcu_epoch;
+	st.idle = true;
+}
+
+/// @brief  CPU が動き出したら read 側の区間に入る前に呼び出す。
+void rcu_idle_exit()
+{
+	rcu_cpu_state& st = rcu_cpus[arch::get_cpu_node_id()];
+
+	// idle のクリアが他の CPU から見えるまで共有データを読まない
+	// ように、メモリバリアになる atomic_exchange を使う。
+	arch::atomic_exchange(u8(false), &st.idle);
+	st.qs_epoch = rcu_epoch;
+	st.waiting = false;
+}
+
@@ -0,0 +1,253 @@
+/// @file   sched_balance.cc
+/// @brief  Load balancing between cpu_node run queues.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/sched_balance.hh>
+
+#include <config.h>
+#include <core/cpu_node.hh>
+#include <core/timer.hh>
+#include <util/atomic.hh>
+
+
+/// thread を移動する方法は2通りある。
+///
+/// (1) sched_balance_idle()
+///     実行する thread が無くなった CPU が、他の CPU の ready_queue から
+///     thread を盗む。
+/// (2) sched_balance_periodic()
+///     タイマで定期的に呼び出し、一番忙しい CPU から一番暇な CPU へ
+///     thread を移す。
+///
+/// どちらも同じ proximity domain の CPU 間の移動を優先し、
+/// 別の proximity domain へはより大きな偏りがあるときだけ移動する。
+/// 最近まで実行していた thread はキャッシュに情報が残っているので移動しない。
+
+namespace {
+
+enum {
+	/// sched_balance_periodic() を呼び出す間隔(ns)。
+	BALANCE_INTERVAL_NS = 100 * 1000 * 1000,
+	/// 間隔は正確でなくてよいので、他のタイマとまとめて呼ばれてよい。
+	BALANCE_SLACK_NS = 10 * 1000 * 1000,
+
+	/// 同じ proximity domain の CPU から thread を移すのに必要な
+	/// ready thread 数の差。
+	LOCAL_IMBALANCE = 2,
+
+	/// 別の proximity domain の CPU から thread を移すのに必要な
+	/// ready thread 数の差。
+	REMOTE_IMBALANCE = 3,
+};
+
+/// 実行を止めてからこの TSC サイクル数が経つまでは移動しない。
+const u64 LOCAL_HOT_CYCLES = 500 * 1000;
+const u64 REMOTE_HOT_CYCLES = 2 * 1000 * 1000;
+
+timer_message balance_timer;
+
+/// 1 ならば balance_timer を止めている。
+u32 volatile balance_stopped;
+
+/// 1 ならば sched_balance_restart() で balance_timer を設定し直す。
+u32 volatile balance_restart;
+
+bool is_local(const cpu_node* a, const cpu_node* b)
+{
+	return a->get_proximity_domain() == b->get_proximity_domain();
+}
+
+/// @brief  src から dst へ thread を1つ移す。
+/// @retval true  移した。
+/// @retval false 移せる thread が無かった。
+bool migrate_one(cpu_node* src, cpu_node* dst)
+{
+	const u64 hot = is_local(src, dst) ? LOCAL_HOT_CYCLES : REMOTE_HOT_CYCLES;
+
+	return src->get_thread_ctl().migrate_to(&dst->get_thread_ctl(), hot);
+}
+
+/// @brief  どの CPU にも移す thread が無ければ true。
+bool is_all_idle()
+{
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		cpu_node* x = get_cpu_node(i);
+		if (x->is_online() &&
+		    x->get_thread_ctl().get_ready_cnt() >= LOCAL_IMBALANCE)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void balance_timer_handler(message*)
+{
+	sched_balance_periodic();
+
+#if CONFIG_NO_HZ
+	// 負荷分散が必要になるまで、暇な CPU をタイマで起こさない。
+	// sched_balance_wakeup() で再開する。
+	if (is_all_idle()) {
+		balance_stopped = 1;
+		return;
+	}
+#endif  // CONFIG_NO_HZ
+
+	timer_set(&balance_timer);
+}
+
+}  // namespace
+
+/// @brief  定期的な負荷分散を始める。
+//
+/// タイマが使える状態で呼び出す必要がある。
+cause::t sched_balance_setup()
+{
+	balance_timer.handler = balance_timer_handler;
+	balance_timer.nanosec_delay = BALANCE_INTERVAL_NS;
+	balance_timer.nanosec_slack = BALANCE_SLACK_NS;
+
+	return timer_set(&balance_timer);
+}
+
+/// @brief  止めていた定期的な負荷分散の再開を求める。
+//
+/// cn の ready thread が増えたときに呼び出す。
+/// balance_stopped を 1 にする直前に増えた thread は見逃すかもしれないが、
+/// そのときは sched_balance_idle() で暇な CPU が盗む。
+/// 割込みハンドラからも呼ばれるので、ロックを取る timer_set() は呼ばずに
+/// sched_balance_restart() に任せる。
+void sched_balance_wakeup(cpu_node* cn)
+{
+	if (!balance_stopped)
+		return;
+
+	if (cn->get_thread_ctl().get_ready_cnt() < LOCAL_IMBALANCE)
+		return;
+
+	if (arch::atomic_compare_exchange(U32(1), U32(0), &balance_stopped) != 1)
+		return;
+
+	balance_restart = 1;
+}
+
+/// @brief  sched_balance_wakeup() で再開を求められていれば
+///         balance_timer を設定する。
+//
+/// message_loop から呼び出す。ready thread が増えた CPU は IPI か
+/// タイマ割込みで message_thread を実行するので、そこで設定される。
+void sched_balance_restart()
+{
+	if (!balance_restart)
+		return;
+
+	if (arch::atomic_exchange(U32(0), &balance_restart) != 1)
+		return;
+
+	timer_set(&balance_timer);
+}
+
+/// @brief  実行する thread が無くなった cn へ他の CPU から thread を盗む。
+/// @retval true  thread を盗んだ。
+/// @retval false 盗める thread が無かった。
+//
+/// 同じ proximity domain の CPU を先に調べる。
+bool sched_balance_idle(cpu_node* cn)
+{
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	thread_sched::balance_stat& stat = cn->get_thread_ctl().get_balance_stat();
+
+	for (int pass = 0; pass < 2; ++pass) {
+		const bool local = pass == 0;
+
+		// cn の ready_queue は空なので、thread 数の差は victim の
+		// thread 数そのものになる。
+		cpu_node* victim = nullptr;
+		int victim_cnt = (local ? LOCAL_IMBALANCE : REMOTE_IMBALANCE) - 1;
+
+		for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+			cpu_node* x = get_cpu_node(i);
+			if (x == cn || !x->is_online() || is_local(cn, x) != local)
+				continue;
+
+			const int cnt = x->get_thread_ctl().get_ready_cnt();
+			if (cnt > victim_cnt) {
+				victim = x;
+				victim_cnt = cnt;
+			}
+		}
+
+		if (!victim)
+			continue;
+
+		stat.steal_attempt.inc();
+
+		if (migrate_one(victim, cn)) {
+			stat.steal.inc();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// @brief  一番忙しい CPU から一番暇な CPU へ thread を1つ移す。
+//
+/// 移動先の CPU が intr_wait() で止まっている場合、移した thread は
+/// 次の割込みの後で実行される。
+void sched_balance_periodic()
+{
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+
+	cpu_node* busiest = nullptr;
+	cpu_node* idlest = nullptr;
+	int busiest_cnt = 0;
+	int idlest_cnt = 0;
+
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		cpu_node* x = get_cpu_node(i);
+		if (!x->is_online())
+			continue;
+
+		const int cnt = x->get_thread_ctl().get_ready_cnt();
+
+		if (!busiest || cnt > busiest_cnt) {
+			busiest = x;
+			busiest_cnt = cnt;
+		}
+		if (!idlest || cnt < idlest_cnt) {
+			idlest = x;
+			idlest_cnt = cnt;
+		}
+	}
+
+	if (!busiest || busiest == idlest)
+		return;
+
+	const int imbalance =
+	    is_local(busiest, idlest) ? LOCAL_IMBALANCE : REMOTE_IMBALANCE;
+	if (busiest_cnt - idlest_cnt < imbalance)
+		return;
+
+	migrate_one(busiest, idlest);
+}
+
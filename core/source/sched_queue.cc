@@ -0,0 +1,157 @@
+/// @file   sched_queue.cc
+/// @brief  fair_sched_queue class implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/sched_queue.hh>
+
+
+fair_sched_queue::fair_sched_queue() :
+	root(nullptr),
+	min_vruntime(0),
+	count(0)
+{
+}
+
+void fair_sched_queue::push(thread* t)
+{
+	if (t->vruntime < min_vruntime)
+		t->vruntime = min_vruntime;
+
+	t->sched_heap_parent = nullptr;
+	t->sched_heap_left = nullptr;
+	t->sched_heap_right = nullptr;
+	t->sched_heap_npl = 0;
+	t->sched_boosted = false;
+
+	root = merge(root, t);
+	root->sched_heap_parent = nullptr;
+
+	++count;
+}
+
+thread* fair_sched_queue::pop()
+{
+	thread* t = urgent_queue.pop_front();
+	if (t) {
+		t->sched_boosted = false;
+		--count;
+		return t;
+	}
+
+	t = root;
+	if (!t)
+		return nullptr;
+
+	root = merge(t->sched_heap_left, t->sched_heap_right);
+	if (root)
+		root->sched_heap_parent = nullptr;
+
+	if (min_vruntime < t->vruntime)
+		min_vruntime = t->vruntime;
+
+	--count;
+
+	return t;
+}
+
+void fair_sched_queue::remove(thread* t)
+{
+	if (t->sched_boosted) {
+		urgent_queue.remove(t);
+		t->sched_boosted = false;
+	} else {
+		heap_remove(t);
+	}
+
+	--count;
+}
+
+void fair_sched_queue::boost(thread* t)
+{
+	if (t->sched_boosted)
+		return;
+
+	heap_remove(t);
+
+	t->sched_boosted = true;
+	urgent_queue.push_back(t);
+}
+
+/// @brief  2つの heap を1つにする。
+/// @return 新しい heap の root。root の sched_heap_parent は設定しない。
+thread* fair_sched_queue::merge(thread* a, thread* b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+
+	if (b->vruntime < a->vruntime) {
+		thread* tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	thread* r = merge(a->sched_heap_right, b);
+	r->sched_heap_parent = a;
+	a->sched_heap_right = r;
+
+	if (npl(a->sched_heap_left) < npl(a->sched_heap_right)) {
+		a->sched_heap_right = a->sched_heap_left;
+		a->sched_heap_left = r;
+	}
+
+	a->sched_heap_npl = npl(a->sched_heap_right) + 1;
+
+	return a;
+}
+
+/// @brief  heap の途中にある thread を取り除く。
+void fair_sched_queue::heap_remove(thread* t)
+{
+	thread* parent = t->sched_heap_parent;
+	thread* sub = merge(t->sched_heap_left, t->sched_heap_right);
+
+	if (sub)
+		sub->sched_heap_parent = parent;
+
+	if (!parent) {
+		root = sub;
+		return;
+	}
+
+	if (parent->sched_heap_left == t)
+		parent->sched_heap_left = sub;
+	else
+		parent->sched_heap_right = sub;
+
+	// 祖先の npl を直しながら leftist の性質を戻す。
+	for (thread* p = parent; p; p = p->sched_heap_parent) {
+		if (npl(p->sched_heap_left) < npl(p->sched_heap_right)) {
+			thread* tmp = p->sched_heap_left;
+			p->sched_heap_left = p->sched_heap_right;
+			p->sched_heap_right = tmp;
+		}
+
+		const s32 n = npl(p->sched_heap_right) + 1;
+		if (n == p->sched_heap_npl)
+			break;
+		p->sched_heap_npl = n;
+	}
+}
+
@@ -42,39 +42,65 @@ inline void local_preempt_enable()
 
 }  // namespace
 
-// spin_lock
+#ifdef KERNEL
 
-void spin_lock::lock()
+namespace {
+
+/// @brief  spin_lock を待つ CPU のキューのノード。
+struct spin_lock_qnode
 {
-	for (;;) {
-		local_preempt_disable();
+	spin_lock_qnode* volatile next;
+	volatile bool             wait;
+} __attribute__((aligned(arch::CACHE_LINE_SIZE)));
 
-		if (_try_lock())
-			break;
+enum {
+	/// 割込みの中でも spin_lock を待つことがあるので、CPU ごとに
+	/// 複数のノードを持つ。
+	QNODE_NEST = 4,
+};
 
-		local_preempt_enable();
+spin_lock_qnode qnodes[CONFIG_MAX_CPUS][QNODE_NEST];
+volatile u8 qnode_nest[CONFIG_MAX_CPUS];
 
-		arch::cpu_relax();
-	}
+inline u16 encode_tail(cpu_id cpu, int nest)
+{
+	return static_cast<u16>(((cpu + 1) << 2) | nest);
 }
 
-void spin_lock::lock_np()
+inline spin_lock_qnode* decode_tail(u16 tail)
 {
-	for (;;) {
-		if (_try_lock())
-			break;
+	return &qnodes[(tail >> 2) - 1][tail & 3];
+}
 
-		arch::cpu_relax();
-	}
+}  // namespace
+
+#endif  // KERNEL
+
+// spin_lock
+
+void spin_lock::lock()
+{
+	local_preempt_disable();
+
+	_lock_np(__builtin_return_address(0));
+}
+
+void spin_lock::lock_np()
+{
+	_lock_np(__builtin_return_address(0));
 }
 
 bool spin_lock::try_lock()
 {
+	lockstat::probe stat(__builtin_return_address(0));
+
 	local_preempt_disable();
 
-	const bool r = _try_lock();
+	const bool r = spin_lock_ops::try_lock();
 
-	if (!r)
+	if (r)
+		stat.acquired(this);
+	else
 		local_preempt_enable();
 
 	return r;
@@ -82,18 +108,100 @@ bool spin_lock::try_lock()
 
 bool spin_lock::try_lock_np()
 {
-	return _try_lock();
+	lockstat::probe stat(__builtin_return_address(0));
+
+	const bool r = spin_lock_ops::try_lock();
+
+	if (r)
+		stat.acquired(this);
+
+	return r;
 }
 
 void spin_lock::unlock()
 {
-	atom.store(UNLOCKED);
+	lockstat::released(this);
+
+	spin_lock_ops::unlock();
 
 	local_preempt_enable();
 }
 
 void spin_lock::unlock_np()
 {
-	atom.store(UNLOCKED);
+	lockstat::released(this);
+
+	spin_lock_ops::unlock();
 }
 
+/// @param[in] caller  統計情報で使うロックの取得場所。
+void spin_lock::_lock_np(const void* caller)
+{
+	lockstat::probe stat(caller);
+
+	if (!spin_lock_ops::try_lock()) {
+		stat.contend();
+		lock_queued();
+	}
+
+	stat.acquired(this);
+}
+
+/// @brief  キューに並んでロックを待つ。
+//
+/// 前の CPU からノードの wait を解除されるまで自分のノードを見て待つ。
+/// キューの先頭になったらロックが解放されるのを待ち、ロックしてから
+/// 次の CPU のノードの wait を解除する。
+/// ロックを取得したらノードは不要になるので、ノードを使うのは待って
+/// いる間だけになる。
+void spin_lock::lock_queued()
+{
+#ifdef KERNEL
+	const cpu_id cpu = arch::get_cpu_node_id();
+	const int nest = qnode_nest[cpu];
+
+	if (UNLIKELY(nest >= QNODE_NEST)) {
+		// ノードが足りないときはキューに並ばずに待つ。
+		while (!spin_lock_ops::try_lock())
+			arch::cpu_relax();
+		return;
+	}
+
+	qnode_nest[cpu] = nest + 1;
+
+	spin_lock_qnode* node = &qnodes[cpu][nest];
+	node->next = nullptr;
+	node->wait = true;
+
+	const u16 tail = encode_tail(cpu, nest);
+	const u16 prev_tail = exchange_tail(tail);
+	if (prev_tail != 0) {
+		decode_tail(prev_tail)->next = node;
+
+		while (node->wait)
+			arch::cpu_relax();
+	}
+
+	// キューの先頭になった。
+	while (spin_lock_ops::is_locked())
+		arch::cpu_relax();
+
+	if (!try_lock_and_clear_tail(tail)) {
+		// 後ろに CPU が並んでいる。
+		set_locked();
+
+		spin_lock_qnode* next;
+		while ((next = node->next) == nullptr)
+			arch::cpu_relax();
+
+		next->wait = false;
+	}
+
+	qnode_nest[cpu] = nest;
+
+#else  // KERNEL
+	while (!spin_lock_ops::try_lock())
+		arch::cpu_relax();
+
+#endif  // KERNEL
+}
@@ -26,10 +26,14 @@
 
 bool spin_rwlock::try_rlock()
 {
+	lockstat::probe stat(__builtin_return_address(0));
+
 	preempt_disable();
 
-	if (spin_rwlock_ops::try_rlock())
+	if (spin_rwlock_ops::try_rlock()) {
+		stat.acquired(nullptr);
 		return true;
+	}
 
 	preempt_enable();
 
@@ -38,10 +42,14 @@ bool spin_rwlock::try_rlock()
 
 bool spin_rwlock::try_wlock()
 {
+	lockstat::probe stat(__builtin_return_address(0));
+
 	preempt_disable();
 
-	if (spin_rwlock_ops::try_wlock())
+	if (spin_rwlock_ops::try_wlock()) {
+		stat.acquired(this);
 		return true;
+	}
 
 	preempt_enable();
 
@@ -50,50 +58,26 @@ bool spin_rwlock::try_wlock()
 
 void spin_rwlock::rlock()
 {
-	for (;;) {
-		preempt_disable();
-
-		if (arch::spin_rwlock_ops::try_rlock())
-			break;
-
-		preempt_enable();
+	preempt_disable();
 
-		arch::cpu_relax();
-	}
+	_rlock_np(__builtin_return_address(0));
 }
 
 void spin_rwlock::rlock_np()
 {
-	for (;;) {
-		if (arch::spin_rwlock_ops::try_rlock())
-			break;
-
-		arch::cpu_relax();
-	}
+	_rlock_np(__builtin_return_address(0));
 }
 
 void spin_rwlock::wlock()
 {
-	for (;;) {
-		preempt_disable();
-
-		if (arch::spin_rwlock_ops::try_wlock())
-			break;
-
-		preempt_enable();
+	preempt_disable();
 
-		arch::cpu_relax();
-	}
+	_wlock_np(__builtin_return_address(0));
 }
 
 void spin_rwlock::wlock_np()
 {
-	for (;;) {
-		if (arch::spin_rwlock_ops::try_wlock())
-			break;
-
-		arch::cpu_relax();
-	}
+	_wlock_np(__builtin_return_address(0));
 }
 
 void spin_rwlock::un_rlock()
@@ -110,6 +94,8 @@ void spin_rwlock::un_rlock_np()
 
 void spin_rwlock::un_wlock()
 {
+	lockstat::released(this);
+
 	spin_rwlock_ops::un_wlock();
 
 	preempt_enable();
@@ -117,6 +103,55 @@ void spin_rwlock::un_wlock()
 
 void spin_rwlock::un_wlock_np()
 {
+	lockstat::released(this);
+
 	spin_rwlock_ops::un_wlock();
 }
 
+/// writer がロックしているか待っていれば wait_lock に並ぶ。
+/// wait_lock を取ったら reader の数を増やして、writer のロックが
+/// 解放されるのを待つ。
+/// reader は複数で保持するので保持時間は記録しない。
+void spin_rwlock::_rlock_np(const void* caller)
+{
+	lockstat::probe stat(caller);
+
+	if (!spin_rwlock_ops::try_rlock()) {
+		stat.contend();
+
+		wait_lock.lock_np();
+
+		add_reader();
+
+		while (is_wlocked())
+			arch::cpu_relax();
+
+		wait_lock.unlock_np();
+	}
+
+	stat.acquired(nullptr);
+}
+
+/// wait_lock を取ったら WWAITING を立てて新しい reader を止め、
+/// reader がいなくなるのを待つ。
+void spin_rwlock::_wlock_np(const void* caller)
+{
+	lockstat::probe stat(caller);
+
+	if (!spin_rwlock_ops::try_wlock()) {
+		stat.contend();
+
+		wait_lock.lock_np();
+
+		if (!spin_rwlock_ops::try_wlock()) {
+			set_wwaiting();
+
+			while (!try_wlock_waiting())
+				arch::cpu_relax();
+		}
+
+		wait_lock.unlock_np();
+	}
+
+	stat.acquired(this);
+}
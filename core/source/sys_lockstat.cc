@@ -0,0 +1,53 @@
+/// @file   sys_lockstat.cc
+/// @brief  Lock statistics system calls.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/sys_lockstat.hh>
+
+#include <core/lockstat.hh>
+#include <core/output_buffer.hh>
+#include <core/process.hh>
+
+
+namespace uniqos {
+
+/// @brief  spin_lock の統計情報を iod に書き込む。
+/// @retval cause::NOFUNC  CONFIG_LOCKSTAT が無効。
+cause::pair<ucpu> sys_lockstat(
+    int iod)
+{
+    auto _desc = get_current_process()->get_io_desc(iod);
+    if (is_fail(_desc))
+        return zero_pair(_desc.cause());
+
+    io_desc* desc = _desc.value();
+
+    output_buffer ob(desc->io, desc->off);
+
+    cause::t r = lockstat_dump(ob);
+    if (is_ok(r))
+        r = ob.flush();
+
+    const ucpu bytes = ob.get_offset() - desc->off;
+    desc->off = ob.get_offset();
+
+    return cause::pair<ucpu>(r, bytes);
+}
+
+}  // namespace uniqos
+
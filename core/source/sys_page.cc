@@ -0,0 +1,62 @@
+/// @file   sys_page.cc
+/// @brief  Physical page system calls.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/sys_page.hh>
+
+#include <core/cpu_node.hh>
+#include <core/global_vars.hh>
+#include <core/page_pool.hh>
+
+
+namespace uniqos {
+
+/// @brief  page_pool の統計情報を返す。
+/// @param[in]  index  page_pool のインデックス。
+/// @param[out] stat   統計情報を返す。
+/// @return  page_pool の数を返す。
+//
+/// CPU ごとに数えている割り当て回数を page_pool ごとに集計する。
+cause::pair<ucpu> sys_page_stat(
+    u32 index,
+    page_pool_stat* stat)
+{
+    const u32 pp_nr = global_vars::core.page_pool_nr;
+    if (index >= pp_nr)
+        return zero_pair(cause::OUTOFRANGE);
+
+    page_pool* pp = global_vars::core.page_pool_objs[index];
+
+    stat->proximity_domain = pp->get_proximity_domain();
+    stat->reserved = 0;
+    stat->free_bytes = pp->get_free_bytes();
+    stat->alloc_cnt = 0;
+    stat->remote_alloc_cnt = 0;
+
+    const cpu_id_t cpu_nr = get_cpu_node_count();
+    for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+        const cpu_node* cn = get_cpu_node(i);
+
+        stat->alloc_cnt += cn->get_page_alloc_cnt(pp);
+        stat->remote_alloc_cnt += cn->get_remote_page_alloc_cnt(pp);
+    }
+
+    return cause::pair<ucpu>(cause::OK, pp_nr);
+}
+
+}  // namespace uniqos
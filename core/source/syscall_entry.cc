@@ -20,9 +20,18 @@
 #include <core/syscall_wrap.hh>
 #include <core/syscall_nr.hh>
 
+#include <arch.hh>
+#include <config.h>
+#include <core/cpu_node.hh>
+#include <core/fs_page_cache.hh>
 #include <core/global_vars.hh>
 #include <core/new_ops.hh>
 #include <core/sys_fs.hh>
+#include <core/sys_lockstat.hh>
+#include <core/sys_page.hh>
+#include <core/sys_syscall.hh>
+#include <util/bitops.hh>
+#include <util/string.hh>
 
 
 namespace uniqos {
@@ -32,9 +41,24 @@ using syscall_func = cause::pair<ucpu> (*)(const ucpu[6]);
 class syscall_ctl
 {
 public:
-    void init();
+    cause::t init();
+
+    cause::pair<ucpu> call(ucpu nr, const ucpu args[6]);
+    void get_stat(u32 nr, syscall_stat* stat) const;
 
     static const syscall_func map[SYSCALL_NR];
+
+private:
+    void account(ucpu nr, u64 cycles);
+
+private:
+    /// 他の CPU と同じキャッシュラインを書き換えないように、
+    /// 統計情報は CPU ごとに確保する。
+    struct cpu_stat
+    {
+        syscall_stat stats[SYSCALL_NR];
+    };
+    cpu_stat* cpu_stats[CONFIG_MAX_CPUS];
 };
 
 const syscall_func syscall_ctl::map[] = {
@@ -60,10 +84,100 @@ const syscall_func syscall_ctl::map[] = {
 [SYSCALL_MOUNT] = syscall_wrap5<
     const char*, const char*, const char*, u32, const void*, sys_mount>,
 
+[SYSCALL_PAGE_STAT] = syscall_wrap2<
+    u32, page_pool_stat*, sys_page_stat>,
+
+[SYSCALL_LOCKSTAT] = syscall_wrap1<
+    int, sys_lockstat>,
+
+[SYSCALL_SYSCALL_STAT] = syscall_wrap2<
+    u32, syscall_stat*, sys_syscall_stat>,
+
+[SYSCALL_BATCH] = syscall_wrap2<
+    syscall_batch_entry*, uptr, sys_batch>,
+
+[SYSCALL_PAGE_CACHE_STAT] = syscall_wrap1<
+    fs_page_cache_stat*, sys_page_cache_stat>,
+
 };
 
-void syscall_ctl::init()
+cause::t syscall_ctl::init()
+{
+    for (auto& cs : cpu_stats)
+        cs = nullptr;
+
+    const cpu_id_t cpu_nr = get_cpu_node_count();
+    for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+        cpu_stat* cs = new (generic_mem()) cpu_stat;
+        if (!cs)
+            return cause::NOMEM;
+
+        mem_fill(0, cs, sizeof *cs);
+
+        cpu_stats[i] = cs;
+    }
+
+    return cause::OK;
+}
+
+/// @brief  システムコール nr を実行する。
+cause::pair<ucpu> syscall_ctl::call(ucpu nr, const ucpu args[6])
 {
+    if (nr >= SYSCALL_NR || !map[nr])
+        return zero_pair(cause::NOFUNC);
+
+#if CONFIG_SYSCALL_STAT
+    const u64 start = arch::read_tsc();
+
+    const cause::pair<ucpu> r = map[nr](args);
+
+    account(nr, arch::read_tsc() - start);
+
+    return r;
+
+#else  // CONFIG_SYSCALL_STAT
+    return map[nr](args);
+
+#endif  // CONFIG_SYSCALL_STAT
+}
+
+/// @brief  全ての CPU の nr の統計情報を合計する。
+void syscall_ctl::get_stat(u32 nr, syscall_stat* stat) const
+{
+    mem_fill(0, stat, sizeof *stat);
+
+    const cpu_id_t cpu_nr = get_cpu_node_count();
+    for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+        const cpu_stat* cs = cpu_stats[i];
+        if (!cs)
+            continue;
+
+        const syscall_stat& st = cs->stats[nr];
+        stat->call_cnt += st.call_cnt;
+        stat->total_cycles += st.total_cycles;
+        for (int j = 0; j < syscall_stat::HIST_NR; ++j)
+            stat->cycles_hist[j] += st.cycles_hist[j];
+    }
+}
+
+/// @brief  nr の呼び出しを実行した CPU の統計情報に加える。
+void syscall_ctl::account(ucpu nr, u64 cycles)
+{
+    // 加える途中で他の CPU へ移動しないようにする。
+    preempt_disable_section _pds;
+
+    cpu_stat* cs = cpu_stats[arch::get_cpu_node_id()];
+    if (!cs)
+        return;
+
+    int hist = cycles > 1 ? find_last_setbit(cycles) : 0;
+    if (hist >= syscall_stat::HIST_NR)
+        hist = syscall_stat::HIST_NR - 1;
+
+    syscall_stat& st = cs->stats[nr];
+    ++st.call_cnt;
+    st.total_cycles += cycles;
+    ++st.cycles_hist[hist];
 }
 
 cause::t syscall_setup()
@@ -72,7 +186,9 @@ cause::t syscall_setup()
     if (!ctl)
         return cause::NOMEM;
 
-    ctl->init();
+    cause::t r = ctl->init();
+    if (is_fail(r))
+        return r;
 
     global_vars::core.syscall_ctl_obj = ctl;
 
@@ -86,7 +202,57 @@ syscall_ctl* get_syscall_ctl()
 
 cause::pair<uptr> core_syscall_entry(const ucpu* data)
 {
-    return get_syscall_ctl()->map[data[0]](data + 1);
+    return get_syscall_ctl()->call(data[0], data + 1);
+}
+
+/// @brief  システムコールの統計情報を返す。
+/// @param[in]  nr    システムコール番号。
+/// @param[out] stat  統計情報を返す。
+/// @return  システムコールの数を返す。
+cause::pair<ucpu> sys_syscall_stat(
+    u32 nr,
+    syscall_stat* stat)
+{
+    if (nr >= SYSCALL_NR)
+        return zero_pair(cause::OUTOFRANGE);
+
+    get_syscall_ctl()->get_stat(nr, stat);
+
+    return cause::pair<ucpu>(cause::OK, SYSCALL_NR);
+}
+
+/// @brief  entries のシステムコールを順に実行する。
+/// @param[in,out] entries  実行するシステムコール。
+///                         結果は ret_cause と ret_value に返す。
+/// @param[in]     count    entries の数。
+/// @return  実行したシステムコールの数を返す。
+//
+/// 1 回のカーネルへの移行で複数のシステムコールを実行する。
+/// 失敗したシステムコールがあれば、そこで止める。
+/// sys_batch() を入れ子に呼び出すことはできない。
+cause::pair<ucpu> sys_batch(
+    syscall_batch_entry* entries,
+    uptr count)
+{
+    syscall_ctl* ctl = get_syscall_ctl();
+
+    for (uptr i = 0; i < count; ++i) {
+        syscall_batch_entry* e = &entries[i];
+
+        cause::pair<ucpu> r;
+        if (e->nr == SYSCALL_BATCH)
+            r = zero_pair(cause::BADARG);
+        else
+            r = ctl->call(e->nr, e->args);
+
+        e->ret_cause = r.cause();
+        e->ret_value = r.value();
+
+        if (is_fail(r))
+            return cause::pair<ucpu>(cause::OK, i + 1);
+    }
+
+    return cause::pair<ucpu>(cause::OK, count);
 }
 
 }  // namespace uniqos
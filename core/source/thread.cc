@@ -25,7 +25,20 @@ thread::thread(thread_id tid) :
 	owner_cpu(nullptr),
 	id(tid),
 	state(SLEEPING),
-	anti_sleep(false)
+	anti_sleep(false),
+	sched_urgent(false),
+	sched_pinned(false),
+	sched_on_cpu(false),
+	sched_weight(SCHED_WEIGHT_DEFAULT),
+	vruntime(0),
+	exec_tsc(0),
+	exec_start_tsc(0),
+	sched_last_tsc(0),
+	sched_heap_parent(nullptr),
+	sched_heap_left(nullptr),
+	sched_heap_right(nullptr),
+	sched_heap_npl(0),
+	sched_boosted(false)
 {
 }
 
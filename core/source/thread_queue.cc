@@ -39,6 +39,10 @@ thread_sched::thread_sched(cpu_node* _owner_cpu) :
 	owner_cpu(_owner_cpu),
 	running_thread(0)
 {
+	bal_stat.steal_attempt.store(0);
+	bal_stat.steal.store(0);
+	bal_stat.migrate_in.store(0);
+	bal_stat.migrate_out.store(0);
 }
 
 void thread_sched::init()
@@ -47,7 +51,7 @@ void thread_sched::init()
 
 cause::pair<thread*> thread_sched::start()
 {
-	running_thread = ready_queue.pop_front();
+	switch_running_thread(ready_queue.pop());
 
 	if (running_thread)
 		return make_pair(cause::OK, running_thread);
@@ -64,7 +68,7 @@ cause::t thread_sched::attach_boot_thread(thread* t)
 	t->owner_cpu = owner_cpu;
 	t->state = thread::READY;
 
-	running_thread = t;
+	switch_running_thread(t);
 
 	return cause::OK;
 }
@@ -79,21 +83,26 @@ void thread_sched::attach(thread* t)
 	if (t->state == thread::SLEEPING)
 		sleeping_queue.push_back(t);
 	else
-		ready_queue.push_back(t);
+		ready_queue.push(t);
 
 	thread_state_lock.un_wlock();
 }
 
-void thread_sched::detach(thread* t)
+/// @retval cause::OK              Succeeded.
+/// @retval cause::INVALID_OBJECT  t は migrate_to() で他の CPU へ移った。
+cause::t thread_sched::detach(thread* t)
 {
-	thread_state_lock.wlock();
+	spin_wlock_section _tsl_sec(thread_state_lock);
+
+	if (t->owner_cpu != owner_cpu)
+		return cause::INVALID_OBJECT;
 
 	if (t->state == thread::SLEEPING)
 		sleeping_queue.remove(t);
 	else
 		ready_queue.remove(t);
 
-	thread_state_lock.un_wlock();
+	return cause::OK;
 }
 
 /// @brief Make current running thread sleeping.
@@ -114,22 +123,26 @@ thread* thread_sched::sleep_current_thread_np()
 		sleeping_queue.push_back(prev_run);
 	}
 
-	running_thread = ready_queue.pop_front();
+	switch_running_thread(ready_queue.pop());
 	// message_thread が常に READY なので 0 にならない。
 
 	return running_thread;
 }
 
-void thread_sched::ready(thread* t)
+/// @retval cause::OK              t を ready_queue に入れた。
+/// @retval cause::EXIST           t はすでに READY だった。
+/// @retval cause::INVALID_OBJECT  t は migrate_to() で他の CPU へ移った。
+///                                t->get_owner_cpu() でやり直す。
+cause::t thread_sched::ready(thread* t)
 {
 	preempt_disable_section _pds;
 
-	_ready(t);
+	return _ready(t);
 }
 
-void thread_sched::ready_np(thread* t)
+cause::t thread_sched::ready_np(thread* t)
 {
-	_ready(t);
+	return _ready(t);
 }
 
 /// @brief  Change running thread ptr.
@@ -155,10 +168,14 @@ void thread_sched::set_running_thread(thread* t)
 
 	spin_wlock_section_np _tsl_sec(thread_state_lock);
 
-	ready_queue.push_back(running_thread);
+	if (t == running_thread)
+		return;
 
 	ready_queue.remove(t);
-	running_thread = t;
+	thread* prev_run = running_thread;
+	switch_running_thread(t);
+
+	ready_queue.push(prev_run);
 }
 
 /// @brief  Change running thread ptr to next thread.
@@ -170,13 +187,14 @@ thread* thread_sched::switch_next_thread()
 {
 	spin_wlock_section_np _swl_sec(thread_state_lock);
 
-	thread* next_thr = ready_queue.pop_front();
+	thread* next_thr = ready_queue.pop();
 	if (!next_thr)
 		return 0;
 
-	ready_queue.push_back(running_thread);
+	thread* prev_run = running_thread;
+	switch_running_thread(next_thr);
 
-	running_thread = next_thr;
+	ready_queue.push(prev_run);
 
 	return next_thr;
 }
@@ -189,7 +207,7 @@ thread* thread_sched::exit_thread(thread* t)
 
 	if (t->state == thread::READY) {
 		if (t == running_thread)
-			running_thread = ready_queue.pop_front();
+			switch_running_thread(ready_queue.pop());
 		else
 			ready_queue.remove(t);
 	} else {
@@ -199,20 +217,110 @@ thread* thread_sched::exit_thread(thread* t)
 	return running_thread;
 }
 
+/// @brief  他の CPU へ移動できる thread を ready_queue から1つ dst へ移す。
+/// @param[in] dst         移動先の thread_sched。
+/// @param[in] hot_cycles  実行を止めてからこの TSC サイクル数が
+///                        経っていない thread はキャッシュに情報が
+///                        残っているとみなして移動しない。
+/// @retval true  移した。
+/// @retval false 移せる thread が無かった。
+//
+/// 両方の thread_state_lock を cpu_node の ID の順に取ってから移す。
+/// ready_queue に入っていても、切り替えた CPU がまだコンテキストを
+/// 保存し終えていない thread は移さない。
+/// thread がどちらの ready_queue にも無い状態や、owner_cpu と入って
+/// いる ready_queue が食い違う状態は他の CPU から見えない。
+bool thread_sched::migrate_to(thread_sched* dst, u64 hot_cycles)
+{
+	spin_rwlock* first = &thread_state_lock;
+	spin_rwlock* second = &dst->thread_state_lock;
+	if (dst->owner_cpu->get_cpu_node_id() < owner_cpu->get_cpu_node_id()) {
+		first = &dst->thread_state_lock;
+		second = &thread_state_lock;
+	}
+
+	spin_wlock_section _tsl_sec1(first);
+	spin_wlock_section_np _tsl_sec2(second);
+
+	const u64 now = arch::read_tsc();
+
+	thread* t = ready_queue.find([now, hot_cycles](thread* x) {
+		return !x->sched_pinned &&
+		       !x->sched_urgent &&
+		       !x->sched_on_cpu &&
+		       now - x->sched_last_tsc >= hot_cycles;
+	});
+	if (!t)
+		return false;
+
+	ready_queue.remove(t);
+
+	// vruntime を移動先の ready_queue に合わせる。
+	const u64 min_vr = ready_queue.get_min_vruntime();
+	t->vruntime = t->vruntime > min_vr ? t->vruntime - min_vr : 0;
+	t->vruntime += dst->ready_queue.get_min_vruntime();
+
+	t->owner_cpu_node_id = dst->owner_cpu->get_cpu_node_id();
+	t->owner_cpu = dst->owner_cpu;
+
+	dst->ready_queue.push(t);
+
+	bal_stat.migrate_out.inc();
+	dst->bal_stat.migrate_in.inc();
+
+	return true;
+}
+
 /// @brief Make thread ready.
-void thread_sched::_ready(thread* t)
+cause::t thread_sched::_ready(thread* t)
 {
 	spin_wlock_section_np _tsl_sec(thread_state_lock);
 
+	if (t->owner_cpu != owner_cpu)
+		return cause::INVALID_OBJECT;
+
 	if (t->state == thread::SLEEPING) {
 		sleeping_queue.remove(t);
-		ready_queue.push_back(t);
+		ready_queue.push(t);
 		t->state = thread::READY;
+		if (t->sched_urgent)
+			ready_queue.boost(t);
+		return cause::OK;
 	} else {
 		t->anti_sleep = true;
+		if (t->sched_urgent && t != running_thread)
+			ready_queue.boost(t);
+		return cause::EXIST;
 	}
 }
 
+/// @brief  running_thread を t に変える。
+//
+/// それまでの running_thread の実行時間を vruntime に加算する。
+/// t は nullptr でもよい。
+/// t の sched_on_cpu を true にする。それまでの running_thread の
+/// sched_on_cpu は、コンテキストを保存した後で呼び出し元が false にする。
+void thread_sched::switch_running_thread(thread* t)
+{
+	const u64 now = arch::read_tsc();
+
+	thread* prev = running_thread;
+	if (prev) {
+		const u64 delta = now - prev->exec_start_tsc;
+		prev->exec_tsc += delta;
+		prev->vruntime +=
+		    delta * thread::SCHED_WEIGHT_DEFAULT / prev->sched_weight;
+		prev->sched_last_tsc = now;
+	}
+
+	if (t) {
+		t->exec_start_tsc = now;
+		t->sched_on_cpu = true;
+	}
+
+	running_thread = t;
+}
+
 #include <core/log.hh>
 void thread_sched::dump()
 {
@@ -225,12 +333,13 @@ void thread_sched::dump()
 		log(1)(" ")(i);
 	}
 	log(1)()("ready:");
-	for(auto i = ready_queue.front();
-            i;
-	    i = ready_queue.next(i))
-	{
-		log(1)(" ")(i);
-	}
+	ready_queue.for_each([](thread* i) {
+		log(1)(" ")(i)('/').u(i->get_vruntime());
+	});
+	log(1)()("steal=").u(bal_stat.steal.load())('/').
+	    u(bal_stat.steal_attempt.load())
+	    (" migrate_in=").u(bal_stat.migrate_in.load())
+	    (" migrate_out=").u(bal_stat.migrate_out.load());
 	log(1)()("--- thread_sched dump end ---")();
 }
 
@@ -30,17 +30,26 @@
 
 
 cause::t hpet_setup(clock_source** clksrc);
+cause::t tsc_clock_setup(clock_source* ref, clock_source** clksrc);
 
 namespace {
 
+/// Invariant TSC が使えれば HPET で較正して TSC を使う。
+/// 使えなければ HPET を使う。
 cause::t detect_clock_src(clock_source** clksrc)
 {
 	cause::t r;
 
 #if CONFIG_HPET
 	r = hpet_setup(clksrc);
-	if (is_ok(r))
+	if (is_ok(r)) {
+# if CONFIG_TSC_CLOCK
+		cause::t r2 = tsc_clock_setup(*clksrc, clksrc);
+		if (is_fail(r2))
+			log()("TSC clock is not available. r=").u(r2)();
+# endif  // CONFIG_TSC_CLOCK
 		return r;
+	}
 
 #endif  // CONFIG_HPET
 
@@ -61,14 +70,22 @@ void timer_store::operations::init()
 {
 	Set = 0;
 	NextClock = 0;
+	Post = 0;
+	Remove = 0;
 }
 
 // time_ctl
 
 timer_ctl::timer_ctl()
 {
-	timer_msg.handler = _on_timer_message;
-	timer_msg.data = this;
+	for (auto& ev : events) {
+		ev.msg.handler = _on_timer_message;
+		ev.msg.data = this;
+		ev.programmed = false;
+	}
+
+	for (auto& store : stores)
+		store = nullptr;
 }
 
 void timer_ctl::set_clock_source(clock_source* cs)
@@ -79,9 +96,17 @@ void timer_ctl::set_clock_source(clock_source* cs)
 	auto r = clk_src->update_clock();
 }
 
+/// @brief  全ての CPU で tq を共有する。
 void timer_ctl::set_store(timer_store* tq)
 {
-	store = tq;
+	for (auto& store : stores)
+		store = tq;
+}
+
+/// @brief  cpu が set_timer() したタイマを tq に入れる。
+void timer_ctl::set_cpu_store(cpu_id_t cpu, timer_store* tq)
+{
+	stores[cpu] = tq;
 }
 
 cause::t timer_ctl::get_jiffy_tick(tick_time* tick)
@@ -94,72 +119,309 @@ cause::t timer_ctl::get_jiffy_tick(tick_time* tick)
 	return cause::OK;
 }
 
+/// @brief  nanosec ナノ秒の間、割込みを使わずに待つ。
+//
+/// AP の起動のように、タイマ割込みを待てない場合に使う。
+void timer_ctl::busy_wait(u64 nanosec)
+{
+	auto now_clk = clk_src->update_clock();
+	if (is_fail(now_clk)) {
+		log()("!!! timer_ctl::busy_wait() failed. r=")
+		    .u(now_clk.cause())();
+		return;
+	}
+
+	auto delay_clk = clk_src->nanosec_to_clock(nanosec);
+	if (is_fail(delay_clk)) {
+		log()("!!! timer_ctl::busy_wait() failed. r=")
+		    .u(delay_clk.cause())();
+		return;
+	}
+
+	const tick_time exp_clk = now_clk.value() + delay_clk.value();
+
+	for (;;) {
+		auto clk = clk_src->update_clock();
+		if (is_fail(clk) || clk.value() >= exp_clk)
+			break;
+
+		arch::cpu_relax();
+	}
+}
+
+/// @brief  msg->nanosec_delay 後に msg を送る。
+//
+/// タイマは呼び出した CPU の store に入れるので、他の CPU と
+/// timer_ctl::lock を取り合うのは clk_src の設定を変えるときだけになる。
+/// clk_src が CPU ごとのタイマを持つときは、この CPU のタイマを設定するので
+/// timer_ctl::lock も取らない。
 cause::t timer_ctl::set_timer(timer_message* msg)
 {
 	// 現在時刻
-#	warning error check omitted.
 	auto now_clk = clk_src->update_clock();
+	if (is_fail(now_clk))
+		return now_clk.cause();
 
 	// どれだけ待つか
-#	warning error check omitted.
 	auto delay_clk = clk_src->nanosec_to_clock(msg->nanosec_delay);
+	if (is_fail(delay_clk))
+		return delay_clk.cause();
 
 	// いつまで待つか
 	tick_time exp_clk = now_clk.value() + delay_clk.value();
 
+	// どこまで遅らせてよいか
+	auto slack_clk = clk_src->nanosec_to_clock(msg->nanosec_slack);
+	if (is_fail(slack_clk))
+		return slack_clk.cause();
+
 	msg->expires_clock = exp_clk;
+	msg->latest_clock = exp_clk + slack_clk.value();
 
-	lock.lock();
+	// store を選んでからタイマを設定するまで他の CPU へ移動しない。
+	preempt_disable_section _pds;
 
-	// TODO:ここでOUTOFRANGEが帰らないようにする
-	const cause::t r = _set_timer(msg, now_clk.value());
+	const cpu_id_t cpu = arch::get_cpu_node_id();
+	timer_store* store = stores[cpu];
 
-	lock.unlock();
+	bool earliest;
+	{
+		spin_lock_section _sls(store->lock);
 
-	return r;
+		earliest = store->set(msg);
+		msg->armed_store = store;
+	}
+
+	if (!earliest)
+		return cause::OK;
+
+	// on_cpu_timer_message() はこの CPU の message_loop で動くので、
+	// プリエンプション禁止の間は競合しない。タイマ割込みとの競合は
+	// clk_src の SetTimer が割込みを禁止して避ける。
+	if (clk_src->is_per_cpu_timer())
+		return arm_timer(get_event(cpu), msg->latest_clock);
+
+	spin_lock_section _sls(lock);
+
+	return arm_timer(get_event(cpu), msg->latest_clock);
+}
+
+/// @brief  set_timer() したタイマを取り消す。
+/// @retval cause::OK     取り消した。
+/// @retval cause::NOENT  タイマは設定されていないか、既に満了した。
+//
+/// clk_src のタイマは設定し直さない。取り消したタイマの時刻に
+/// on_timer_message() が呼ばれても、次のタイマを設定し直すだけになる。
+cause::t timer_ctl::cancel_timer(timer_message* msg)
+{
+	for (;;) {
+		timer_store* store = msg->armed_store;
+		if (!store)
+			return cause::NOENT;
+
+		spin_lock_section _sls(store->lock);
+
+		// lock を取る間に満了したか、設定し直された。
+		if (msg->armed_store != store)
+			continue;
+
+		store->remove(msg);
+		msg->armed_store = nullptr;
+
+		return cause::OK;
+	}
+}
+
+/// @brief  タイマを nanosec_delay 後に設定し直す。
+//
+/// 設定されていなければ新しく設定する。
+/// 満了して送られたが、まだ handler が呼ばれていない msg を設定し直しては
+/// ならない。
+cause::t timer_ctl::mod_timer(timer_message* msg, u64 nanosec_delay)
+{
+	cancel_timer(msg);
+
+	msg->nanosec_delay = nanosec_delay;
+
+	return set_timer(msg);
 }
 
+/// @brief  clk_src のタイマが満了したときに呼ばれる。
 void timer_ctl::on_timer_message()
 {
-	lock.lock();
+	if (clk_src->is_per_cpu_timer())
+		on_cpu_timer_message(arch::get_cpu_node_id());
+	else
+		on_global_timer_message();
+}
+
+/// @brief  clk_src のタイマを clock までに満了させる。
+//
+/// 設定済みの時刻が clock までならば、その時刻に一緒に送られる。
+/// ev が events[0] ならば lock を取って呼び出す必要がある。
+cause::t timer_ctl::arm_timer(timer_event* ev, tick_time clock)
+{
+	if (ev->programmed && ev->programmed_clock <= clock)
+		return cause::OK;
+
+	// TODO:ここでOUTOFRANGEが帰らないようにする
+	return program_timer(ev, clock);
+}
+
+/// @brief  全ての CPU で共有するタイマが満了したときの処理。
+//
+/// 全ての store から満了したタイマを送り、一番早いタイマの時刻を
+/// clk_src に設定する。
+/// store を調べている間に set_timer() されたタイマを取りこぼさないように、
+/// 先に programmed を外しておく。
+void timer_ctl::on_global_timer_message()
+{
+	timer_event* ev = &events[0];
+
+	{
+		spin_lock_section _sls(lock);
+		ev->programmed = false;
+	}
 
 #	warning error check omitted.
 	clk_src->update_clock();
 
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+
 	for (;;) {
 		tick_time now_clock = clk_src->get_latest_clock(); 
 
-		store->post(now_clock);
+		bool found = false;
+		tick_time next_clock;
 
-		//TODO:すでにタイマー設定済みの場合は、再設定の動作にする
-
-		auto next_clock = store->next_clock();
-		if (is_ok(next_clock)) {
-			const cause::t r =
-			    clk_src->set_timer(next_clock.value(), &timer_msg);
-			if (r == cause::OUTOFRANGE)
+		for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+			timer_store* store = stores[i];
+			if (!store || (i > 0 && store == stores[i - 1]))
 				continue;
+
+			spin_lock_section _sls(store->lock);
+
+			store->post(now_clock);
+
+			auto r = store->next_clock();
+			if (is_ok(r) && (!found || r.value() < next_clock)) {
+				next_clock = r.value();
+				found = true;
+			}
+		}
+
+		if (!found)
+			break;
+
+		spin_lock_section _sls(lock);
+
+		if (arm_timer(ev, next_clock) == cause::OUTOFRANGE)
+			continue;
+
+		break;
+	}
+}
+
+/// @brief  cpu のタイマが満了したときの処理。
+//
+/// cpu の store だけを調べて、cpu のタイマを設定し直す。
+/// message の handler は割込み禁止で呼ばれるので、cpu の set_timer() とは
+/// 競合しない。
+void timer_ctl::on_cpu_timer_message(cpu_id_t cpu)
+{
+	timer_event* ev = get_event(cpu);
+	ev->programmed = false;
+
+	timer_store* store = stores[cpu];
+	if (!store)
+		return;
+
+	for (;;) {
+		auto now_clock = clk_src->update_clock();
+		if (is_fail(now_clock)) {
+			log()("!!! timer_ctl::on_cpu_timer_message() failed. r=")
+			    .u(now_clock.cause())();
+			break;
+		}
+
+		cause::pair<tick_time> next_clock;
+		{
+			spin_lock_section _sls(store->lock);
+
+			store->post(now_clock.value());
+			next_clock = store->next_clock();
 		}
 
+		if (is_fail(next_clock))
+			break;
+
+		if (arm_timer(ev, next_clock.value()) == cause::OUTOFRANGE)
+			continue;
+
 		break;
 	}
+}
+
+/// @brief  CPU が割込みを待つ前に呼ぶ。
+/// @retval true  満了したタイマを送ったので、割込みを待たずに処理する。
+//
+/// clk_src が CPU ごとのタイマを持つときは、cpu の store の一番早い
+/// タイマの時刻に cpu のタイマを設定し直す。cancel_timer() したタイマの
+/// 時刻に起きることが無くなり、次のタイマまで割込みが入らない。
+/// 全ての CPU で共有するタイマは、常に一番早いタイマの時刻に設定して
+/// あるので何もしない。
+/// 割込み禁止状態で呼び出す必要がある。
+bool timer_ctl::idle_enter(cpu_id_t cpu)
+{
+	if (!clk_src->is_per_cpu_timer())
+		return false;
+
+	timer_store* store = stores[cpu];
+	if (!store)
+		return false;
+
+	cause::pair<tick_time> r;
+	{
+		spin_lock_section _sls(store->lock);
+
+		r = store->next_clock();
+	}
+
+	if (is_fail(r))
+		return false;
+
+	timer_event* ev = get_event(cpu);
+	tick_time next_clock = r.value();
+	if (ev->programmed &&
+	    static_cast<tick_int>(ev->programmed_clock) ==
+	    static_cast<tick_int>(next_clock))
+	{
+		return false;
+	}
 
-	lock.unlock();
+	if (program_timer(ev, next_clock) != cause::OUTOFRANGE)
+		return false;
+
+	on_cpu_timer_message(cpu);
+
+	return true;
 }
 
-/// @brief 現在時刻を now_clock と仮定してタイマをセットする。
+/// @brief  clk_src のタイマを clock に設定する。
 //
-/// msg->ticks ではなく msg->expires_clock をタイマの時刻とする。
-/// ロックしない。
-cause::t timer_ctl::_set_timer(timer_message* msg, tick_time now_clock)
+/// ev が events[0] ならば lock を取って呼び出す必要がある。
+cause::t timer_ctl::program_timer(timer_event* ev, tick_time clock)
 {
-	if (store->set(msg)) {
-		//TODO:すでにタイマー設定済みの場合は、再設定の動作にする
+	const cause::t r = clk_src->set_timer(clock, &ev->msg);
 
-		return clk_src->set_timer(msg->expires_clock, &timer_msg);
+	if (r == cause::OUTOFRANGE) {
+		ev->programmed = false;
+	} else {
+		ev->programmed = true;
+		ev->programmed_clock = clock;
 	}
 
-	return cause::OK;
+	return r;
 }
 
 void timer_ctl::dump(output_buffer& ob)
@@ -167,6 +429,70 @@ void timer_ctl::dump(output_buffer& ob)
 }
 
 #include <core/timer_liner_q.hh>
+#include <core/timer_wheel.hh>
+
+namespace {
+
+#if CONFIG_TIMER_WHEEL
+
+/// timer_wheel_store の 1 granule を 1us 程度にする。
+cause::t setup_wheel_stores(timer_ctl* tc, clock_source* clksrc)
+{
+	timer_wheel_store::setup();
+
+	auto us = clksrc->nanosec_to_clock(1000);
+	if (is_fail(us))
+		return us.cause();
+
+	const int shift = us.value() > 1 ? find_last_setbit(us.value()) : 0;
+
+	auto now = clksrc->update_clock();
+	if (is_fail(now))
+		return now.cause();
+
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+	for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+		void* mem = mem_alloc(sizeof (timer_wheel_store));
+		if (!mem)
+			return cause::NOMEM;
+
+		timer_store* store = new (mem)
+		    timer_wheel_store(get_cpu_node(i), shift, now.value());
+
+		tc->set_cpu_store(i, store);
+	}
+
+	return cause::OK;
+}
+
+#else  // CONFIG_TIMER_WHEEL
+
+/// clksrc が CPU ごとのタイマを持つときは CPU ごとに store を作る。
+cause::t setup_liner_store(timer_ctl* tc, clock_source* clksrc)
+{
+	timer_liner_store::setup();
+
+	const cpu_id_t store_nr =
+	    clksrc->is_per_cpu_timer() ? get_cpu_node_count() : 1;
+
+	for (cpu_id_t i = 0; i < store_nr; ++i) {
+		timer_store* liner_q =
+		    new (mem_alloc(sizeof (timer_liner_store))) timer_liner_store;
+		if (!liner_q)
+			return cause::NOMEM;
+
+		if (store_nr == 1)
+			tc->set_store(liner_q);
+		else
+			tc->set_cpu_store(i, liner_q);
+	}
+
+	return cause::OK;
+}
+
+#endif  // CONFIG_TIMER_WHEEL
+
+}  // namespace
 
 cause::t timer_setup()
 {
@@ -175,19 +501,19 @@ cause::t timer_setup()
 	if (is_fail(r))
 		return r;
 
-	timer_liner_store::setup();
-
-	timer_store* liner_q =
-	    new (mem_alloc(sizeof (timer_liner_store))) timer_liner_store;
-	if (!liner_q)
-		return cause::NOMEM;
-
 	timer_ctl* tc = new (mem_alloc(sizeof (timer_ctl))) timer_ctl;
 	if (!tc)
 		return cause::NOMEM;
 
 	tc->set_clock_source(clksrc);
-	tc->set_store(liner_q);
+
+#if CONFIG_TIMER_WHEEL
+	r = setup_wheel_stores(tc, clksrc);
+#else
+	r = setup_liner_store(tc, clksrc);
+#endif
+	if (is_fail(r))
+		return r;
 
 	global_vars::core.timer_ctl_obj = tc;
 
@@ -204,6 +530,34 @@ cause::t timer_set(timer_message* m)
 	return global_vars::core.timer_ctl_obj->set_timer(m);
 }
 
+cause::t timer_cancel(timer_message* m)
+{
+	return global_vars::core.timer_ctl_obj->cancel_timer(m);
+}
+
+cause::t timer_mod(timer_message* m, u64 nanosec_delay)
+{
+	return global_vars::core.timer_ctl_obj->mod_timer(m, nanosec_delay);
+}
+
+void timer_busy_wait(u64 nanosec)
+{
+	global_vars::core.timer_ctl_obj->busy_wait(nanosec);
+}
+
+/// @brief  この CPU が割込みを待つ前に、次のタイマの時刻を設定する。
+/// @retval true  満了したタイマを送ったので、割込みを待ってはならない。
+//
+/// 割込み禁止状態で呼び出す必要がある。
+bool timer_idle_enter()
+{
+	timer_ctl* tc = global_vars::core.timer_ctl_obj;
+	if (!tc)
+		return false;
+
+	return tc->idle_enter(arch::get_cpu_node_id());
+}
+
 
 // wakeup_thread_timer_message
 
@@ -41,6 +41,8 @@ cause::t timer_liner_store::setup()
 	    timer_store::call_on_timer_store_NextClock<timer_liner_store>;
 	ops.Post =
 	    timer_store::call_on_timer_store_Post<timer_liner_store>;
+	ops.Remove =
+	    timer_store::call_on_timer_store_Remove<timer_liner_store>;
 
 	return cause::OK;
 }
@@ -70,36 +72,51 @@ bool timer_liner_store::on_timer_store_Set(timer_message* new_msg)
 		msg_chain.push_back(new_msg);
 	}
 
-	return msg_chain.front() == new_msg;
+	auto front = msg_chain.front();
+
+	return front == new_msg || new_msg->latest_clock < front->latest_clock;
 }
 
+/// @brief  先頭のタイマの slack の範囲で、なるべく多くのタイマを送れる
+///         時刻を返す。
 cause::pair<tick_time> timer_liner_store::on_timer_store_NextClock()
 {
-	auto next_msg = msg_chain.front();
+	auto msg = msg_chain.front();
 
-	if (next_msg) {
-		return cause::pair<tick_time>(
-		    cause::OK, next_msg->expires_clock);
-	} else {
+	if (!msg)
 		return cause::pair<tick_time>(cause::FAIL, tick_time(0));
+
+	tick_time clock = msg->latest_clock;
+
+	for (msg = msg_chain.next(msg); msg; msg = msg_chain.next(msg)) {
+		if (clock < msg->expires_clock)
+			break;
+		if (msg->latest_clock < clock)
+			clock = msg->latest_clock;
 	}
+
+	return cause::pair<tick_time>(cause::OK, clock);
 }
 
 cause::t timer_liner_store::on_timer_store_Post(tick_time clock)
 {
-	auto msg = msg_chain.front();
-
-	while (msg) {
-		auto next = msg_chain.next(msg);
+	for (;;) {
+		auto msg = msg_chain.front();
 
-		if (msg->expires_clock < clock) {
-			msg_chain.remove(msg);
-			post_message(msg);
-		}
+		// 満了時刻の順に並んでいる。
+		if (!msg || clock < msg->expires_clock)
+			break;
 
-		msg = next;
+		msg_chain.remove(msg);
+		msg->armed_store = nullptr;
+		post_message(msg);
 	}
 
 	return cause::OK;
 }
 
+void timer_liner_store::on_timer_store_Remove(timer_message* msg)
+{
+	msg_chain.remove(msg);
+}
+
@@ -0,0 +1,322 @@
+/// @file   timer_wheel.cc
+/// @brief  timer_wheel_store class implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/timer_wheel.hh>
+
+#include <core/cpu_node.hh>
+#include <util/bitops.hh>
+
+
+namespace {
+
+timer_store::operations timer_wheel_store_ops;
+
+}  // namespace
+
+
+cause::t timer_wheel_store::setup()
+{
+	timer_store::operations& ops = timer_wheel_store_ops;
+
+	ops.init();
+
+	ops.Set =
+	    timer_store::call_on_timer_store_Set<timer_wheel_store>;
+	ops.NextClock =
+	    timer_store::call_on_timer_store_NextClock<timer_wheel_store>;
+	ops.Post =
+	    timer_store::call_on_timer_store_Post<timer_wheel_store>;
+	ops.Remove =
+	    timer_store::call_on_timer_store_Remove<timer_wheel_store>;
+
+	return cause::OK;
+}
+
+/// @param[in] _owner        満了したタイマを送る CPU。
+/// @param[in] _clock_shift  1 granule の clock 数の log2。
+/// @param[in] now           現在の clock。
+timer_wheel_store::timer_wheel_store(
+    cpu_node* _owner, int _clock_shift, tick_time now) :
+	owner(_owner),
+	clock_shift(_clock_shift),
+	armed(false)
+{
+	ops = &timer_wheel_store_ops;
+
+	cur = to_granule(now);
+
+	for (int i = 0; i < LEVEL_CNT; ++i)
+		levels[i].occupied = 0;
+}
+
+/// @retval true  タイマの再設定が必要。
+/// @retval false 前に next_clock() で返した時刻より後のタイマだった。
+bool timer_wheel_store::on_timer_store_Set(timer_message* new_msg)
+{
+	insert(new_msg);
+
+	if (!armed || new_msg->latest_clock < armed_clock) {
+		armed = true;
+		armed_clock = new_msg->latest_clock;
+		return true;
+	}
+
+	return false;
+}
+
+/// @brief  次にタイマを設定する時刻を返す。
+//
+/// 一番早いタイマの latest_clock までに満了するタイマを level 0 から
+/// 集め、それらの latest_clock の最小値を返す。その時刻に post() すれば
+/// 集めたタイマを一度に送れる。
+/// 上位の level のスロットは cascade するまで中のタイマの時刻が分から
+/// ないので、cascade する時刻より後にはしない。
+cause::pair<tick_time> timer_wheel_store::on_timer_store_NextClock()
+{
+	u64 granule;
+	int level;
+	if (!next_event(&granule, &level)) {
+		armed = false;
+		return cause::pair<tick_time>(cause::FAIL, tick_time(0));
+	}
+
+	tick_time clock;
+	if (level == 0)
+		clock = coalesce_clock(granule);
+	else
+		clock = tick_time(granule << clock_shift);
+
+	armed = true;
+	armed_clock = clock;
+
+	return cause::pair<tick_time>(cause::OK, clock);
+}
+
+/// @brief  clock までに満了したタイマを owner へ送る。
+cause::t timer_wheel_store::on_timer_store_Post(tick_time clock)
+{
+	const u64 target = to_granule(clock);
+
+	for (;;) {
+		post_slot(cur & SLOT_MASK, clock);
+
+		if (cur >= target)
+			break;
+
+		u64 next;
+		int level;
+		if (!next_event(&next, &level) || next > target) {
+			// target までに処理するスロットは無い。
+			cur = target;
+			continue;
+		}
+
+		cur = next;
+
+		for (int i = LEVEL_CNT - 1; i > 0; --i)
+			cascade(i);
+	}
+
+	return cause::OK;
+}
+
+/// @brief  満了時刻で level とスロットを選んで msg を入れる。
+//
+/// 一番上の level にも入らない遠いタイマは一番上の level の最後の
+/// スロットに入れ、cascade するときに入れ直す。
+void timer_wheel_store::insert(timer_message* msg)
+{
+	u64 exp = to_granule(msg->expires_clock);
+	if (exp < cur)
+		exp = cur;
+
+	const u64 delta = exp - cur;
+
+	int level = 0;
+	while (level < LEVEL_CNT - 1 &&
+	       delta >= (U64(1) << (SLOT_BITS * (level + 1))))
+	{
+		++level;
+	}
+
+	const u64 range = U64(1) << (SLOT_BITS * LEVEL_CNT);
+	if (delta >= range)
+		exp = cur + range - 1;
+
+	const int slot = (exp >> (SLOT_BITS * level)) & SLOT_MASK;
+
+	levels[level].slots[slot].push_back(msg);
+	levels[level].occupied |= U64(1) << slot;
+
+	msg->store_slot = level * SLOT_CNT + slot;
+}
+
+void timer_wheel_store::on_timer_store_Remove(timer_message* msg)
+{
+	wheel_level& lv = levels[msg->store_slot / SLOT_CNT];
+	const int slot = msg->store_slot % SLOT_CNT;
+
+	lv.slots[slot].remove(msg);
+	if (lv.slots[slot].is_empty())
+		lv.occupied &= ~(U64(1) << slot);
+}
+
+/// @brief  cur が level のスロットの開始時刻ならば、スロットのタイマを
+///         下位の level へ入れ直す。
+void timer_wheel_store::cascade(int level)
+{
+	const int shift = SLOT_BITS * level;
+
+	if (cur & ((U64(1) << shift) - 1))
+		return;
+
+	const int slot = (cur >> shift) & SLOT_MASK;
+
+	wheel_level& lv = levels[level];
+	if (!(lv.occupied & (U64(1) << slot)))
+		return;
+
+	message_chain tmp;
+	lv.slots[slot].move_to(&tmp);
+	lv.occupied &= ~(U64(1) << slot);
+
+	while (timer_message* msg = tmp.pop_front())
+		insert(msg);
+}
+
+/// @brief  level 0 の slot から clock までに満了したタイマを送る。
+void timer_wheel_store::post_slot(int slot, tick_time clock)
+{
+	wheel_level& lv = levels[0];
+	message_chain& ch = lv.slots[slot];
+
+	timer_message* msg = ch.front();
+	while (msg) {
+		timer_message* next = ch.next(msg);
+
+		if (msg->expires_clock <= clock) {
+			ch.remove(msg);
+			msg->armed_store = nullptr;
+			arch::post_cpu_message(msg, owner);
+		}
+
+		msg = next;
+	}
+
+	if (ch.is_empty())
+		lv.occupied &= ~(U64(1) << slot);
+}
+
+/// @brief  cur より後で最初に処理が必要な granule を探す。
+/// @param[out] granule  level 0 のスロットの満了時刻か、上位の level の
+///                      スロットを cascade する時刻。
+/// @param[out] level    そのスロットの level。
+/// @param[in] first_level  この level 以上のスロットだけを調べる。
+/// @retval false タイマが無い。
+//
+/// level ごとにビットマップを cur の位置から 1 回だけ調べるので、
+/// タイマの数に関係なく O(LEVEL_CNT) で終わる。
+bool timer_wheel_store::next_event(
+    u64* granule, int* level, int first_level) const
+{
+	bool found = false;
+
+	for (int i = first_level; i < LEVEL_CNT; ++i) {
+		const u64 occupied = levels[i].occupied;
+		if (!occupied)
+			continue;
+
+		// level 0 は cur のスロットから、上位の level は cur の次の
+		// スロットから探す。cur のスロットは 1 周後になる。
+		int start = (cur >> (SLOT_BITS * i)) & SLOT_MASK;
+		if (i > 0)
+			++start;
+
+		const u64 upper =
+		    start < SLOT_CNT ? occupied & (~U64(0) << start) : 0;
+		const int slot = find_first_setbit(upper ? upper : occupied);
+
+		const u64 g = slot_granule(i, slot);
+		if (!found || g < *granule) {
+			*granule = g;
+			*level = i;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+/// @brief  level の slot を処理する granule を返す。
+u64 timer_wheel_store::slot_granule(int level, int slot) const
+{
+	const int shift = SLOT_BITS * level;
+	const int rot = shift + SLOT_BITS;
+
+	u64 g = ((cur >> rot) << rot) | (u64(slot) << shift);
+
+	if (level == 0 ? g < cur : g <= cur)
+		g += U64(1) << rot;
+
+	return g;
+}
+
+/// @brief  first から順に level 0 のスロットを調べて、まとめて送れる
+///         時刻を返す。
+/// @param[in] first  一番早いタイマが入っている level 0 のスロットの
+///                   granule。
+tick_time timer_wheel_store::coalesce_clock(u64 first)
+{
+	// 上位の level から cascade するタイマの時刻は分からない。
+	u64 limit;
+	int limit_level;
+	if (!next_event(&limit, &limit_level, 1))
+		limit = U64(-1);
+
+	message_chain& first_ch = levels[0].slots[first & SLOT_MASK];
+	tick_time clock = first_ch.front()->latest_clock;
+	for (timer_message* msg : first_ch) {
+		if (msg->latest_clock < clock)
+			clock = msg->latest_clock;
+	}
+
+	// level 0 の 1 周の中で、clock までに満了するタイマを集める。
+	for (u64 g = first + 1; g < first + SLOT_CNT; ++g) {
+		if (tick_time(g << clock_shift) > clock || g >= limit)
+			break;
+
+		const int slot = g & SLOT_MASK;
+		if (!(levels[0].occupied & (U64(1) << slot)))
+			continue;
+
+		for (timer_message* msg : levels[0].slots[slot]) {
+			if (msg->expires_clock <= clock &&
+			    msg->latest_clock < clock)
+			{
+				clock = msg->latest_clock;
+			}
+		}
+	}
+
+	if (limit != U64(-1) && tick_time(limit << clock_shift) < clock)
+		clock = tick_time(limit << clock_shift);
+
+	return clock;
+}
+
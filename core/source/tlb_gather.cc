@@ -0,0 +1,191 @@
+/// @file   tlb_gather.cc
+/// @brief  tlb_gather class implements.
+
+//  Uniqos  --  Unique Operating System
+//  (C) 2018 KATO Takeshi
+//
+//  Uniqos is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  any later version.
+//
+//  Uniqos is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <core/tlb_gather.hh>
+
+#include <core/cpu_node.hh>
+#include <core/log.hh>
+#include <core/new_ops.hh>
+#include <core/page.hh>
+
+
+/// @param[in] _pgtbl  変更するページテーブル。
+///                    nullptr のときは使用中のページテーブル。
+/// @param[in] _mode   アドレス空間の状態。
+tlb_gather::tlb_gather(page_table* _pgtbl, MODE _mode) :
+	pgtbl(_pgtbl ? _pgtbl : arch::page::get_table()),
+	own_pgtbl(_pgtbl == nullptr),
+	mode(_mode),
+	table_page_cnt(0)
+{
+	clear_range();
+}
+
+tlb_gather::~tlb_gather()
+{
+	if (!is_empty() || table_page_cnt > 0)
+		log()(SRCPOS)("!!! tlb_gather is not finished.")();
+
+	if (own_pgtbl)
+		arch::page::unget_table(pgtbl);
+}
+
+/// @brief  level のページを 1 つ外す。
+cause::t tlb_gather::unmap(uptr vadr, page_level level)
+{
+	return unmap_range(vadr, vadr + page_size_of_level(level) - 1);
+}
+
+/// @brief  low_vadr から high_vadr までに割り当てたページを全て外す。
+cause::t tlb_gather::unmap_range(uptr low_vadr, uptr high_vadr)
+{
+	return arch::page::unmap_range(pgtbl, low_vadr, high_vadr, this);
+}
+
+/// @brief  フラッシュする範囲に vadr から bytes を加える。
+/// @param[in] global  ページがグローバルページならば true。
+void tlb_gather::add_range(uptr vadr, uptr bytes, bool _global)
+{
+	if (vadr < range_low)
+		range_low = vadr;
+	if (range_high < vadr + bytes - 1)
+		range_high = vadr + bytes - 1;
+	if (bytes < stride)
+		stride = bytes;
+
+	global = global && _global;
+}
+
+/// @brief  フラッシュした後で解放するページテーブルを加える。
+//
+/// ページテーブルは親のエントリから外してあること。
+cause::t tlb_gather::add_table_page(uptr padr)
+{
+	if (table_page_cnt >= TABLE_PAGE_MAX) {
+		cause::t r = flush();
+		if (is_fail(r))
+			return r;
+	}
+
+	table_pages[table_page_cnt++] = padr;
+
+	return cause::OK;
+}
+
+/// @brief  集めた範囲の TLB をフラッシュして、ページテーブルを解放する。
+//
+/// ACTIVE のときは他の CPU のフラッシュが終わるまで待つ。
+cause::t tlb_gather::finish()
+{
+	return flush();
+}
+
+void tlb_gather::clear_range()
+{
+	range_low = UPTR(-1);
+	range_high = 0;
+	stride = UPTR(-1);
+	global = true;
+}
+
+cause::t tlb_gather::flush()
+{
+	if (mode == ACTIVE && !is_empty())
+		flush_cpus();
+
+	clear_range();
+
+	cause::t r = cause::OK;
+	for (int i = 0; i < table_page_cnt; ++i) {
+		cause::t r2 = page_dealloc(arch::page::PHYS_L1, table_pages[i]);
+		if (is_fail(r2)) {
+			log()(SRCPOS)("!!! page_dealloc() failed. r=").u(r2)();
+			r = r2;
+		}
+	}
+	table_page_cnt = 0;
+
+	return r;
+}
+
+/// @brief  online の全ての CPU の TLB をフラッシュする。
+//
+/// 各 CPU へ cpu_call を 1 つずつ送ってから、まとめて終了を待つ。
+/// cpu_call を確保できなかったときは 1 つずつ送って待つ。
+void tlb_gather::flush_cpus()
+{
+	const cpu_id_t cpu_nr = get_cpu_node_count();
+
+	cpu_call* calls =
+	    static_cast<cpu_call*>(mem_alloc(sizeof (cpu_call) * cpu_nr));
+
+	if (!calls) {
+		cpu_call call;
+		call.func = flush_on_cpu;
+		call.arg = this;
+		for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+			cpu_node* cn = get_cpu_node(i);
+			if (!cn->is_online())
+				continue;
+			arch::call_on_cpu(cn, &call);
+			arch::wait_cpu_call(&call);
+		}
+		return;
+	}
+
+	{
+		// 自分の CPU を決めてから IPI を送り終えるまで、他の CPU へ
+		// 移動しないようにする。自分の CPU では call_on_cpu() の中で
+		// 直接フラッシュする。
+		preempt_disable_section _pds;
+
+		for (cpu_id_t i = 0; i < cpu_nr; ++i) {
+			cpu_node* cn = get_cpu_node(i);
+			calls[i].done = true;
+			if (!cn->is_online())
+				continue;
+
+			calls[i].func = flush_on_cpu;
+			calls[i].arg = this;
+			arch::call_on_cpu(cn, &calls[i]);
+		}
+	}
+
+	for (cpu_id_t i = 0; i < cpu_nr; ++i)
+		arch::wait_cpu_call(&calls[i]);
+
+	mem_dealloc(calls);
+}
+
+/// @brief  この CPU の TLB をフラッシュする。
+void tlb_gather::flush_local()
+{
+	const uptr pages = (range_high - range_low) / stride + 1;
+
+	if (pages > FLUSH_ALL_THRESHOLD)
+		arch::page::clear_tlb_all();
+	else
+		arch::page::clear_tlb_range(range_low, range_high, stride, global);
+}
+
+void tlb_gather::flush_on_cpu(void* arg)
+{
+	static_cast<tlb_gather*>(arg)->flush_local();
+}
+
@@ -23,6 +23,7 @@
 #include <core/global_vars.hh>
 #include <core/log.hh>
 #include <core/new_ops.hh>
+#include <core/tlb_gather.hh>
 
 
 // vadr_pool::resource
@@ -104,38 +105,51 @@ cause::pair<void*> vadr_pool::assign(
 }
 
 /// @brief 仮想アドレスを返却する。
+//
+/// 全ての CPU の TLB をフラッシュしてから pool_chain へ戻す。
+/// フラッシュは他の CPU を待つので、lock を外してから行う。
+/// その間 res はどちらの chain にも入っていないので再利用されない。
 cause::t vadr_pool::revoke(void* vadr)
 {
-	spin_lock_section _sls(lock);
+	tlb_gather tg(nullptr, tlb_gather::ACTIVE);
 
 	uptr _vadr = reinterpret_cast<uptr>(vadr);
 
 	resource* res = nullptr;
-	for (resource* _res : assign_chain) {
-		if(_res->vadr_range.test(_vadr)) {
-			res = _res;
-			break;
+	{
+		spin_lock_section _sls(lock);
+
+		for (resource* _res : assign_chain) {
+			if(_res->vadr_range.test(_vadr)) {
+				res = _res;
+				break;
+			}
 		}
-	}
 
-	if (!res)
-		return cause::NOENT;
+		if (!res)
+			return cause::NOENT;
 
-	--res->ref_cnt;
+		--res->ref_cnt;
 
-	if (res->ref_cnt == 0) {
-		assign_chain.remove(res);
-		cause::t r = page_unmap(nullptr,
-		                        res->vadr_range.low_adr(),
-		                        res->pagelevel);
-		if (is_fail(r))
-			log()(SRCPOS)("!!! page_unmap() failed.")();
+		if (res->ref_cnt != 0)
+			return cause::OK;
 
-		r = merge_pool(res);
+		assign_chain.remove(res);
+		cause::t r = tg.unmap(res->vadr_range.low_adr(), res->pagelevel);
 		if (is_fail(r))
-			log()(SRCPOS)("!!! vadr_pool::merge_pool() failed")();
+			log()(SRCPOS)("!!! tlb_gather::unmap() failed.")();
 	}
 
+	cause::t r = tg.finish();
+	if (is_fail(r))
+		log()(SRCPOS)("!!! tlb_gather::finish() failed.")();
+
+	spin_lock_section _sls(lock);
+
+	r = merge_pool(res);
+	if (is_fail(r))
+		log()(SRCPOS)("!!! vadr_pool::merge_pool() failed")();
+
 	return cause::OK;
 }
 
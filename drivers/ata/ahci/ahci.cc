@@ -710,40 +710,30 @@ cause::t ahci_driver::scan()
 auto ahci_driver::acquire_table_alloc(uptr bytes)
 -> cause::pair<table_alloc*>
 {
-	sptr table_chunk_bytes = sizeof (COMMAND_HEADER) * CMD_HDR_NR;
-
-	page_level pg_lv = page_level_of_size(table_chunk_bytes);
-	uptr pg_sz = page_size_of_level(pg_lv);
-
 	tbl_alloc_lock.lock();
 
 	uptr free_bytes = tbl_alloc.total_free_bytes(TABLE_ALLOC_SLOT_MASK);
 	sptr want_bytes = bytes - free_bytes;
 
-	for (;;) {
-		if (want_bytes <= 0)
-			break;
-		if (want_bytes < table_chunk_bytes) {
-			pg_lv = page_level_of_size(want_bytes);
-			pg_sz = page_size_of_level(pg_lv);
-		}
+	if (want_bytes > 0) {
+		// 足りない分を物理的に連続したページでまとめて確保する。
+		const uptr pages = up_div<uptr>(want_bytes, arch::page::L1_SIZE);
 
-		auto padr = page_alloc(pg_lv);
-		if (is_fail(padr)) {
+		uptr padr;
+		auto r = page_alloc_contig(pages, arch::page::L1_SIZE, &padr);
+		if (is_fail(r)) {
 			tbl_alloc_lock.unlock();
-			log()(SRCPOS)(":page_alloc() failed. r=").u(padr.cause())();
-			return null_pair(padr.cause());
+			log()(SRCPOS)(":page_alloc_contig() failed. r=").u(r)();
+			return null_pair(r);
 		}
 
-		bool r = tbl_alloc.add_free(
-		    TABLE_ALLOC_SLOT, padr.value(), pg_sz);
-		if (!r) {
+		bool r2 = tbl_alloc.add_free(
+		    TABLE_ALLOC_SLOT, padr, pages * arch::page::L1_SIZE);
+		if (!r2) {
 			tbl_alloc_lock.unlock();
 			log()(SRCPOS)(":add_free() failed.")();
 			return null_pair(cause::FAIL);
 		}
-
-		want_bytes -= pg_sz;
 	}
 
 	return make_pair(cause::OK, &tbl_alloc);
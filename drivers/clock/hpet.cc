@@ -268,8 +268,11 @@ cause::t hpet::setup()
 
 	regs->disable();
 	regs->counter = 0;
+#if !CONFIG_NO_HZ
+	// NO_HZ のときは周期タイマで CPU を起こさない。
 	regs->set_periodic_timer(TIMER_0, 1000000 /* 1sec */, 0);
 	//regs->set_periodic_timer(TIMER_0, _1sec_clks.value, 0);
+#endif  // !CONFIG_NO_HZ
 	regs->enable_legrep();
 
 	regs->set_nonperiodic_timer(TIMER_1, 2);
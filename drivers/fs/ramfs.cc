@@ -17,8 +17,10 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <arch.hh>
 #include <core/fs_ctl.hh>
 #include <core/log.hh>
+#include <core/page.hh>
 #include <util/string.hh>
 
 
@@ -29,6 +31,64 @@ const char driver_name_ramfs[] = "ramfs";
 class ramfs_reg_node;
 class ramfs_io_node;
 
+/// @brief  ファイルのデータページを索引する基数木。
+//
+/// 節は 1 ページで ENTRY_NR 個の子を持ち、葉は PAGE_SIZE のデータページ。
+/// 高さ h の木は PAGE_SIZE * ENTRY_NR^h バイトを表し、高さ 0 の木は
+/// root がデータページそのものになる。ファイルが大きくなったら根の上に
+/// 節を足して高くする。
+///
+/// 高さ 2 の節の子には、高さ 1 の節の代わりに HUGE_SIZE のページを
+/// 入れることができる。HUGE_SIZE の範囲をまとめて書き込むときに使う。
+///
+/// 書き込んでいないページは nullptr のままにしておき、穴として扱う。
+class ramfs_page_tree
+{
+	DISALLOW_COPY_AND_ASSIGN(ramfs_page_tree);
+
+public:
+	enum {
+		PAGE_SIZE  = arch::page::PHYS_L1_SIZE,
+		HUGE_SIZE  = arch::page::PHYS_L2_SIZE,
+		HUGE_PAGES = HUGE_SIZE / PAGE_SIZE,
+
+		ENTRY_BITS = 9,
+		ENTRY_NR   = 1 << ENTRY_BITS,
+		ENTRY_MASK = ENTRY_NR - 1,
+	};
+
+public:
+	ramfs_page_tree() : root(0), height(0) {}
+
+	u8* lookup(uptr page_idx) const;
+	cause::pair<u8*> get_page(uptr page_idx, bool huge);
+	void destroy();
+
+private:
+	enum {
+		/// エントリが HUGE_SIZE のページならばセットする。
+		HUGE = 0x1,
+	};
+
+	/// 高さ h の木が表すページ数の log2。
+	static int index_bits(int h) { return h * ENTRY_BITS; }
+	bool covers(uptr page_idx) const {
+		return index_bits(height) >= 64 ||
+		       (page_idx >> index_bits(height)) == 0;
+	}
+
+	cause::t grow(uptr page_idx);
+
+	static u8* alloc_page(page_level lv, bool zero);
+	static void free_page(page_level lv, uptr vadr);
+	static void release(uptr entry, int h);
+
+private:
+	/// 各エントリは子の節かデータページのカーネル仮想アドレス。
+	uptr root;
+	int  height;
+};
+
 class ramfs_driver : public fs_driver
 {
 public:
@@ -66,7 +126,6 @@ public:
 	ramfs_driver* get_driver() {
 		return static_cast<ramfs_driver*>(fs_mount::get_driver());
 	}
-	mempool* get_block_mp() { return block_mp; }
 
 	cause::t mount(const char* dev);
 
@@ -90,9 +149,6 @@ public:
 private:
 	cause::pair<io_node*> create_io_node(ramfs_reg_node* fsn);
 	cause::t destroy_io_node(ramfs_io_node* ion);
-
-private:
-	mempool* block_mp;
 };
 
 /// opened file node
@@ -138,7 +194,7 @@ public:
 private:
 	ramfs_io_node ramfs_ion;
 	uptr size_bytes;
-	u8* blocks[8];
+	ramfs_page_tree pages;
 };
 
 /// directory node
@@ -260,8 +316,7 @@ cause::t ramfs_driver::on_Unmount(
 // ramfs_mount
 
 ramfs_mount::ramfs_mount(ramfs_driver* drv) :
-	fs_mount(drv, drv->get_fs_mount_ifs()),
-	block_mp(nullptr)
+	fs_mount(drv, drv->get_fs_mount_ifs())
 {
 }
 
@@ -272,12 +327,6 @@ cause::t ramfs_mount::mount(const char*)
 	if (!root)
 		return cause::NOMEM;
 
-	auto mp = mempool::acquire_shared(8196);
-	if (is_fail(mp))
-		return mp.cause();
-
-	block_mp = mp.value();
-
 	return cause::OK;
 }
 
@@ -422,6 +471,158 @@ cause::pair<dir_entry*> ramfs_io_node::on_GetDirEntry(
 }
 
 
+// ramfs_page_tree
+
+/// @brief  page_idx のデータページを返す。
+/// @return  ページが無ければ nullptr を返す。
+u8* ramfs_page_tree::lookup(uptr page_idx) const
+{
+	if (!covers(page_idx))
+		return nullptr;
+
+	uptr e = root;
+	for (int h = height; h > 0; --h) {
+		if (!e)
+			return nullptr;
+
+		const uptr* node = reinterpret_cast<const uptr*>(e);
+		e = node[(page_idx >> index_bits(h - 1)) & ENTRY_MASK];
+
+		if (e & HUGE) {
+			return reinterpret_cast<u8*>(e & ~HUGE) +
+			       (page_idx % HUGE_PAGES) * PAGE_SIZE;
+		}
+	}
+
+	return reinterpret_cast<u8*>(e);
+}
+
+/// @brief  page_idx のデータページを返す。無ければ作る。
+/// @param[in] huge  page_idx から HUGE_SIZE の範囲を全て書き込むならば
+///                  true。HUGE_SIZE のページを作ってもよい。
+//
+/// 新しく作ったページは 0 で埋める。ただし HUGE_SIZE のページは全て
+/// 書き込まれるので埋めない。
+cause::pair<u8*> ramfs_page_tree::get_page(uptr page_idx, bool huge)
+{
+	// HUGE_SIZE のページは高さ 2 以上の節にしか入らない。
+	cause::t r = grow(huge ? max<uptr>(page_idx, ENTRY_NR) : page_idx);
+	if (is_fail(r))
+		return null_pair(r);
+
+	uptr* slot = &root;
+	for (int h = height; h > 0; --h) {
+		if (!*slot) {
+			u8* node = alloc_page(arch::page::PHYS_L1, true);
+			if (!node)
+				return null_pair(cause::NOMEM);
+			*slot = reinterpret_cast<uptr>(node);
+		}
+
+		uptr* node = reinterpret_cast<uptr*>(*slot);
+		slot = &node[(page_idx >> index_bits(h - 1)) & ENTRY_MASK];
+
+		if (*slot & HUGE) {
+			return cause::make_pair(cause::OK,
+			    reinterpret_cast<u8*>(*slot & ~HUGE) +
+			    (page_idx % HUGE_PAGES) * PAGE_SIZE);
+		}
+
+		if (h == 2 && huge && !*slot) {
+			// 失敗したら PAGE_SIZE のページを使う。
+			u8* page = alloc_page(arch::page::PHYS_L2, false);
+			if (page) {
+				*slot = reinterpret_cast<uptr>(page) | HUGE;
+				return cause::make_pair(cause::OK, page);
+			}
+		}
+	}
+
+	if (!*slot) {
+		u8* page = alloc_page(arch::page::PHYS_L1, true);
+		if (!page)
+			return null_pair(cause::NOMEM);
+		*slot = reinterpret_cast<uptr>(page);
+	}
+
+	return cause::make_pair(cause::OK, reinterpret_cast<u8*>(*slot));
+}
+
+/// @brief  全てのページを解放する。
+void ramfs_page_tree::destroy()
+{
+	release(root, height);
+
+	root = 0;
+	height = 0;
+}
+
+/// @brief  page_idx が入るまで木を高くする。
+cause::t ramfs_page_tree::grow(uptr page_idx)
+{
+	while (!covers(page_idx)) {
+		if (root) {
+			u8* node = alloc_page(arch::page::PHYS_L1, true);
+			if (!node)
+				return cause::NOMEM;
+
+			reinterpret_cast<uptr*>(node)[0] = root;
+			root = reinterpret_cast<uptr>(node);
+		}
+
+		++height;
+	}
+
+	return cause::OK;
+}
+
+u8* ramfs_page_tree::alloc_page(page_level lv, bool zero)
+{
+	uptr padr;
+	cause::t r = page_alloc(lv, &padr);
+	if (is_fail(r))
+		return nullptr;
+
+	const uptr size = lv == arch::page::PHYS_L1 ? PAGE_SIZE : HUGE_SIZE;
+	u8* page = static_cast<u8*>(arch::map_phys_adr(padr, size));
+	if (zero)
+		mem_fill(0, page, size);
+
+	return page;
+}
+
+void ramfs_page_tree::free_page(page_level lv, uptr vadr)
+{
+	const uptr size = lv == arch::page::PHYS_L1 ? PAGE_SIZE : HUGE_SIZE;
+	const uptr padr =
+	    arch::unmap_phys_adr(reinterpret_cast<void*>(vadr), size);
+
+	cause::t r = page_dealloc(lv, padr);
+	if (is_fail(r))
+		log()(SRCPOS)("!!! page_dealloc() failed. r=").u(r)();
+}
+
+/// @brief  高さ h の entry 以下のページを全て解放する。
+void ramfs_page_tree::release(uptr entry, int h)
+{
+	if (!entry)
+		return;
+
+	if (entry & HUGE) {
+		free_page(arch::page::PHYS_L2, entry & ~HUGE);
+		return;
+	}
+
+	if (h > 0) {
+		const uptr* node = reinterpret_cast<const uptr*>(entry);
+		for (int i = 0; i < ENTRY_NR; ++i)
+			release(node[i], h - 1);
+	}
+
+	free_page(arch::page::PHYS_L1, entry);
+}
+
+
 // ramfs_reg_node
 
 ramfs_reg_node::ramfs_reg_node(ramfs_mount* owner) :
@@ -429,90 +630,72 @@ ramfs_reg_node::ramfs_reg_node(ramfs_mount* owner) :
 	ramfs_ion(owner->get_driver()->get_io_node_ifs(), this),
 	size_bytes(0)
 {
-	for (uint i = 0; i < num_of_array(blocks); ++i)
-		blocks[i] = nullptr;
 }
 
 cause::t ramfs_reg_node::destroy()
 {
-	mempool* block_mp = get_owner()->get_block_mp();
-
-	for (uint i = 0; i < num_of_array(blocks); ++i) {
-		if (blocks[i]) {
-			auto r = block_mp->release(blocks[i]);
-		}
-	}
+	pages.destroy();
+	size_bytes = 0;
 
 	return cause::OK;
 }
 
+/// @brief  off から bytes を data へ読み込む。
+//
+/// ファイルの末尾を超えた分は読まない。書き込んでいないページは 0 を返す。
 cause::pair<uptr> ramfs_reg_node::read(uptr off, void* data, uptr bytes)
 {
-	mempool* block_mp = get_owner()->get_block_mp();
-	const uptr block_size = block_mp->get_obj_size();
+	const uptr page_size = ramfs_page_tree::PAGE_SIZE;
 
-	const uptr start_blk = off / block_size;
+	if (off >= size_bytes)
+		return make_pair(cause::OK, uptr(0));
+
+	bytes = min(bytes, size_bytes - off);
 
 	u8* _data = static_cast<u8*>(data);
 	uptr read_bytes = 0;
-	for (uptr blk = start_blk;
-	     blk < (num_of_array(blocks) - 1) && bytes > 0;
-	     ++blk)
-	{
-		uptr start = off - block_size * blk;
-		if (start >= size_bytes)
-			break;
-
-		uptr size = min(bytes, block_size - start);
-		if ((start + size) >= size_bytes)
-			size = size_bytes - off;
-
-		if (!blocks[blk]) {
+	while (read_bytes < bytes) {
+		const uptr start = off % page_size;
+		const uptr size = min(bytes - read_bytes, page_size - start);
+
+		const u8* page = pages.lookup(off / page_size);
+		if (page)
+			mem_copy(&page[start], _data, size);
+		else
 			mem_fill(0, _data, size);
-		} else {
-			mem_copy(&blocks[blk][start], _data, size);
 
-			off += size;
-			_data += size;
-			bytes -= size;
-			read_bytes += size;
-		}
+		off += size;
+		_data += size;
+		read_bytes += size;
 	}
 
 	return make_pair(cause::OK, read_bytes);
 }
 
+/// @brief  data から bytes を off へ書き込む。
+//
+/// ページが確保できなければ、そこまでに書き込んだバイト数を返す。
 cause::pair<uptr> ramfs_reg_node::write(uptr off, const void* data, uptr bytes)
 {
-	mempool* block_mp = get_owner()->get_block_mp();
-	const uptr block_size = block_mp->get_obj_size();
-
-	const uptr start_blk = off / block_size;
+	const uptr page_size = ramfs_page_tree::PAGE_SIZE;
+	const uptr huge_size = ramfs_page_tree::HUGE_SIZE;
 
 	const u8* _data = static_cast<const u8*>(data);
 	uptr write_bytes = 0;
-	for (uptr blk = start_blk;
-	     blk < (num_of_array(blocks) - 1) && bytes > 0;
-	     ++blk)
-	{
-		u8* block;
-		if (!blocks[blk]) {
-			auto b = block_mp->acquire();
-			if (is_fail(b))
-				return make_pair(cause::NOMEM, write_bytes);
-
-			blocks[blk] = static_cast<u8*>(b.value());
-			mem_fill(0, blocks[blk], block_size);
-		}
-		block = blocks[blk];
+	while (write_bytes < bytes) {
+		const uptr rest = bytes - write_bytes;
+		const bool huge = off % huge_size == 0 && rest >= huge_size;
+
+		auto page = pages.get_page(off / page_size, huge);
+		if (is_fail(page))
+			return make_pair(page.cause(), write_bytes);
 
-		uptr start = off - block_size * blk;
-		uptr size = min(bytes, block_size - start);
-		mem_copy(_data, &block[start], size);
+		const uptr start = off % page_size;
+		const uptr size = min(rest, page_size - start);
+		mem_copy(_data, &page.value()[start], size);
 
 		off += size;
 		_data += size;
-		bytes -= size;
 		write_bytes += size;
 
 		if (off > size_bytes)